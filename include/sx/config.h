@@ -102,6 +102,16 @@
 #   define SX_CONFIG_INCLUDE_BANNED 0
 #endif
 
+// Records job system events for profiling, see jobs.h. Nothing is compiled in when it's disabled
+#ifndef SX_CONFIG_JOBS_PROFILE
+#   define SX_CONFIG_JOBS_PROFILE 0
+#endif
+
+// Collects contention stats in every sx_lock_adaptive_t, see lockless.h
+#ifndef SX_CONFIG_LOCK_STATS
+#   define SX_CONFIG_LOCK_STATS 0
+#endif
+
 #ifndef SX_CONFIG_OBSOLETE_CODE
 #   define SX_CONFIG_OBSOLETE_CODE 0
 #endif
\ No newline at end of file
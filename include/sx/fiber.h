@@ -18,6 +18,24 @@
 //      sx_fiber_stack_init_ptr initializes stack object without allocating any memory
 //                              this function is useful for allocating virtual memory
 //                              (see virtual-alloc.h) yourself and pass the pointer to this function
+//      sx_fiber_stack_init_growable
+//                              reserves `max_size` of virtual memory for the stack, but only commits
+//                              `commit_size` bytes at the top. The lowest page is a guard page.
+//                              Pages below the committed region are committed as the fiber touches
+//                              them, so you can reserve for the worst case and have thousands of
+//                              fibers with small memory footprint. Release with sx_fiber_stack_release
+//      sx_fiber_stack_usage    returns the high-water mark of the stack in bytes (page granularity)
+//                              which is the deepest point that the fiber has ever touched
+//      sx_fiber_stack_commit_size
+//                              returns the bytes of the stack that are backed by physical memory
+//      sx_fiber_stack_acquire  gets a growable stack from the global (thread-safe) stack cache
+//                              stack sizes are rounded up to the power-of-two size classes
+//                              (16kb..8mb), larger stacks are not cached
+//      sx_fiber_stack_recycle  puts the stack back into the cache and gives its physical memory
+//                              back to the OS, except the top 16kb which is used by every fiber
+//                              If the cache is full, the stack is released
+//      sx_fiber_stack_cache_trim
+//                              releases all stacks in the cache, call it at shutdown
 //      sx_fiber_stack          fiber_stack object, must be initialized by 'sx_fiber_stack_init' or
 //                              'sx_fiber_stack_init_ptr'
 //
@@ -61,13 +79,26 @@
 // update the context. So when you invoke a coroutine, it will run it like a normal function,
 // but you can return in the middle of the it and continue on some other time.
 // NOTE that the context API is not thread-safe, so the context-related functions must be called
-// within one thread only
+// within one thread only, unless the context is created by `sx_coro_create_context_jobs`
+// Fiber stacks of coroutines are taken from the global stack cache (see sx_fiber_stack_acquire) and
+// returned to it when they end, so they are reused between all contexts
 //
 //      sx_coro_create_context     creates fiber context (fiber pool)
 //                                  max_fibers is the maximum number of fibers in the pool
 //                                  (actual count of running 'invokes')
 //                                  stack_sz is the size of fiber stack is bytes,
 //                                  must be more than sx_os_minstacksz()
+//      sx_coro_create_context_jobs
+//                                 same as sx_coro_create_context, but woken coroutines are resumed
+//                                 in parallel by jobs of `job_ctx`, and sx_coro_update waits for
+//                                 them to yield. sx_coro_invoke is thread-safe and can be called
+//                                 from any thread or job, the coroutine runs on the calling thread
+//                                 until it yields for the first time.
+//                                 sx_coro_update must be called from the thread that created
+//                                 `job_ctx` or from inside a job, because it helps the workers
+//                                 while it waits for the coroutines (asserts otherwise).
+//                                 sx_coro_update, sx_coro_replace_callback and
+//                                 sx_coro_destroy_context must not overlap each other
 //      sx_coro_destroy_context    destroys fiber context
 //
 //  MACROS
@@ -81,6 +112,8 @@
 //      sx_coro_yieldn             yields current coroutine and gets back to it after N updates
 //      sx_coro_update             Updates fiber-context state with a delta-time as input.
 //                                 In the game this should be called on each frame
+//                                 Waiting coroutines are kept in timer wheels, so the cost is
+//                                 proportional to the coroutines that wake up, not the sleeping ones
 //      sx_coro_end                Exits the fiber execution and returns to program,
 //                                 This function MUST be called whenever you want to exit the coro
 // Example:
@@ -112,8 +145,10 @@
 #include "macros.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef struct sx_alloc sx_alloc;
+typedef struct sx_job_context sx_job_context;
 
 #define SX_FIBER_INVALID NULL
 
@@ -135,6 +170,8 @@ typedef void(sx_fiber_cb)(sx_fiber_transfer transfer);
 typedef struct sx_coro_context sx_coro_context;
 
 SX_API sx_coro_context* sx_coro_create_context(const sx_alloc* alloc, int num_initial_fibers, int stack_sz);
+SX_API sx_coro_context* sx_coro_create_context_jobs(const sx_alloc* alloc, int num_initial_fibers,
+                                                    int stack_sz, sx_job_context* job_ctx);
 SX_API void sx_coro_destroy_context(sx_coro_context* ctx);
 SX_API void sx_coro_update(sx_coro_context* ctx, float dt);
 SX_API bool sx_coro_replace_callback(sx_coro_context* ctx, sx_fiber_cb* callback,
@@ -158,6 +195,13 @@ SX_API void sx__coro_yield(sx_coro_context* ctx, sx_fiber_t* pfrom, int nupdates
 SX_API bool sx_fiber_stack_init(sx_fiber_stack* fstack, unsigned int size sx_default(0));
 SX_API void sx_fiber_stack_init_ptr(sx_fiber_stack* fstack, void* ptr, unsigned int size);
 SX_API void sx_fiber_stack_release(sx_fiber_stack* fstack);
+SX_API bool sx_fiber_stack_init_growable(sx_fiber_stack* fstack, unsigned int max_size,
+                                         unsigned int commit_size sx_default(0));
+SX_API size_t sx_fiber_stack_usage(const sx_fiber_stack* fstack);
+SX_API size_t sx_fiber_stack_commit_size(const sx_fiber_stack* fstack);
+SX_API bool sx_fiber_stack_acquire(sx_fiber_stack* fstack, unsigned int size sx_default(0));
+SX_API void sx_fiber_stack_recycle(sx_fiber_stack* fstack);
+SX_API void sx_fiber_stack_cache_trim(void);
 
 SX_API sx_fiber_t sx_fiber_create(const sx_fiber_stack stack, sx_fiber_cb* fiber_cb);
 SX_API sx_fiber_transfer sx_fiber_switch(const sx_fiber_t to, void* user);
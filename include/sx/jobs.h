@@ -7,18 +7,22 @@
 //
 // Job dispatcher is a multi-threaded task scheduler, that uses lightweight fibers to switch
 //      contexts and schedule jobs.
-//      Jobs are converted into fibers and pushed to a list that are picked up by worker threads
+//      Jobs are converted into fibers and pushed to the dispatching thread's work-stealing queue.
+//      Worker threads pick them up from their own queue or steal from other threads when idle
 //      Worker threads pickup fibers and switch to them. When dependencies and nested jobs are
 //      created, they are immediately rescheduled to threads and replace the current job they are
 //      doing. Threads can also get back and continue the job when dependencies are met.
 //      This makes this scheduler powerfull in terms of shceduling and not blocking the threads to
 //      wait for dependencies there is also no need to create dependency graphs before submitting
 //      jobs.
+//      Dependencies can also be declared up-front (see sx_job_dispatch_desc), in that case the
+//      dispatch is deferred and released by the last finished dependency, without any thread
+//      waiting on them.
 //
 // Types:
 //      sx_job_priorty      Job priority, higher priority jobs will run sooner
 //      sx_job_desc         Job description, required for submitting jobs, includes a job function,
-//                          priority and user data
+//                          priority, user data and optional dependencies (see sx_job_dispatch_desc)
 // API:
 //      sx_job_create_context       Create the job context (manager)
 //                                  - num_threads: number of worker threads, usually one less that
@@ -28,10 +32,15 @@
 //                                                 main thread.
 //                                                 if num_threads = -1, the dispatcher will
 //                                                 automatically spawn num_cpu_cores-1 threads.
-//                                  - max_fibers: Total number of fibers that users can create
-//                                                This is actually the total number of sx_job_desc
-//                                                submitted that are still active
+//                                  - max_fibers: Page size of the job pool. There is no limit on the
+//                                                number of active jobs, the pool grows by this
+//                                                many jobs whenever it's full
 //                                                (see sx_job_dispatch)
+//                                  - max_handles: Maximum number of sx_job_t handles that are
+//                                                 dispatched and not yet deleted. Handles are
+//                                                 allocated without locks from a fixed array, if
+//                                                 all of them are in use, dispatch asserts and
+//                                                 returns zero. Use sx_job_num_handles to monitor.
 //                                  - fiber_stack_sz: Stack size of fibers in bytes
 //                                                    This parameter depends on how much work you
 //                                                    will do inside job functions.
@@ -39,6 +48,35 @@
 //                                                    get stack overflow exception.
 //                                                    Usually a number between 128kb ~ 2mb is
 //                                                    sufficient.
+//                                                    Stacks are fetched from a per-thread cache
+//                                                    only when jobs start running, so memory
+//                                                    usage follows the number of running and
+//                                                    waiting jobs, not max_fibers
+//                                  - small_fiber_stack_sz: Stack size of the jobs that are
+//                                                          dispatched with SX_JOB_FLAG_SMALL_STACK
+//                                  - idle_spin_count/idle_max_pause: Idle policy of worker threads
+//                                                    Idle workers keep polling for new jobs with
+//                                                    exponential backoff before they go to sleep.
+//                                                    Sleeping workers are only woken up when there
+//                                                    are new jobs for them, so dispatching doesn't
+//                                                    make any syscalls while workers are awake.
+//                                                    More spinning means lower latency for bursts
+//                                                    of short jobs, but more wasted cpu time.
+//                                  - affinity: Placement policy of worker threads, see
+//                                              sx_job_affinity. With pinned workers, threads are
+//                                              grouped by NUMA node (see sx_os_cpu_topology) and
+//                                              idle workers steal from the threads of their own
+//                                              node before trying other nodes.
+//                                              Main thread is never pinned, but the first cpu is
+//                                              left for it and it's considered on that cpu's node.
+//                                              If num_threads is 0, it's derived from the policy
+//                                              (number of allowed logical cpus or physical cores)
+//                                  - starvation_us: Starvation protection of lower priorities.
+//                                                   Higher priority jobs run first, but if no job
+//                                                   of a lower priority has started for this long
+//                                                   while there are some in the queues, it jumps
+//                                                   ahead. So lower priorities keep progressing
+//                                                   under a steady load of high priority jobs.
 //      sx_job_destroy_context      Destroy the job context
 //      sx_job_dispatch             (Thread-Safe) Submit bunch of sub-jobs for the scheduler, this
 //                                  will return a valid sx_job_t handle that you can later wait on
@@ -57,28 +95,109 @@
 //                                              higher priority jobs gets executed earlier
 //                                  - tags: (default: 0) assigns work tag for the job. See below for
 //                                           more details on the concept of Tags
-//                                  NOTE: if max_fibers (running-jobs) is exceeded, job will be
-//                                        queued and automatically dispatched later on
-//                                        'sx_job_wait_and_del' and 'sx_job_test_and_del'
+//      sx_job_dispatch_desc        (Thread-Safe) Same as sx_job_dispatch, but takes sx_job_desc
+//                                  which can also declare up to SX_JOB_MAX_DEPS dependencies
+//                                  (`deps`, `num_deps`). The jobs are not submitted until all the
+//                                  dependencies are finished, the thread that finishes the last
+//                                  dependency submits them. Zero or deleted handles are ignored.
+//                                  `deadline_us` is the latest time that the jobs should start,
+//                                  relative to this call. Late jobs are picked before any other
+//                                  job, regardless of priority. Jobs with deadlines go through a
+//                                  shared locked list instead of work-stealing queues, so use them
+//                                  for few latency sensitive jobs.
+//                                  NOTE: dependency handles must stay valid (not deleted by
+//                                        'sx_job_wait_and_del' or 'sx_job_test_and_del') until
+//                                        this call returns. After that, they can be deleted freely
+//      sx_job_parallel_for         (Thread-Safe) Same as sx_job_dispatch_desc, but for work sets
+//                                  with uneven cost per item. The callback is called with ranges of at
+//                                  most `grain_size` items. Whenever a worker runs out of work in
+//                                  it's queue, the job that it's running splits the rest of it's
+//                                  range in half and gives the other half to idle threads. So
+//                                  skewed work sets keep all threads busy.
+//                                  - grain_size: smallest range that is worth a callback, too
+//                                                small values add overhead, too large values
+//                                                limit the balancing. (>0)
+//      sx_job_dispatch_batch       (Thread-Safe) Submits many different dispatches (array of
+//                                  sx_job_desc) with a single handle, that is finished when all of
+//                                  them are done. Jobs are pushed under one lock and workers are
+//                                  woken once for the whole batch, so it's much cheaper than
+//                                  calling sx_job_dispatch for each of many small jobs.
+//                                  Each desc is divided into ranges like sx_job_dispatch_desc, but
+//                                  dependencies (`deps`) are not supported in batches
 //      sx_job_wait_and_del         (Thread-Safe) Blocks the program and waits on dispatched job.
 //                                  It deletes the sx_job_t handle if the job is done
 //                                  NOTE: If the sx_job_t is done this functions returns immediately
 //                                        but will do some work if any sub-jobs are remaining and
 //                                        sx_job_t is not finished
+//                                  NOTE: Handles carry a generation, so passing a handle that is
+//                                        already deleted is detected (asserts in debug builds)
 //      sx_job_test_and_del         (Thread-Safe) This is a non-blocking function,
 //                                  which only checks if sx_job_t is finished
 //                                  If job is finished, it returns True and deletes the sx_job_t
 //                                  handle. If not, the function moves on and returns False
 //                                  immediately
+//      sx_job_pump                 Runs the jobs that are ready on the main thread (the thread that
+//                                  has created the context) for a time slice, without waiting on
+//                                  any handle. Returns as soon as there are no jobs that it can
+//                                  pick, or `budget_us` has passed, and returns the number of jobs
+//                                  that it has run. Budget is checked between jobs, so a single
+//                                  long job can exceed it, and budget_us <= 0 runs a single job.
+//                                  Use it in the main loop (IO, rendering) to keep the main thread
+//                                  busy in idle phases, when the context is created with
+//                                  num_cores-1 workers. Jobs that the main thread has started
+//                                  and are suspended in 'wait', only continue on the main thread:
+//                                  in sx_job_pump or sx_job_wait_and_del.
+//                                  NOTE: cannot be called inside jobs
+//      sx_job_num_handles          Returns number of sx_job_t handles that are currently in use
 //      sx_job_num_worker_threads   Returns number of worker threads running
 //                                  (does not include main thread)
 //      sx_job_set_current_thread_tags Sets thread-tag for the current running thread.
 //                                     better call this inside `sx_job_thread_init_cb` callback
 //                                     function. See below for more details on the concept of Tags
 //
+//      sx_job_thread_in_context    Returns true if the current thread is the one that created the
+//                                  context or one of it's worker threads
 //      sx_job_thread_index         Get current working thread's index (0..num_workers)
 //      sx_job_thread_id            Get current working thread's Os Id
 //
+// Synchronization:
+//      sx_mutex/sx_sem of threads.h block the whole worker thread. Objects below only suspend the
+//      running job: it's queued on the object and the worker continues with other jobs, when the
+//      object is released/signaled, the job is re-queued and continues on the same thread.
+//      Waiters are resumed in FIFO order and the object is handed over to them directly.
+//      Outside of jobs (main thread), waiting functions run other jobs until the object is
+//      available, like sx_job_wait_and_del. Functions are thread-safe, except init/release.
+//      Jobs that are holding a sx_job_mutex can wait or lock others, but the mutex is not
+//      recursive, and it can be unlocked by any job or thread.
+//      sx_job_mutex        Mutual exclusion between jobs. 'enter' suspends the job if it's locked
+//                          'sx_job_mutex_lock(ctx, mtx) { ... }' locks the scope (like sx_lock)
+//      sx_job_event        Manual-reset event. 'wait' suspends the job until the event is 'set',
+//                          'set' resumes all the waiting jobs, and the event stays set until
+//                          'reset'
+//      sx_job_sem          Counting semaphore. 'wait' suspends the job if the count is zero, else
+//                          decreases the count. 'post' resumes waiting jobs or increases the count
+//
+// Profiling:
+//      Build with SX_CONFIG_JOBS_PROFILE=1 (cmake: SX_JOBS_PROFILE=ON) to record job system events
+//      (see sx_job_profile_event_type). Every thread writes to it's own ring buffer of
+//      `profile_events` events (sx_job_context_desc), so recording doesn't take any locks and
+//      only the latest events are kept. Timestamps are sx_tm_now() ticks, so sx_tm_init must be
+//      called before creating the context. Without SX_CONFIG_JOBS_PROFILE nothing is recorded,
+//      and the functions below return zero/false
+//      sx_job_profile_events       (Thread-Safe) Copies the latest events of the thread into
+//                                  `events` (oldest first), returns the number of events copied
+//      sx_job_profile_thread_stats (Thread-Safe) Totals of the thread since the context is
+//                                  created: count of each event type, time spent running jobs
+//                                  and idle time
+//      sx_job_profile_save_trace   Saves recorded events of all threads as Chrome trace json
+//                                  (open it in chrome://tracing or https://ui.perfetto.dev)
+//      sx_job_profile_save_bin     Saves recorded events of all threads in compact binary format:
+//                                  header (sx_job_profile_bin_header) followed by
+//                                  sx_job_profile_event array of all threads, timestamps are
+//                                  converted to nanoseconds
+//      Saving can be done while jobs are running, events that are overwritten during the copy
+//      are dropped
+//
 // clang-format off
 //  Tags (Advanced):
 //      The concept is that every worker thread can be assigned a tag (which is a uint32_t bitset), and by default, every thread's tag is 0xffffffff
@@ -101,7 +220,9 @@
 
 typedef struct sx_alloc sx_alloc;
 typedef struct sx_job_context sx_job_context;
-typedef uint32_t* sx_job_t;
+typedef uint32_t sx_job_t;    // generation-tagged handle, zero is invalid
+
+#define SX_JOB_MAX_DEPS 8
 
 typedef void(sx_job_cb)(int range_start, int range_end, int thread_index, void* user);
 typedef void(sx_job_thread_init_cb)(sx_job_context* ctx, int thread_index, unsigned int thread_id,
@@ -116,10 +237,87 @@ typedef enum sx_job_priority {
     SX_JOB_PRIORITY_COUNT
 } sx_job_priority;
 
+typedef enum sx_job_flag {
+    SX_JOB_FLAG_SMALL_STACK = 0x1,    // run on a small fiber stack (small_fiber_stack_sz), use it
+                                      // for jobs that don't go deep in the call stack
+    SX_JOB_FLAG_INLINE = 0x2    // run directly on the worker's scheduler stack, without creating
+                                // a fiber. Best for short jobs that don't wait. If the job waits
+                                // it is promoted to a fiber and works like a normal job
+} sx_job_flag;
+typedef uint32_t sx_job_flags;
+
+typedef enum sx_job_affinity {
+    SX_JOB_AFFINITY_NONE = 0,          // workers are not pinned, the OS places them (default)
+    SX_JOB_AFFINITY_LOGICAL_CORES,     // each worker is pinned to a logical cpu, physical cores
+                                       // of a node are filled first, then their SMT siblings
+    SX_JOB_AFFINITY_PHYSICAL_CORES,    // each worker is pinned to a physical core, SMT siblings
+                                       // are not used (workers wrap around if there are more)
+} sx_job_affinity;
+
+typedef enum sx_job_profile_event_type {
+    SX_JOB_PROFILE_DISPATCH = 0,    // dispatch is submitted (arg: number of sub-jobs)
+    SX_JOB_PROFILE_START,           // sub-job starts running
+    SX_JOB_PROFILE_END,             // sub-job is finished
+    SX_JOB_PROFILE_WAIT,            // running sub-job is suspended in wait (arg: waited handle)
+    SX_JOB_PROFILE_RESUME,          // suspended sub-job continues
+    SX_JOB_PROFILE_STEAL,           // sub-job is stolen from another thread (arg: thread index)
+    SX_JOB_PROFILE_IDLE_BEGIN,      // worker has run out of jobs (spinning or sleeping)
+    SX_JOB_PROFILE_IDLE_END,        // worker has found a job
+    SX_JOB_PROFILE_COUNT
+} sx_job_profile_event_type;
+
+typedef struct sx_job_profile_event {
+    uint64_t tm;                // sx_tm_now ticks (nanoseconds in binary files)
+    sx_job_t job;               // zero for idle events
+    int job_index;              // index of the sub-job in it's dispatch (-1: parallel_for split)
+    uint32_t arg;               // see sx_job_profile_event_type
+    uint16_t thread_index;
+    uint8_t type;               // sx_job_profile_event_type
+    uint8_t priority;           // sx_job_priority
+} sx_job_profile_event;
+
+typedef struct sx_job_profile_stats {
+    uint32_t counts[SX_JOB_PROFILE_COUNT];    // number of events of each type
+    double busy_ms;                         // time spent running jobs
+    double idle_ms;                         // time spent without jobs
+} sx_job_profile_stats;
+
+typedef struct sx_job_profile_bin_header {
+    uint32_t fourcc;         // 'SXJP'
+    uint32_t version;        // 1
+    uint32_t num_threads;    // including main thread
+    uint32_t num_events;
+} sx_job_profile_bin_header;
+
+typedef struct sx_job_desc {
+    int count;                   // number of items in the work set
+    sx_job_cb* callback;         // worker callback function
+    void* user;                  // user pointer to be passed to callback function
+    sx_job_priority priority;    // job priority (default: SX_JOB_PRIORITY_HIGH)
+    unsigned int tags;           // job tags (default: 0)
+    const sx_job_t* deps;        // jobs that must finish before this job starts (optional)
+    int num_deps;                // number of items in `deps`, maximum is SX_JOB_MAX_DEPS
+    sx_job_flags flags;          // combination of sx_job_flag (default: 0)
+    int deadline_us;             // jobs should start within this time after dispatch, late jobs
+                                 // are run before all priorities (default: 0, no deadline)
+} sx_job_desc;
+
 typedef struct sx_job_context_desc {
     int num_threads;    // number of worker threads to spawn,exclude main (default: num_cpu_cores-1)
-    int max_fibers;     // maximum fibers that are can be running at the same time (default: 64)
+    int max_fibers;     // job pool grows by this many jobs at a time (default: 64)
+    int max_handles;    // maximum sx_job_t handles that can be alive at the same time
+                        // (default: 1024, maximum: 65536)
     int fiber_stack_sz;                               // fiber stack size (default: 1mb)
+    int small_fiber_stack_sz;    // stack size for SX_JOB_FLAG_SMALL_STACK jobs (default: 64kb)
+    int idle_spin_count;    // times an idle worker polls the queues before sleeping (default: 64)
+                            // -1: sleep immediately
+    int idle_max_pause;     // max pause instructions between polls, doubles on each poll
+                            // (default: 64)
+    sx_job_affinity affinity;    // worker thread placement (default: SX_JOB_AFFINITY_NONE)
+    int starvation_us;           // lower priorities that are not served for this long, are
+                                 // picked first (default: 1000, -1: strict priorities)
+    int profile_events;          // size of per-thread event buffer, only used with
+                                 // SX_CONFIG_JOBS_PROFILE (default: 65536)
     sx_job_thread_init_cb* thread_init_cb;            // callback function that will be called on
                                                       // initiaslization of each worker thread
     sx_job_thread_shutdown_cb* thread_shutdown_cb;    // callback functions that will be called on
@@ -134,10 +332,60 @@ SX_API void sx_job_destroy_context(sx_job_context* ctx, const sx_alloc* alloc);
 SX_API sx_job_t sx_job_dispatch(sx_job_context* ctx, int count, sx_job_cb* callback, void* user,
                                 sx_job_priority priority sx_default(SX_JOB_PRIORITY_NORMAL),
                                 unsigned int tags sx_default(0));
+SX_API sx_job_t sx_job_dispatch_desc(sx_job_context* ctx, const sx_job_desc* desc);
+SX_API sx_job_t sx_job_dispatch_batch(sx_job_context* ctx, const sx_job_desc* descs,
+                                      int num_descs);
+SX_API sx_job_t sx_job_parallel_for(sx_job_context* ctx, const sx_job_desc* desc, int grain_size);
 SX_API void sx_job_wait_and_del(sx_job_context* ctx, sx_job_t job);
 SX_API bool sx_job_test_and_del(sx_job_context* ctx, sx_job_t job);
+SX_API int sx_job_pump(sx_job_context* ctx, int budget_us sx_default(0));
+SX_API int sx_job_num_handles(sx_job_context* ctx);
 SX_API int sx_job_num_worker_threads(sx_job_context* ctx);
 SX_API void sx_job_set_current_thread_tags(sx_job_context* ctx, unsigned int tags);
 
+SX_API bool sx_job_thread_in_context(sx_job_context* ctx);
 SX_API int sx_job_thread_index(sx_job_context* ctx);
-SX_API unsigned int sx_job_thread_id(sx_job_context* ctx);
\ No newline at end of file
+SX_API unsigned int sx_job_thread_id(sx_job_context* ctx);
+
+// Job mutex
+typedef sx_align_decl(64, struct) sx_job_mutex_s {
+    uint8_t data[128];
+} sx_job_mutex;
+
+SX_API void sx_job_mutex_init(sx_job_mutex* mutex);
+SX_API void sx_job_mutex_release(sx_job_mutex* mutex);
+SX_API void sx_job_mutex_enter(sx_job_context* ctx, sx_job_mutex* mutex);
+SX_API void sx_job_mutex_exit(sx_job_context* ctx, sx_job_mutex* mutex);
+SX_API bool sx_job_mutex_try(sx_job_mutex* mutex);
+
+#define sx_job_mutex_lock(_ctx, _mtx) \
+    sx_defer(sx_job_mutex_enter(_ctx, &_mtx), sx_job_mutex_exit(_ctx, &_mtx))
+
+// Job event
+typedef sx_align_decl(64, struct) sx_job_event_s {
+    uint8_t data[128];
+} sx_job_event;
+
+SX_API void sx_job_event_init(sx_job_event* event, bool set sx_default(false));
+SX_API void sx_job_event_release(sx_job_event* event);
+SX_API void sx_job_event_wait(sx_job_context* ctx, sx_job_event* event);
+SX_API void sx_job_event_set(sx_job_context* ctx, sx_job_event* event);
+SX_API void sx_job_event_reset(sx_job_event* event);
+SX_API bool sx_job_event_test(sx_job_event* event);
+
+// Job semaphore
+typedef sx_align_decl(64, struct) sx_job_sem_s {
+    uint8_t data[128];
+} sx_job_sem;
+
+SX_API void sx_job_sem_init(sx_job_sem* sem, int count sx_default(0));
+SX_API void sx_job_sem_release(sx_job_sem* sem);
+SX_API void sx_job_sem_wait(sx_job_context* ctx, sx_job_sem* sem);
+SX_API bool sx_job_sem_try(sx_job_sem* sem);
+SX_API void sx_job_sem_post(sx_job_context* ctx, sx_job_sem* sem, int count sx_default(1));
+
+SX_API int sx_job_profile_events(sx_job_context* ctx, int thread_index,
+                                 sx_job_profile_event* events, int max_events);
+SX_API sx_job_profile_stats sx_job_profile_thread_stats(sx_job_context* ctx, int thread_index);
+SX_API bool sx_job_profile_save_trace(sx_job_context* ctx, const char* filepath);
+SX_API bool sx_job_profile_save_bin(sx_job_context* ctx, const char* filepath);
\ No newline at end of file
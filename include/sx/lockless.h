@@ -41,8 +41,48 @@ SX_FORCE_INLINE bool sx_lock_try(sx_lock_t* lock);
 #    define sx_lock(_lock) sx_defer(sx_lock_enter(&_lock), sx_lock_exit(&_lock))
 #endif
 
+// Adaptive spinlock
+// Takes the lock with a single CAS when it's free. Under contention, it spins with exponential
+// backoff (pause) for a few rounds and then parks the thread with sx_futex_wait until the owner
+// wakes it on exit, so long waits don't burn cores. Use it for locks that can be heavily contended
+// or held for longer, sx_lock_t is still a bit cheaper to release for short uncontended sections
+// Build with SX_CONFIG_LOCK_STATS=1 to collect contention stats in every lock, which are read with
+// sx_lock_adaptive_stats (returns false if stats are not compiled in)
+typedef struct sx_lock_stats {
+    uint64_t num_acquires;
+    uint64_t num_contended;    // acquires that didn't get the lock on the first try
+    uint64_t num_spins;        // number of pause instructions
+    uint64_t num_parks;        // number of times waiting threads went to sleep
+    uint64_t max_wait;         // longest wait for the lock in nanoseconds
+} sx_lock_stats;
+
+typedef sx_align_decl(SX_CACHE_LINE_SIZE, struct) sx_lock_adaptive_s {
+    sx_atomic_uint32 state;    // 0: unlocked, 1: locked, 2: locked and threads may be parked
+#if SX_CONFIG_LOCK_STATS
+    sx_lock_stats stats;
+#endif
+} sx_lock_adaptive_t;
+
+SX_FORCE_INLINE void sx_lock_adaptive_enter(sx_lock_adaptive_t* lock);
+SX_FORCE_INLINE void sx_lock_adaptive_exit(sx_lock_adaptive_t* lock);
+SX_FORCE_INLINE bool sx_lock_adaptive_try(sx_lock_adaptive_t* lock);
+SX_API bool sx_lock_adaptive_stats(sx_lock_adaptive_t* lock, sx_lock_stats* stats);
+SX_API void sx_lock_adaptive_reset_stats(sx_lock_adaptive_t* lock);
+
+#define sx_lock_adaptive(_lock) \
+    sx_defer(sx_lock_adaptive_enter(&_lock), sx_lock_adaptive_exit(&_lock))
+
 // single-producer / single-consumer
-// growable
+// growable, capacity is rounded up to power-of-two
+// Items live in contiguous ring blocks, producer and consumer indexes are on separate cache-lines
+// and each side caches the other's index, so it only touches the shared one when a block looks
+// full/empty. sx_queue_spsc_grow (producer thread) adds a new block to the ring
+//      sx_queue_spsc_produce           copies the item in, returns false if the queue is full
+//      sx_queue_spsc_consume           copies the item out, returns false if the queue is empty
+//      sx_queue_spsc_produce_reserve   returns a pointer to the next free item (NULL if full) that
+//                                      the producer fills in-place, then publishes with _commit
+//      sx_queue_spsc_consume_peek      returns a pointer to the next item (NULL if empty) that the
+//                                      consumer reads in-place, then releases with _commit
 typedef struct sx_queue_spsc sx_queue_spsc;
 SX_API sx_queue_spsc* sx_queue_spsc_create(const sx_alloc* alloc, int item_sz, int capacity);
 SX_API void sx_queue_spsc_destroy(sx_queue_spsc* queue, const sx_alloc* alloc);
@@ -52,10 +92,63 @@ SX_API bool sx_queue_spsc_consume(sx_queue_spsc* queue, void* data);
 SX_API bool sx_queue_spsc_grow(sx_queue_spsc* queue, const sx_alloc* alloc);
 SX_API bool sx_queue_spsc_full(const sx_queue_spsc* queue);
 
+SX_API void* sx_queue_spsc_produce_reserve(sx_queue_spsc* queue);
+SX_API void sx_queue_spsc_produce_commit(sx_queue_spsc* queue);
+SX_API void* sx_queue_spsc_consume_peek(sx_queue_spsc* queue);
+SX_API void sx_queue_spsc_consume_commit(sx_queue_spsc* queue);
+
 #define sx_queue_spsc_produce_and_grow(_queue, _data, _alloc)             \
     (sx_queue_spsc_full(_queue) ? sx_queue_spsc_grow(_queue, _alloc) : 0, sx_queue_spsc_produce(_queue, (_data)))
 
+// multi-producer / multi-consumer
+// bounded, capacity is rounded up to power-of-two
+// Reference: https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+// Each cell carries a sequence number that tells producers/consumers if it's free or full, so they
+// only contend on the enqueue/dequeue positions (each on its own cache-line)
+//      sx_queue_mpmc_produce           returns false if the queue is full
+//      sx_queue_mpmc_consume           returns false if the queue is empty
+//      sx_queue_mpmc_produce_batch     produces up to `count` items from `data` (array of items),
+//                                      with a single CAS. Returns the number of produced items
+//      sx_queue_mpmc_consume_batch     consumes up to `max_count` items into `data`
+//                                      with a single CAS. Returns the number of consumed items
+typedef struct sx_queue_mpmc sx_queue_mpmc;
+SX_API sx_queue_mpmc* sx_queue_mpmc_create(const sx_alloc* alloc, int item_sz, int capacity);
+SX_API void sx_queue_mpmc_destroy(sx_queue_mpmc* queue, const sx_alloc* alloc);
+
+SX_API bool sx_queue_mpmc_produce(sx_queue_mpmc* queue, const void* data);
+SX_API bool sx_queue_mpmc_consume(sx_queue_mpmc* queue, void* data);
+SX_API int sx_queue_mpmc_produce_batch(sx_queue_mpmc* queue, const void* data, int count);
+SX_API int sx_queue_mpmc_consume_batch(sx_queue_mpmc* queue, void* data, int max_count);
+SX_API int sx_queue_mpmc_capacity(const sx_queue_mpmc* queue);
+
+// multi-producer / single-consumer
+// intrusive and unbounded, no memory is allocated by the queue after creation
+// Reference: https://www.1024cores.net/home/lock-free-algorithms/queues/intrusive-mpsc-node-based-queue
+// Put sx_queue_mpsc_node as the first member of your item struct and pass items as nodes. Items
+// can come from anywhere (sx_pool, arrays, ...) and must stay valid until they are consumed
+//      sx_queue_mpsc_produce           links the node with a single atomic exchange, any thread
+//      sx_queue_mpsc_consume           returns the oldest node, or NULL if the queue is empty.
+//                                      NULL is also returned for a short window while a producer
+//                                      is between its exchange and link, so just try again later
+//      sx_queue_mpsc_consume_batch     drains up to `max_count` nodes into `nodes`, returns the
+//                                      number of consumed nodes
+typedef struct sx_queue_mpsc_node {
+    sx_atomic_ptr next;
+} sx_queue_mpsc_node;
+
+typedef struct sx_queue_mpsc sx_queue_mpsc;
+SX_API sx_queue_mpsc* sx_queue_mpsc_create(const sx_alloc* alloc);
+SX_API void sx_queue_mpsc_destroy(sx_queue_mpsc* queue, const sx_alloc* alloc);
+
+SX_API void sx_queue_mpsc_produce(sx_queue_mpsc* queue, sx_queue_mpsc_node* node);
+SX_API sx_queue_mpsc_node* sx_queue_mpsc_consume(sx_queue_mpsc* queue);
+SX_API int sx_queue_mpsc_consume_batch(sx_queue_mpsc* queue, sx_queue_mpsc_node** nodes,
+                                       int max_count);
+
 //--------------------------------------------------------------------------------------------------
+SX_API void sx__lock_adaptive_enter_slow(sx_lock_adaptive_t* lock);
+SX_API void sx__lock_adaptive_wake(sx_lock_adaptive_t* lock);
+
 SX_FORCE_INLINE void sx_lock_enter(sx_lock_t* lock)
 {
     sx_lock_measure_time_begin();
@@ -81,3 +174,36 @@ SX_FORCE_INLINE bool sx_lock_try(sx_lock_t* lock)
            sx_atomic_exchange32_explicit(lock, 1, SX_ATOMIC_MEMORYORDER_ACQUIRE) == 0;
 }
 
+SX_FORCE_INLINE void sx_lock_adaptive_enter(sx_lock_adaptive_t* lock)
+{
+    uint32_t expected = 0;
+    if (!sx_atomic_compare_exchange32_strong_explicit(&lock->state, &expected, 1,
+                                                      SX_ATOMIC_MEMORYORDER_ACQUIRE,
+                                                      SX_ATOMIC_MEMORYORDER_RELAXED)) {
+        sx__lock_adaptive_enter_slow(lock);
+    }
+#if SX_CONFIG_LOCK_STATS
+    ++lock->stats.num_acquires;
+#endif
+}
+
+SX_FORCE_INLINE void sx_lock_adaptive_exit(sx_lock_adaptive_t* lock)
+{
+    if (sx_atomic_exchange32_explicit(&lock->state, 0, SX_ATOMIC_MEMORYORDER_RELEASE) == 2)
+        sx__lock_adaptive_wake(lock);
+}
+
+SX_FORCE_INLINE bool sx_lock_adaptive_try(sx_lock_adaptive_t* lock)
+{
+    uint32_t expected = 0;
+    if (sx_atomic_load32_explicit(&lock->state, SX_ATOMIC_MEMORYORDER_RELAXED) == 0 &&
+        sx_atomic_compare_exchange32_strong_explicit(&lock->state, &expected, 1,
+                                                     SX_ATOMIC_MEMORYORDER_ACQUIRE,
+                                                     SX_ATOMIC_MEMORYORDER_RELAXED)) {
+#if SX_CONFIG_LOCK_STATS
+        ++lock->stats.num_acquires;
+#endif
+        return true;
+    }
+    return false;
+}
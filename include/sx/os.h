@@ -4,6 +4,19 @@
 //
 // os.h - v1.1.0 - Common portable OS related functions
 //
+// sx_os_cpu_topology: Fills the logical cpus that the process is allowed to run on, with their
+//                     physical core and NUMA node. On linux, it's read from /sys, on windows from
+//                     GetLogicalProcessorInformation. On other platforms, every logical cpu is
+//                     reported as a separate core on node #0.
+//                     cpus are sorted by node, then by SMT index, then by core. So the first
+//                     `num_cores` cpus of a single node machine are all on different physical
+//                     cores. Returns false if the topology is not available and the fallback
+//                     is used
+//
+// sx_os_clock_ns: Monotonic clock of the OS in nanoseconds (CLOCK_MONOTONIC, or
+//                 QueryPerformanceCounter on windows). Unlike sx_tm_now, it doesn't need any
+//                 initialization, so the library can use it internally without sx_tm_init
+//
 #pragma once
 
 #include "sx.h"
@@ -28,6 +41,22 @@ typedef struct sx_file_info {
     uint64_t last_modified;    // time_t
 } sx_file_info;
 
+#define SX_OS_MAX_CPUS 256
+
+typedef struct sx_os_cpu {
+    int id;      // logical cpu id of the OS, use it with sx_thread_setaffinity
+    int core;    // physical core index (0..num_cores-1), SMT siblings have the same core
+    int node;    // NUMA node index (0..num_nodes-1)
+    int smt;     // index of the hardware thread inside it's core, 0 is the first one
+} sx_os_cpu;
+
+typedef struct sx_os_topology {
+    int num_cpus;     // logical cpus (SMT threads)
+    int num_cores;    // physical cores
+    int num_nodes;    // NUMA nodes
+    sx_os_cpu cpus[SX_OS_MAX_CPUS];
+} sx_os_topology;
+
 typedef struct sx_pinfo {
     union {
         uintptr_t linux_pid;
@@ -48,6 +77,7 @@ SX_API void* sx_os_dlsym(void* handle, const char* symbol);
 SX_API const char* sx_os_dlerr(void);
 SX_API int sx_os_chdir(const char* path);
 SX_API void sx_os_sleep(int ms);
+SX_API uint64_t sx_os_clock_ns(void);
 SX_API sx_pinfo sx_os_exec(const char* const* argv);
 SX_API bool sx_os_copy(const char* src, const char* dest);
 SX_API bool sx_os_rename(const char* src, const char* dest);
@@ -75,3 +105,4 @@ SX_API uint32_t sx_os_getpid(void);
 SX_API sx_file_info sx_os_stat(const char* filepath);
 
 SX_API int sx_os_numcores(void);
+SX_API bool sx_os_cpu_topology(sx_os_topology* topo);
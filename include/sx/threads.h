@@ -9,6 +9,8 @@
 // threads.h - v1.0 - Common portable multi-threading primitives
 //
 //      sx_thread       Portable thread
+//                      sx_thread_setaffinity pins the calling thread to a logical cpu (see
+//                      sx_os_cpu_topology for cpu ids), returns false if it's not supported
 //      sx_tls          Portable thread-local-storage which you can store a user_data per Tls
 //      sx_mutex        Portable OS mutex, use for long-time data locks, for short-time locks use
 //                      sx_lock_t in atomics.h
@@ -18,6 +20,21 @@
 //      sx_signal       Portable OS signals/events. simplified version of the semaphore,
 //                      where you 'wait' for signal to be triggered, then in another thread you
 //                      'raise' it and 'wait' will continue
+//      sx_rwlock       Reader-writer lock built on sx_futex, many readers or a single writer can hold
+//                      the lock. Readers are preferred by default, init with prefer_writers=true to
+//                      block new readers while writers are waiting, so writers don't starve.
+//                      Taking the read lock recursively can deadlock with writers waiting.
+//                      '_try' never blocks and '_timed' gives up after 'msecs', both return
+//                      false if they don't get the lock
+//      sx_seqlock      Sequence lock for small POD data that is read a lot and written rarely.
+//                      Readers never block writers nor write to shared memory, they just copy the
+//                      data and retry if a writer came in between. Writers are serialized.
+//                      Use sx_seqlock_read/sx_seqlock_write to copy the whole data, or
+//                      read_begin/read_retry and write_enter/write_exit to access it in place
+//      sx_futex        Parks threads on the address of a 32bit value until another thread wakes them
+//                      (futex on linux, WaitOnAddress on windows, mutex/cond buckets elsewhere).
+//                      'wait' only sleeps if the value is still 'expected', and can return early, so
+//                      always check the value again in a loop. Returns false on timeout
 //      sx_queue_spsc   Single producer/Single consumer self contained queue
 //
 #pragma once
@@ -41,6 +58,7 @@ SX_API bool sx_thread_running(sx_thread* thrd);
 SX_API void sx_thread_setname(sx_thread* thrd, const char* name);
 SX_API void sx_thread_yield(void);
 SX_API uint32_t sx_thread_tid(void);
+SX_API bool sx_thread_setaffinity(int cpu_id);
 
 // Tls data
 typedef void* sx_tls;
@@ -89,3 +107,48 @@ SX_API void sx_signal_release(sx_signal* sig);
 SX_API void sx_signal_raise(sx_signal* sig);
 SX_API bool sx_signal_wait(sx_signal* sig, int msecs sx_default(-1));
 
+// RW lock
+typedef sx_align_decl(64, struct) sx_rwlock_s {
+    uint32_t state;    // number of readers, or the writer bit
+    uint32_t reader_seq;
+    uint32_t writer_seq;
+    uint32_t num_waiting_readers;
+    uint32_t num_waiting_writers;
+    bool prefer_writers;
+} sx_rwlock;
+
+SX_API void sx_rwlock_init(sx_rwlock* lock, bool prefer_writers sx_default(false));
+SX_API void sx_rwlock_release(sx_rwlock* lock);
+SX_API void sx_rwlock_read_enter(sx_rwlock* lock);
+SX_API void sx_rwlock_read_exit(sx_rwlock* lock);
+SX_API bool sx_rwlock_read_try(sx_rwlock* lock);
+SX_API bool sx_rwlock_read_enter_timed(sx_rwlock* lock, int msecs);
+SX_API void sx_rwlock_write_enter(sx_rwlock* lock);
+SX_API void sx_rwlock_write_exit(sx_rwlock* lock);
+SX_API bool sx_rwlock_write_try(sx_rwlock* lock);
+SX_API bool sx_rwlock_write_enter_timed(sx_rwlock* lock, int msecs);
+
+#define sx_rwlock_read(_lock) sx_defer(sx_rwlock_read_enter(&_lock), sx_rwlock_read_exit(&_lock))
+#define sx_rwlock_write(_lock) sx_defer(sx_rwlock_write_enter(&_lock), sx_rwlock_write_exit(&_lock))
+
+// Seqlock
+typedef sx_align_decl(64, struct) sx_seqlock_s {
+    uint32_t seq;    // odd while a writer is inside
+    uint32_t num_waiting_writers;
+} sx_seqlock;
+
+SX_API void sx_seqlock_init(sx_seqlock* lock);
+SX_API uint32_t sx_seqlock_read_begin(sx_seqlock* lock);
+SX_API bool sx_seqlock_read_retry(sx_seqlock* lock, uint32_t seq);
+SX_API void sx_seqlock_read(sx_seqlock* lock, void* dst, const void* src, size_t size);
+SX_API bool sx_seqlock_read_try(sx_seqlock* lock, void* dst, const void* src, size_t size);
+SX_API void sx_seqlock_write_enter(sx_seqlock* lock);
+SX_API void sx_seqlock_write_exit(sx_seqlock* lock);
+SX_API bool sx_seqlock_write_try(sx_seqlock* lock);
+SX_API bool sx_seqlock_write_enter_timed(sx_seqlock* lock, int msecs);
+SX_API void sx_seqlock_write(sx_seqlock* lock, void* dst, const void* src, size_t size);
+
+// Futex
+SX_API bool sx_futex_wait(uint32_t* addr, uint32_t expected, int msecs sx_default(-1));
+SX_API void sx_futex_wake(uint32_t* addr, bool wake_all sx_default(false));
+
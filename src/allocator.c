@@ -112,7 +112,7 @@ typedef struct stb__leakcheck_malloc_info {
 } stb__leakcheck_malloc_info;
 
 static stb__leakcheck_malloc_info* mi_head;
-static sx_lock_t mi_lock;
+static sx_lock_adaptive_t mi_lock;
 
 static void* stb_leakcheck_malloc(size_t sz, const char* file, const char* func, int line)
 {
@@ -122,7 +122,7 @@ static void* stb_leakcheck_malloc(size_t sz, const char* file, const char* func,
 
     sx_strcpy(mi->file, sizeof(mi->file), file);
     sx_strcpy(mi->func, sizeof(mi->func), func);
-    sx_lock(mi_lock) {
+    sx_lock_adaptive(mi_lock) {
         mi->line = line;
         mi->next = mi_head;
         if (mi_head)
@@ -139,7 +139,7 @@ static void stb_leakcheck_free(void* ptr)
     if (ptr != NULL) {
         stb__leakcheck_malloc_info* mi = (stb__leakcheck_malloc_info*)ptr - 1;
         mi->size = ~mi->size;
-        sx_lock(mi_lock) {
+        sx_lock_adaptive(mi_lock) {
             if (mi->prev == NULL) {
                 sx_assert(mi_head == mi);
                 mi_head = mi->next;
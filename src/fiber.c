@@ -4,8 +4,12 @@
 //
 #include "sx/fiber.h"
 #include "sx/allocator.h"
+#include "sx/array.h"
+#include "sx/jobs.h"
+#include "sx/lockless.h"
 #include "sx/os.h"
 #include "sx/pool.h"
+#include "sx/vmem.h"
 
 #include <stdlib.h>
 
@@ -28,6 +32,7 @@ SX_PRAGMA_DIAGNOSTIC_POP()
 #endif
 
 #define DEFAULT_STACK_SIZE 131072    // 120kb
+#define SX__FIBER_GUARD_PAGES 1
 
 // Fwd declare ASM functions
 SX_API sx_fiber_transfer jump_fcontext(sx_fiber_t const, void*);
@@ -68,6 +73,66 @@ bool sx_fiber_stack_init(sx_fiber_stack* fstack, unsigned int size)
     return true;
 }
 
+// Growable stacks reserve the whole range and keep the lowest page(s) as guard, which is never
+// committed. On windows, only the top of the stack is committed, followed by a PAGE_GUARD page that
+// the OS moves down on each touch, because the fcontext asm swaps the stack limits of TIB for us.
+// On posix, the kernel backs anonymous pages on first touch, so the range above the guard is
+// made read-write and only the pages that the fiber touches take physical memory
+static bool sx__fiber_stack_commit(sx_vmem_context* vmem, int num_commit_pages)
+{
+#if SX_PLATFORM_WINDOWS
+    int start_page = vmem->max_pages - num_commit_pages;
+    return sx_vmem_commit_pages(vmem, start_page, num_commit_pages) &&
+           VirtualAlloc(sx_vmem_get_page(vmem, start_page - 1), vmem->page_size, MEM_COMMIT,
+                        PAGE_READWRITE | PAGE_GUARD);
+#else
+    if (!sx_vmem_commit_pages(vmem, SX__FIBER_GUARD_PAGES,
+                              vmem->max_pages - SX__FIBER_GUARD_PAGES)) {
+        return false;
+    }
+
+    // pre-fault the pages that we are asked to commit
+    uint8_t* top = (uint8_t*)vmem->ptr + (size_t)vmem->page_size * (size_t)vmem->max_pages;
+    for (int i = 1; i <= num_commit_pages; i++) {
+        *(volatile uint8_t*)(top - i * vmem->page_size) = 0;
+    }
+    return true;
+#endif
+}
+
+bool sx_fiber_stack_init_growable(sx_fiber_stack* fstack, unsigned int max_size,
+                                  unsigned int commit_size)
+{
+    if (max_size == 0)
+        max_size = DEFAULT_STACK_SIZE;
+    max_size = (uint32_t)sx_os_align_pagesz(max_size);
+    commit_size = (uint32_t)sx_os_align_pagesz(sx_max(commit_size, 1u));
+
+    int num_pages = sx_vmem_get_needed_pages(max_size);
+    sx_assertf(num_pages > SX__FIBER_GUARD_PAGES + 1, "stack size is too small");
+
+    // keep guard pages and the soft guard page (windows) out of the initial commit
+    int num_commit_pages = sx_min(sx_vmem_get_needed_pages(commit_size),
+                                  num_pages - SX__FIBER_GUARD_PAGES - 1);
+
+    sx_vmem_context vmem;
+    if (!sx_vmem_init(&vmem, 0, num_pages)) {
+        sx_out_of_memory();
+        return false;
+    }
+
+    if (!sx__fiber_stack_commit(&vmem, num_commit_pages)) {
+        sx_vmem_release(&vmem);
+        sx_out_of_memory();
+        return false;
+    }
+
+    // releasing is the same as fixed stacks, so we don't need to keep the vmem context
+    fstack->sptr = (uint8_t*)vmem.ptr + max_size;
+    fstack->ssize = max_size;
+    return true;
+}
+
 void sx_fiber_stack_init_ptr(sx_fiber_stack* fstack, void* ptr, unsigned int size)
 {
     size_t page_sz = sx_os_pagesz();
@@ -93,6 +158,210 @@ void sx_fiber_stack_release(sx_fiber_stack* fstack)
 #endif
 }
 
+#if SX_PLATFORM_POSIX
+#    if SX_PLATFORM_APPLE || SX_PLATFORM_BSD
+typedef char sx__fiber_mincore_vec;
+#    else
+typedef unsigned char sx__fiber_mincore_vec;
+#    endif
+
+// calls `page_fn` for each resident page of the stack from the bottom to the top, stops if returns
+// false
+static void sx__fiber_stack_resident_pages(const sx_fiber_stack* fstack,
+                                           bool (*page_fn)(uint8_t* page, void* user),
+                                           void* user)
+{
+    size_t page_sz = sx_os_pagesz();
+    uint8_t* base = (uint8_t*)fstack->sptr - fstack->ssize;
+    size_t num_pages = fstack->ssize / page_sz;
+    sx__fiber_mincore_vec vec[256];
+
+    for (size_t i = 0; i < num_pages; i += sizeof(vec)) {
+        size_t count = sx_min(num_pages - i, sizeof(vec));
+        if (mincore(base + i * page_sz, count * page_sz, vec) != 0)
+            return;
+        for (size_t k = 0; k < count; k++) {
+            if ((vec[k] & 0x1) && !page_fn(base + (i + k) * page_sz, user))
+                return;
+        }
+    }
+}
+
+static bool sx__fiber_stack_lowest_page(uint8_t* page, void* user)
+{
+    *((uint8_t**)user) = page;
+    return false;
+}
+
+static bool sx__fiber_stack_count_page(uint8_t* page, void* user)
+{
+    sx_unused(page);
+    ++(*(size_t*)user);
+    return true;
+}
+#endif    // SX_PLATFORM_POSIX
+
+size_t sx_fiber_stack_usage(const sx_fiber_stack* fstack)
+{
+    sx_assert(fstack->sptr);
+
+#if SX_PLATFORM_WINDOWS
+    // the lowest committed page that is not a guard page
+    uint8_t* addr = (uint8_t*)fstack->sptr - fstack->ssize;
+    MEMORY_BASIC_INFORMATION info;
+    while (addr < (uint8_t*)fstack->sptr && VirtualQuery(addr, &info, sizeof(info))) {
+        if (info.State == MEM_COMMIT && !(info.Protect & PAGE_GUARD))
+            return (size_t)((uint8_t*)fstack->sptr - addr);
+        addr = (uint8_t*)info.BaseAddress + info.RegionSize;
+    }
+    return 0;
+#elif SX_PLATFORM_POSIX
+    uint8_t* lowest = (uint8_t*)fstack->sptr;
+    sx__fiber_stack_resident_pages(fstack, sx__fiber_stack_lowest_page, &lowest);
+    return (size_t)((uint8_t*)fstack->sptr - lowest);
+#else
+    return fstack->ssize;
+#endif
+}
+
+size_t sx_fiber_stack_commit_size(const sx_fiber_stack* fstack)
+{
+    sx_assert(fstack->sptr);
+
+#if SX_PLATFORM_WINDOWS
+    uint8_t* addr = (uint8_t*)fstack->sptr - fstack->ssize;
+    size_t size = 0;
+    MEMORY_BASIC_INFORMATION info;
+    while (addr < (uint8_t*)fstack->sptr && VirtualQuery(addr, &info, sizeof(info))) {
+        if (info.State == MEM_COMMIT)
+            size += info.RegionSize;
+        addr = (uint8_t*)info.BaseAddress + info.RegionSize;
+    }
+    return size;
+#elif SX_PLATFORM_POSIX
+    size_t num_pages = 0;
+    sx__fiber_stack_resident_pages(fstack, sx__fiber_stack_count_page, &num_pages);
+    return num_pages * sx_os_pagesz();
+#else
+    return fstack->ssize;
+#endif
+}
+
+// Global stack cache: growable stacks of power-of-two sizes, starting from 16kb
+// Physical memory of stacks (except the top) is given back to the OS when they are recycled, so the
+// cache mostly holds address space and we get rid of mmap/munmap calls when coroutines are created
+// at high rates
+#define MIN_CACHED_STACK_SIZE_LOG2 14    // 16kb
+#define NUM_STACK_CLASSES 10             // 16kb .. 8mb
+#define MAX_CACHED_STACKS 256            // per size class
+#define KEEP_STACK_SIZE 16384            // top of the stack that stays resident in the cache
+
+typedef struct sx__fiber_stack_cache {
+    sx_lock_t lock;
+    sx_fiber_stack* stacks[NUM_STACK_CLASSES];    // sx_array
+} sx__fiber_stack_cache;
+
+static sx__fiber_stack_cache g_stack_cache;
+
+// returns -1 if the size doesn't fit in any class
+static int sx__fiber_stack_class(unsigned int size)
+{
+    for (int i = 0; i < NUM_STACK_CLASSES; i++) {
+        if (size <= (1u << (MIN_CACHED_STACK_SIZE_LOG2 + i)))
+            return i;
+    }
+    return -1;
+}
+
+// gives the physical memory of the stack back to the OS, but keeps the address range
+// the top of the stack is touched by every fiber, so we keep it to avoid faulting it back again
+static void sx__fiber_stack_reset(sx_fiber_stack* fstack)
+{
+    uint8_t* base = (uint8_t*)fstack->sptr - fstack->ssize;
+    size_t page_sz = sx_os_pagesz();
+    size_t keep_sz = sx_min((size_t)KEEP_STACK_SIZE, (size_t)fstack->ssize / 2);
+
+#if SX_PLATFORM_WINDOWS
+    VirtualFree(base, fstack->ssize - keep_sz, MEM_DECOMMIT);
+    sx_vmem_context vmem = { .ptr = base,
+                             .num_pages = 0,
+                             .page_size = (int)page_sz,
+                             .max_pages = (int)(fstack->ssize / page_sz) };
+    sx__fiber_stack_commit(&vmem, (int)(keep_sz / page_sz));
+#elif SX_PLATFORM_POSIX
+    size_t guard_sz = page_sz * SX__FIBER_GUARD_PAGES;
+    madvise(base + guard_sz, fstack->ssize - guard_sz - keep_sz, MADV_DONTNEED);
+#else
+    sx_unused(base);
+    sx_unused(page_sz);
+    sx_unused(keep_sz);
+#endif
+}
+
+bool sx_fiber_stack_acquire(sx_fiber_stack* fstack, unsigned int size)
+{
+    if (size == 0)
+        size = DEFAULT_STACK_SIZE;
+    int stack_class = sx__fiber_stack_class(size);
+    if (stack_class == -1)
+        return sx_fiber_stack_init_growable(fstack, size, 0);
+
+    bool found = false;
+    sx_lock(g_stack_cache.lock) {
+        sx_fiber_stack* cache = g_stack_cache.stacks[stack_class];
+        int count = sx_array_count(cache);
+        if (count > 0) {
+            *fstack = cache[count - 1];
+            sx_array_pop_last(cache);
+            found = true;
+        }
+    }
+
+    return found ? true
+                 : sx_fiber_stack_init_growable(
+                       fstack, 1u << (MIN_CACHED_STACK_SIZE_LOG2 + stack_class), 0);
+}
+
+void sx_fiber_stack_recycle(sx_fiber_stack* fstack)
+{
+    sx_assert(fstack->sptr);
+
+    int stack_class = sx__fiber_stack_class(fstack->ssize);
+    if (stack_class == -1 || fstack->ssize != (1u << (MIN_CACHED_STACK_SIZE_LOG2 + stack_class))) {
+        sx_fiber_stack_release(fstack);
+    } else {
+        sx__fiber_stack_reset(fstack);
+
+        bool cached = false;
+        sx_lock(g_stack_cache.lock) {
+            if (sx_array_count(g_stack_cache.stacks[stack_class]) < MAX_CACHED_STACKS) {
+                sx_array_push(sx_alloc_malloc(), g_stack_cache.stacks[stack_class], *fstack);
+                cached = true;
+            }
+        }
+
+        if (!cached)
+            sx_fiber_stack_release(fstack);
+    }
+
+    fstack->sptr = NULL;
+    fstack->ssize = 0;
+}
+
+void sx_fiber_stack_cache_trim(void)
+{
+    sx_lock(g_stack_cache.lock) {
+        for (int i = 0; i < NUM_STACK_CLASSES; i++) {
+            sx_fiber_stack* cache = g_stack_cache.stacks[i];
+            for (int k = 0, c = sx_array_count(cache); k < c; k++) {
+                sx_fiber_stack_release(&cache[k]);
+            }
+            sx_array_free(sx_alloc_malloc(), cache);
+            g_stack_cache.stacks[i] = NULL;
+        }
+    }
+}
+
 sx_fiber_t sx_fiber_create(const sx_fiber_stack stack, sx_fiber_cb* fiber_cb)
 {
     return make_fcontext(stack.sptr, stack.ssize, fiber_cb);
@@ -107,35 +376,63 @@ typedef enum {
     CORO_RET_NONE = 0,
     CORO_RET_END,      // Executation is finished
     CORO_RET_YIELD,    // Pass this 'update' to the next N update which is 'arg' in
-                       // sx_fiber_return
-    CORO_RET_WAIT      // Wait for msecs: 'arg' is msecs in sx_fiber_return
+                       // sx__coro_return
+    CORO_RET_WAIT      // Wait for msecs: 'arg' is msecs in sx__coro_return
 } sx_coro_ret_type;
 
-typedef union {
-    float tm;
-    int n;
-} sx__coro_state_counter;
+// Hierarchical timer wheel: 4 levels of 64 slots, each level covers 64 times the range of the
+// previous one. Coroutines are put into the slot of their wake tick, and they are cascaded down to
+// lower levels as the wheel turns. So waking up is O(1) per coroutine and update doesn't touch the
+// sleeping ones. Yields use a wheel that ticks every update and waits use a wheel of milliseconds
+#define CORO_WHEEL_BITS 6
+#define CORO_WHEEL_SIZE (1 << CORO_WHEEL_BITS)
+#define CORO_WHEEL_MASK (CORO_WHEEL_SIZE - 1)
+#define CORO_WHEEL_LEVELS 4
+
+typedef struct sx__coro_state sx__coro_state;
+
+typedef struct sx__coro_list {
+    sx__coro_state* first;
+    sx__coro_state* last;
+} sx__coro_list;
 
 typedef struct sx__coro_state {
     sx_fiber_t fiber;
     sx_fiber_stack stack_mem;
     sx_fiber_cb* callback;
     void* user;
+    sx_fiber_t caller;    // fiber that resumed the coroutine, we switch back to it on return
     sx_coro_ret_type ret_state;
-    sx__coro_state_counter arg;
-    sx__coro_state_counter counter;
+    int ret_arg;
+    uint64_t wake_tick;    // update number (yield) or milliseconds (wait) to continue
+    double wake_tm;        // wait: exact ctx->tm to continue, wake_tick is its rounded down msecs
     struct sx__coro_state* next;
     struct sx__coro_state* prev;
-    bool init;
+    struct sx__coro_state* wnext;    // links in wheel slot or due list
+    struct sx__coro_state* wprev;
+    sx__coro_list* wlist;            // the list that the coroutine is waiting in, if any
 } sx__coro_state;
 
+typedef struct sx__coro_wheel {
+    sx__coro_list slots[CORO_WHEEL_LEVELS][CORO_WHEEL_SIZE];
+    sx__coro_list pending;    // already expired when they were added, woken on next update
+    uint64_t tick;
+    int count;
+} sx__coro_wheel;
+
 typedef struct sx_coro_context {
     const sx_alloc* alloc;
     sx_pool* coro_pool;             // sx__coro_state
     sx__coro_state* run_list;
     sx__coro_state* run_list_last;
-    sx__coro_state* cur_coro;
+    sx_job_context* job_ctx;        // coroutines are resumed by jobs if not NULL
+    sx_lock_t lock;                 // protects everything but `due` and `resume_list`
+    sx__coro_state** resume_list;   // sx_array: coroutines resumed by jobs in the current update
     int stack_sz;
+    double tm;                      // accumulated update time in seconds
+    sx__coro_wheel yield_wheel;     // ticks every update
+    sx__coro_wheel wait_wheel;      // ticks every millisecond
+    sx__coro_list due;              // woken coroutines that are resumed in the current update
 } sx_coro_context;
 
 static inline void sx__coro_add_list(sx__coro_state** pfirst, sx__coro_state** plast,
@@ -165,7 +462,154 @@ static inline void sx__coro_remove_list(sx__coro_state** pfirst, sx__coro_state*
     node->prev = node->next = NULL;
 }
 
-sx_coro_context* sx_coro_create_context(const sx_alloc* alloc, int num_initial_fibers, int stack_sz)
+static inline void sx__coro_wlist_add(sx__coro_list* list, sx__coro_state* node)
+{
+    node->wnext = NULL;
+    node->wprev = list->last;
+    if (list->last)
+        list->last->wnext = node;
+    else
+        list->first = node;
+    list->last = node;
+    node->wlist = list;
+}
+
+static inline void sx__coro_wlist_remove(sx__coro_state* node)
+{
+    sx__coro_list* list = node->wlist;
+    if (node->wprev)
+        node->wprev->wnext = node->wnext;
+    else
+        list->first = node->wnext;
+    if (node->wnext)
+        node->wnext->wprev = node->wprev;
+    else
+        list->last = node->wprev;
+    node->wnext = node->wprev = NULL;
+    node->wlist = NULL;
+}
+
+// moves all coroutines of the list to the end of `dst`, returns the number of moved coroutines
+static int sx__coro_wlist_move(sx__coro_list* dst, sx__coro_list* src)
+{
+    int count = 0;
+    sx__coro_state* node = src->first;
+    while (node) {
+        sx__coro_state* next = node->wnext;
+        sx__coro_wlist_add(dst, node);
+        node = next;
+        ++count;
+    }
+    src->first = src->last = NULL;
+    return count;
+}
+
+static void sx__coro_wheel_add(sx__coro_wheel* wheel, sx__coro_state* fs)
+{
+    if (fs->wake_tick <= wheel->tick) {
+        sx__coro_wlist_add(&wheel->pending, fs);
+    } else {
+        // pick the level by distance, coroutines further than the whole range are put into the
+        // last slot of the top level and go up and down until they reach the range
+        uint64_t delta = fs->wake_tick - wheel->tick;
+        uint64_t tick = fs->wake_tick;
+        int level = 0;
+        while (level < CORO_WHEEL_LEVELS - 1 &&
+               delta >= ((uint64_t)1 << (CORO_WHEEL_BITS * (level + 1)))) {
+            ++level;
+        }
+        if (delta >= ((uint64_t)1 << (CORO_WHEEL_BITS * CORO_WHEEL_LEVELS)))
+            tick = wheel->tick + ((uint64_t)1 << (CORO_WHEEL_BITS * CORO_WHEEL_LEVELS)) - 1;
+
+        int slot = (int)((tick >> (CORO_WHEEL_BITS * level)) & CORO_WHEEL_MASK);
+        sx__coro_wlist_add(&wheel->slots[level][slot], fs);
+    }
+    ++wheel->count;
+}
+
+static void sx__coro_wheel_remove(sx__coro_wheel* wheel, sx__coro_state* fs)
+{
+    sx__coro_wlist_remove(fs);
+    --wheel->count;
+}
+
+// re-adds the coroutines of the list to the wheel, with respect to the current tick
+static void sx__coro_wheel_readd(sx__coro_wheel* wheel, sx__coro_list* list)
+{
+    sx__coro_state* fs = list->first;
+    list->first = list->last = NULL;
+    while (fs) {
+        sx__coro_state* next = fs->wnext;
+        --wheel->count;
+        sx__coro_wheel_add(wheel, fs);
+        fs = next;
+    }
+}
+
+// turns the wheel up to `tick` and moves all expired coroutines into the `due` list
+static void sx__coro_wheel_advance(sx__coro_wheel* wheel, uint64_t tick, sx__coro_list* due)
+{
+    wheel->count -= sx__coro_wlist_move(due, &wheel->pending);
+
+    if (tick <= wheel->tick)
+        return;
+
+    // big jumps or empty wheels are not worth turning slot by slot, re-add everything instead
+    if (wheel->count == 0 || (tick - wheel->tick) > CORO_WHEEL_SIZE * CORO_WHEEL_SIZE) {
+        sx__coro_list all = { NULL, NULL };
+        for (int l = 0; l < CORO_WHEEL_LEVELS; l++) {
+            for (int i = 0; i < CORO_WHEEL_SIZE; i++)
+                sx__coro_wlist_move(&all, &wheel->slots[l][i]);
+        }
+        wheel->tick = tick;
+        sx__coro_wheel_readd(wheel, &all);
+        wheel->count -= sx__coro_wlist_move(due, &wheel->pending);
+        return;
+    }
+
+    while (wheel->tick < tick) {
+        uint64_t t = ++wheel->tick;
+
+        // cascade upper levels when the lower ones wrap around, top level first, so the
+        // coroutines that come down don't land in a slot that is already cascaded
+        int top = 0;
+        while (top < CORO_WHEEL_LEVELS - 1 &&
+               (t & (((uint64_t)1 << (CORO_WHEEL_BITS * (top + 1))) - 1)) == 0) {
+            ++top;
+        }
+        for (int l = top; l > 0; l--) {
+            int slot = (int)((t >> (CORO_WHEEL_BITS * l)) & CORO_WHEEL_MASK);
+            sx__coro_wheel_readd(wheel, &wheel->slots[l][slot]);
+        }
+
+        wheel->count -= sx__coro_wlist_move(due, &wheel->slots[0][t & CORO_WHEEL_MASK]);
+    }
+
+    // cascaded coroutines that are expired exactly on the tick of the cascade
+    wheel->count -= sx__coro_wlist_move(due, &wheel->pending);
+}
+
+// turns the wait wheel up to the current time. Coroutines that are expired by the rounded down
+// millisecond but not by the exact time, go back to the wheel and are checked on next update
+static void sx__coro_wheel_advance_wait(sx_coro_context* ctx)
+{
+    sx__coro_list expired = { NULL, NULL };
+    sx__coro_wheel* wheel = &ctx->wait_wheel;
+    sx__coro_wheel_advance(wheel, (uint64_t)(ctx->tm * 1000.0), &expired);
+
+    sx__coro_state* fs = expired.first;
+    while (fs) {
+        sx__coro_state* next = fs->wnext;
+        if (fs->wake_tm <= ctx->tm)
+            sx__coro_wlist_add(&ctx->due, fs);
+        else
+            sx__coro_wheel_add(wheel, fs);
+        fs = next;
+    }
+}
+
+static sx_coro_context* sx__coro_create_context(const sx_alloc* alloc, int num_initial_fibers,
+                                                int stack_sz, sx_job_context* job_ctx)
 {
     sx_assert(num_initial_fibers > 0);
     sx_assertf((size_t)stack_sz >= sx_os_minstacksz(), "stack size too small");
@@ -185,93 +629,183 @@ sx_coro_context* sx_coro_create_context(const sx_alloc* alloc, int num_initial_f
         return NULL;
     }
     ctx->stack_sz = stack_sz;
+    ctx->job_ctx = job_ctx;
 
     return ctx;
 }
 
+sx_coro_context* sx_coro_create_context(const sx_alloc* alloc, int num_initial_fibers, int stack_sz)
+{
+    return sx__coro_create_context(alloc, num_initial_fibers, stack_sz, NULL);
+}
+
+sx_coro_context* sx_coro_create_context_jobs(const sx_alloc* alloc, int num_initial_fibers,
+                                             int stack_sz, sx_job_context* job_ctx)
+{
+    sx_assert(job_ctx);
+    return sx__coro_create_context(alloc, num_initial_fibers, stack_sz, job_ctx);
+}
+
 void sx_coro_destroy_context(sx_coro_context* ctx)
 {
     sx_assert(ctx);
 
     const sx_alloc* alloc = ctx->alloc;
     if (ctx->coro_pool) {
-        // TODO: release fiber's stack memory
-        sx__pool_page* page = ctx->coro_pool->pages;
-        int capacity = ctx->coro_pool->capacity;
-        while (page) {
-            for (int i = page->iter; i < capacity; i++) {
-                sx__coro_state* state = page->ptrs[i];
-                if (state->init) {
-                    sx_fiber_stack_release(&state->stack_mem);
-                }
-            }
-            page = page->next;
+        // finished coroutines have already recycled their stacks, only pending ones are left
+        sx__coro_state* fs = ctx->run_list;
+        while (fs) {
+            sx_fiber_stack_recycle(&fs->stack_mem);
+            fs = fs->next;
         }
 
+        sx_array_free(alloc, ctx->resume_list);
         sx_pool_destroy(ctx->coro_pool, alloc);
         sx_free(alloc, ctx);
     }
 }
 
+// must be called within ctx->lock, the stack is not recycled
+static void sx__coro_unlink(sx_coro_context* ctx, sx__coro_state* fs)
+{
+    if (fs->wlist == &ctx->due)
+        sx__coro_wlist_remove(fs);
+    else if (fs->ret_state == CORO_RET_YIELD && fs->wlist)
+        sx__coro_wheel_remove(&ctx->yield_wheel, fs);
+    else if (fs->ret_state == CORO_RET_WAIT && fs->wlist)
+        sx__coro_wheel_remove(&ctx->wait_wheel, fs);
+    sx__coro_remove_list(&ctx->run_list, &ctx->run_list_last, fs);
+    sx_pool_del(ctx->coro_pool, fs);
+}
+
+// Coroutines see their own state as `from` of the transfer, instead of the fiber that resumed them.
+// So sx__coro_return finds the coroutine without going through the context, which may be running
+// other coroutines on other threads at the same time
+static void sx__coro_entry(sx_fiber_transfer transfer)
+{
+    sx__coro_state* fs = transfer.user;
+    fs->caller = transfer.from;
+    fs->callback((sx_fiber_transfer){ .from = (sx_fiber_t)fs, .user = fs->user });
+    sx_assertf(0, "coroutines must exit with sx_coro_end");
+}
+
+static void sx__coro_resume(sx_coro_context* ctx, sx__coro_state* fs)
+{
+    fs->fiber = sx_fiber_switch(fs->fiber, fs).from;
+
+    // we are out of the coroutine's stack now, so it can be scheduled again or removed
+    sx_fiber_stack stack = { 0 };
+    sx_lock(ctx->lock) {
+        switch (fs->ret_state) {
+        case CORO_RET_END:
+            stack = fs->stack_mem;
+            sx__coro_unlink(ctx, fs);
+            break;
+        case CORO_RET_WAIT:
+            // counts from the exact accumulated time, the wheel only tracks whole milliseconds
+            fs->wake_tm = ctx->tm + (double)((float)sx_max(fs->ret_arg, 0) * 0.001f);
+            fs->wake_tick = (uint64_t)(fs->wake_tm * 1000.0);
+            sx__coro_wheel_add(&ctx->wait_wheel, fs);
+            break;
+        case CORO_RET_YIELD:
+            fs->wake_tick = ctx->yield_wheel.tick + (uint64_t)sx_max(fs->ret_arg, 1);   // updates
+            sx__coro_wheel_add(&ctx->yield_wheel, fs);
+            break;
+        default:
+            sx_assertf(0, "Invalid ret type");
+            break;
+        }
+    }
+
+    // releasing stack memory is slow, so we don't hold the lock for it
+    if (stack.sptr)
+        sx_fiber_stack_recycle(&stack);
+}
+
+static void sx__coro_resume_job_cb(int range_start, int range_end, int thread_index, void* user)
+{
+    sx_unused(thread_index);
+    sx_coro_context* ctx = user;
+    for (int i = range_start; i < range_end; i++) {
+        sx__coro_resume(ctx, ctx->resume_list[i]);
+    }
+}
+
 void sx__coro_invoke(sx_coro_context* ctx, sx_fiber_cb* callback, void* user)
 {
-    sx__coro_state* fs = sx_pool_new_and_grow(ctx->coro_pool, ctx->alloc);
+    sx__coro_state* fs = NULL;
+    sx_lock(ctx->lock) {
+        fs = sx_pool_new_and_grow(ctx->coro_pool, ctx->alloc);
+    }
     if (!fs) {
         sx_out_of_memory();
         return;
     }
 
-    // Initialize stack memory if not initilized
-    if (!fs->init) {
-        if (!sx_fiber_stack_init(&fs->stack_mem, ctx->stack_sz)) {
-            sx_out_of_memory();
-            return;
+    // stacks are shared between all contexts through the global stack cache
+    if (!sx_fiber_stack_acquire(&fs->stack_mem, (unsigned int)ctx->stack_sz)) {
+        sx_lock(ctx->lock) {
+            sx_pool_del(ctx->coro_pool, fs);
         }
-        fs->init = true;
+        sx_out_of_memory();
+        return;
     }
 
-    fs->fiber = sx_fiber_create(fs->stack_mem, callback);
+    fs->fiber = sx_fiber_create(fs->stack_mem, sx__coro_entry);
     fs->callback = callback;
     fs->user = user;
+    fs->ret_state = CORO_RET_NONE;
+    fs->wnext = fs->wprev = NULL;
+    fs->wlist = NULL;
     // Add to the end of the list
-    sx__coro_add_list(&ctx->run_list, &ctx->run_list_last, fs);
+    sx_lock(ctx->lock) {
+        sx__coro_add_list(&ctx->run_list, &ctx->run_list_last, fs);
+    }
 
-    ctx->cur_coro = fs;
-    fs->fiber = sx_fiber_switch(fs->fiber, user).from;
+    // runs on the calling thread until the first yield, even if the context is using jobs
+    sx__coro_resume(ctx, fs);
 }
 
 void sx_coro_update(sx_coro_context* ctx, float dt)
 {
-    sx_assert(ctx->cur_coro == NULL);
-
-    sx__coro_state* fs = ctx->run_list;
-    while (fs) {
-        sx__coro_state* next = fs->next;
-
-        // Check state and take action for pending fibers
-        switch (fs->ret_state) {
-        case CORO_RET_YIELD: {
-            ++fs->counter.n;
-            if (fs->counter.n >= fs->arg.n) {
-                ctx->cur_coro = fs;
-                fs->fiber = sx_fiber_switch(fs->fiber, fs->user).from;
+    sx_assertf(!ctx->job_ctx || sx_job_thread_in_context(ctx->job_ctx),
+               "sx_coro_update must be called from the thread that created job_ctx or a job");
+
+    sx_lock(ctx->lock) {
+        ctx->tm += dt;
+        sx__coro_wheel_advance(&ctx->yield_wheel, ctx->yield_wheel.tick + 1, &ctx->due);
+        sx__coro_wheel_advance_wait(ctx);
+
+        if (ctx->job_ctx) {
+            sx_array_clear(ctx->resume_list);
+            while (ctx->due.first) {
+                sx__coro_state* fs = ctx->due.first;
+                sx__coro_wlist_remove(fs);
+                sx_array_push(ctx->alloc, ctx->resume_list, fs);
             }
-            break;
         }
-        case CORO_RET_WAIT: {
-            fs->counter.tm += dt;
-            if (fs->counter.tm >= fs->arg.tm) {
-                ctx->cur_coro = fs;
-                fs->fiber = sx_fiber_switch(fs->fiber, fs->user).from;
-            }
-            break;
+    }
+
+    if (ctx->job_ctx) {
+        // all woken coroutines run in parallel, and the calling thread helps while it waits
+        int count = sx_array_count(ctx->resume_list);
+        if (count > 0) {
+            sx_job_wait_and_del(ctx->job_ctx,
+                                sx_job_dispatch(ctx->job_ctx, count, sx__coro_resume_job_cb, ctx,
+                                                SX_JOB_PRIORITY_NORMAL, 0));
         }
-        default:
-            sx_assertf(0, "Invalid ret type in update loop");
-            break;
+    } else {
+        // coroutines that yield/wait again while they are resumed are added to the wheels, and
+        // don't show up in the due list before the next update
+        while (ctx->due.first) {
+            sx__coro_state* fs = ctx->due.first;
+            sx_assertf(fs->ret_state == CORO_RET_YIELD || fs->ret_state == CORO_RET_WAIT,
+                       "Invalid ret type in update loop");
+            sx_lock(ctx->lock) {
+                sx__coro_wlist_remove(fs);
+            }
+            sx__coro_resume(ctx, fs);
         }
-
-        fs = next;
     }
 }
 
@@ -281,51 +815,49 @@ bool sx_coro_replace_callback(sx_coro_context* ctx, sx_fiber_cb* callback,
     sx_assert(callback);
     bool r = false;
 
-    sx__coro_state* fs = ctx->run_list;
-    while (fs) {
-        sx__coro_state* next = fs->next;
-
-        // just remove the fiber if the new callback is NULL
-        if (fs->callback == callback) {
-            if (new_callback) {
-                fs->callback = new_callback;
-                fs->fiber = sx_fiber_create(fs->stack_mem, new_callback);
-                r = true;
-            } else {
-                sx__coro_remove_list(&ctx->run_list, &ctx->run_list_last, fs);
-                sx_pool_del(ctx->coro_pool, fs);
+    // stacks of the removed coroutines are recycled after the lock is released
+    sx_fiber_stack* stacks = NULL;
+    sx_lock(ctx->lock) {
+        sx__coro_state* fs = ctx->run_list;
+        while (fs) {
+            sx__coro_state* next = fs->next;
+
+            // just remove the fiber if the new callback is NULL
+            if (fs->callback == callback) {
+                if (new_callback) {
+                    fs->callback = new_callback;
+                    fs->fiber = sx_fiber_create(fs->stack_mem, sx__coro_entry);
+                    r = true;
+                } else {
+                    sx_array_push(ctx->alloc, stacks, fs->stack_mem);
+                    sx__coro_unlink(ctx, fs);
+                }
             }
+            fs = next;
         }
-        fs = next;
     }
 
+    for (int i = 0, c = sx_array_count(stacks); i < c; i++)
+        sx_fiber_stack_recycle(&stacks[i]);
+    sx_array_free(ctx->alloc, stacks);
+
     return r;
 }
 
 static inline void sx__coro_return(sx_coro_context* ctx, sx_fiber_t* pfrom, sx_coro_ret_type type,
                                    int arg)
 {
-    sx_assertf(ctx->cur_coro,
-              "You must call this function from within sx_fiber_cb invoked by sx_fiber_invoke");
+    sx_unused(ctx);
     sx_assertf(type != CORO_RET_NONE, "Invalid enum for type");
 
-    sx__coro_state* fs = ctx->cur_coro;
-
-    // If fiber is finished, just remove it from the list
-    if (type == CORO_RET_END) {
-        sx__coro_remove_list(&ctx->run_list, &ctx->run_list_last, fs);
-        sx_pool_del(ctx->coro_pool, fs);
-    } else {
-        fs->ret_state = type;
-        fs->counter.n = 0;
-        if (type == CORO_RET_WAIT)
-            fs->arg.tm = ((float)arg) * 0.001f;    // Convert msecs to seconds
-        else if (type == CORO_RET_YIELD)
-            fs->arg.n = arg;    // Number of next update passes
-    }
+    // see sx__coro_entry, the resumer adds the coroutine to the wheels after we switched out
+    sx__coro_state* fs = (sx__coro_state*)*pfrom;
+    sx_assertf(fs && fs->caller,
+               "You must call this function from within the coroutine invoked by sx_coro_invoke");
+    fs->ret_state = type;
+    fs->ret_arg = arg;
 
-    ctx->cur_coro = NULL;
-    *pfrom = sx_fiber_switch(*pfrom, NULL).from;
+    fs->caller = sx_fiber_switch(fs->caller, NULL).from;
 }
 
 void sx__coro_end(sx_coro_context* ctx, sx_fiber_t* pfrom)
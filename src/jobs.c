@@ -3,147 +3,641 @@
 #include "sx/allocator.h"
 #include "sx/array.h"
 #include "sx/fiber.h"
-#include "sx/os.h"    // sx_os_minstacksz, sx_os_numcores
+#include "sx/math-scalar.h"    // sx_nearest_pow2
+#include "sx/os.h"    // sx_os_minstacksz, sx_os_numcores, sx_os_cpu_topology, sx_os_clock_ns
 #include "sx/pool.h"
+#include "sx/rng.h"
 #include "sx/string.h"    // sx_snprintf
 #include "sx/threads.h"
 #include "sx/lockless.h"
+#include "sx/timer.h"    // sx_tm_now (profiler)
 
-#include <alloca.h>
+#if SX_CONFIG_JOBS_PROFILE
+#    include "sx/io.h"    // sx_file
+#endif
 
-// TODO: job selector, should do some caching/hashing to select the same thread for the job
-//       Maybe hash sx_job_desc and assign thread_id to that
-//       Each thread has a waiting_list for themself, so if we find the hash, put the job into
-//       thread's waiting_list instead of global waiting_list. The selector, should only try once
-//       for it's own waiting_list, if not found push all local list to global list for other
-//       threads to pickup the work This method may reduce the context switches in many situations,
-//       especially in root jobs
+#include <alloca.h>
 
-#define COUNTER_POOL_SIZE 256
+// Scheduling:
+//      Every thread (including main) owns a work-stealing deque per priority. Dispatched jobs are
+//      pushed to the bottom of the caller's deque, the owner pops from the bottom (LIFO) and idle
+//      threads steal from the top (FIFO) of random victims. So the common path never takes a lock.
+//      Victims on the same NUMA node as the thief are tried first, remote nodes only when all
+//      the local deques are empty (nodes are only known when workers are pinned, see affinity).
+//      Jobs that are resumed after 'wait' are pinned to the thread that has started them, and are
+//      pushed to that thread's resume queue, which only the owner takes from. Tagged jobs are
+//      kept in global tag queues (guarded by job_lk), one for each distinct tags value, so
+//      threads only check the first job of the queues that match their tags. Neither of them is
+//      ever scanned job by job.
+//
+// Priorities:
+//      Priorities are scanned from high to low. Each priority keeps the last time that it was
+//      served (a job is picked, or it has been scanned and found empty). If a lower priority is
+//      not served for starvation_us, the next thread that selects a job starts scanning from that
+//      priority. So lower priorities keep progressing under a steady stream of high priority
+//      jobs, and fork-join workloads, which are mostly waiting on higher priority sub-jobs, keep
+//      running depth-first. Timestamps are only written when they are older than a quarter of
+//      the limit, so threads don't fight over the cache line.
+//      Jobs with deadlines are kept in the global deadline_list. When the earliest deadline passes,
+//      the late job is picked before any priority. Deadlines are start deadlines, they are cleared
+//      once the job starts running.
+//
+// Counters (sx_job_t):
+//      Every counter keeps a lock-free list of waiters: jobs that are suspended in
+//      'sx_job_wait_and_del' and deferred dispatches that depend on the counter (see
+//      sx_job_desc.deps). The thread that finishes the last job of a counter closes the list and
+//      pushes all the waiters into the ready queues. So waiting jobs are never polled.
+//      Counters live in a fixed array (max_handles) and free ones are kept in a lock-free stack
+//      (Treiber stack with a tagged head against ABA). sx_job_t is the counter index combined
+//      with the counter's generation, which is bumped on every delete, so using a deleted handle
+//      is detected.
+//
+// Job pool:
+//      sx__job structs are allocated in pages (max_fibers jobs each) that are never moved or freed
+//      until the context is destroyed, and free jobs are kept in a list. Deques grow when they are
+//      full, so any number of jobs can be dispatched at once.
+//      Every thread keeps it's own cache of free jobs. It's refilled from the global list when
+//      it's empty and spills back to it when it has more than two batches (JOB_CACHE_BATCH), so
+//      job_lk is taken once per batch instead of once per job. Jobs are freed by the thread that
+//      finishes them, which is not always the thread that has dispatched them.
+//
+// Fiber stacks:
+//      Jobs don't own a stack. A stack is fetched when the job starts running and is returned
+//      when it's finished, so the number of live stacks is the number of jobs that are running or
+//      suspended in 'wait', rather than all the dispatched jobs. A job always finishes on the
+//      thread that has started it (waiting jobs are pinned to their thread), so every thread
+//      keeps it's own cache of free stacks for each size class and no locking is involved.
+//
+// Inline jobs (SX_JOB_FLAG_INLINE):
+//      Inline jobs don't get a fiber, the scheduler calls them directly on it's own stack.
+//      If an inline job waits, it is promoted: it keeps the scheduler stack as it's own and the
+//      thread continues scheduling on a new stack. When the promoted job is finished, it returns
+//      into the old scheduler frame, so the thread continues scheduling there and the newer
+//      scheduler stack, which is left behind, is released.
+//      Scheduler stacks are large class, because inline jobs run on them.
+//
+// Synchronization (sx_job_mutex, sx_job_event, sx_job_sem):
+//      All three share sx__job_sync: a value and a FIFO of suspended jobs behind a spinlock.
+//      Waiting jobs are suspended the same way as in 'wait': they are pinned to their thread and
+//      linked into the object with their `waiter` node, the signaling thread detaches them and
+//      pushes them to their thread's resume queue. Releasing a mutex or posting a semaphore hands the object
+//      over to the resumed job without touching the value, so it can't be stolen in between.
+//
+// Idle workers:
+//      Workers that run out of jobs keep polling the queues for idle_spin_count times, with
+//      exponential backoff of pause instructions in between, then they park on their own
+//      semaphore. Threads that push jobs only wake parked workers (wake-one-per-job), so there are
+//      no syscalls as long as workers are busy or spinning. Parking is announced before the last
+//      check of the queues and waking is checked after the push, both with seq_cst ordering, so
+//      wakeups can't get lost. Resumed jobs wake their owner thread and tagged jobs only wake
+//      threads with matching tags.
+//
+// Profiling (SX_CONFIG_JOBS_PROFILE):
+//      Events are written by each thread to it's own ring buffer and published by a release store
+//      of the head, readers copy the latest events and re-check the head afterwards to drop the
+//      ones that could be overwritten in the meantime. With profiling disabled, the hooks
+//      (sx__job_profile_*) are empty macros.
+
+#define DEFAULT_MAX_HANDLES 1024
+#define HANDLE_INDEX_BITS 16
+#define HANDLE_INDEX_MASK ((1u << HANDLE_INDEX_BITS) - 1)
 #define DEFAULT_MAX_FIBERS 64
 #define DEFAULT_FIBER_STACK_SIZE 1048576    // 1MB
+#define DEFAULT_SMALL_FIBER_STACK_SIZE 65536    // 64kb
+#define MAX_CACHED_STACKS 16    // per-thread, per-class: extra stacks are released to the OS
+#define JOB_CACHE_BATCH 32      // per-thread free jobs are moved from/to the global list in batches
+#define DEPS_POOL_SIZE 64
+#define WAITERS_CLOSED ((uintptr_t)1)
+#define DEFAULT_IDLE_SPIN_COUNT 64
+#define DEFAULT_IDLE_MAX_PAUSE 64
+#define DEFAULT_PROFILE_EVENTS 65536
+#define DEFAULT_STARVATION_US 1000
+
+typedef struct sx__job sx__job;
+typedef struct sx__job_deps sx__job_deps;
+
+typedef enum sx__job_stack_class {
+    SX__JOB_STACK_LARGE = 0,
+    SX__JOB_STACK_SMALL,
+    SX__JOB_STACK_COUNT
+} sx__job_stack_class;
+
+// node in counter's waiter list, either a suspended job or a deferred dispatch
+typedef struct sx__job_waiter {
+    struct sx__job_waiter* next;
+    sx__job* job;
+    sx__job_deps* deps;
+} sx__job_waiter;
+
+typedef struct sx__job_counter {
+    sx_align_decl(SX_CACHE_LINE_SIZE, sx_atomic_uint32) value;    // number of remaining jobs
+    sx_atomic_ptr waiters;     // sx__job_waiter list, WAITERS_CLOSED when all jobs are done
+    sx_atomic_uint32 gen;      // generation of the handle, never zero
+    sx_atomic_uint32 next_free;    // index+1 of the next free counter, 0 for end of the list
+} sx__job_counter;
 
 typedef struct sx__job {
     int job_index;
     int done;
-    uint32_t owner_tid;
+    int owner;    // index+1 of the thread that the job is pinned to (suspended in wait), 0: none
     uint32_t tags;
-    sx_fiber_stack stack_mem;
-    sx_fiber_t fiber;
-    sx_fiber_t selector_fiber;
-    sx_job_t counter;
-    sx_job_t wait_counter;
+    bool run_inline;
+    sx__job_stack_class stack_class;
+    sx_fiber_stack stack_mem;    // fetched from thread's stack cache when the job starts
+                                 // inline jobs: scheduler stack taken on promotion
+    sx_fiber_t fiber;            // NULL until the job starts
+    sx__job_counter* counter;
+    sx__job_waiter waiter;
     sx_job_context* ctx;
     sx_job_cb* callback;
     void* user;
     int range_start;
     int range_end;
+    int grain_size;    // >0 for parallel_for jobs, see sx__job_run
     sx_job_priority priority;
+    uint64_t deadline;    // sx_os_clock_ns, latest time that the job should start, 0: none
     struct sx__job* next;
     struct sx__job* prev;
 } sx__job;
 
+// Chase-Lev work-stealing deque (growable, holds sx__job pointers)
+// Reference: https://fzn.fr/readings/ppopp13.pdf
+//            "Correct and Efficient Work-Stealing for Weak Memory Models"
+typedef struct sx__job_deque_array {
+    uint32_t mask;
+    struct sx__job_deque_array* prev;    // retired arrays, thieves may still read from them
+    sx_atomic_ptr* items;
+} sx__job_deque_array;
+
+typedef struct sx__job_deque {
+    sx_align_decl(SX_CACHE_LINE_SIZE, sx_atomic_uint32) top;       // written by thieves
+    sx_align_decl(SX_CACHE_LINE_SIZE, sx_atomic_uint32) bottom;    // written by owner
+    sx_align_decl(SX_CACHE_LINE_SIZE, sx_atomic_ptr) array;        // sx__job_deque_array*
+} sx__job_deque;
+
+// sleep state of a worker thread, owned by the context so wakers can access it at any time
+typedef struct sx__job_sleeper {
+    sx_align_decl(SX_CACHE_LINE_SIZE, sx_atomic_uint32) sleeping;    // 1: parked or about to park
+    sx_sem sem;
+} sx__job_sleeper;
+
+// jobs that are resumed after 'wait' and pinned to a thread, only the owner thread takes them
+typedef struct sx__job_resume_queue {
+    sx_lock_t lock;
+    sx_atomic_uint32 count;    // checked by the owner before taking the lock
+    sx__job* first[SX_JOB_PRIORITY_COUNT];
+    sx__job* last[SX_JOB_PRIORITY_COUNT];
+} sx__job_resume_queue;
+
+// tagged jobs, one queue for each distinct tags value. So the first job of a queue can be run by
+// every thread with matching tags, and threads never walk over jobs that they can't run
+typedef struct sx__job_tag_queue {
+    uint32_t tags;
+    sx__job* first[SX_JOB_PRIORITY_COUNT];
+    sx__job* last[SX_JOB_PRIORITY_COUNT];
+} sx__job_tag_queue;
+
+#if SX_CONFIG_JOBS_PROFILE
+// event ring buffer of a thread, only written by it's owner thread
+typedef struct sx__job_profile_ring {
+    sx_align_decl(SX_CACHE_LINE_SIZE, sx_atomic_uint32) head;    // number of recorded events
+    sx_atomic_uint32 counts[SX_JOB_PROFILE_COUNT];
+    sx_atomic_uint64 busy_ticks;
+    sx_atomic_uint64 idle_ticks;
+    uint64_t start_tm;    // beginning of the running job or idle period
+    bool idle;
+    sx_job_profile_event* events;    // count = profile_capacity
+} sx__job_profile_ring;
+#endif
+
 typedef struct sx__job_thread_data {
     sx__job* cur_job;
-    sx_fiber_stack selector_stack;
-    sx_fiber_t selector_fiber;
+    sx_fiber_stack selector_stack;    // stack of the active scheduler fiber
+    sx_fiber_t selector_fiber;        // scheduler context, refreshed on every switch back from it
+    sx_fiber_t native_fiber;          // thread's own context, that started the scheduler
+    sx__job* promoted_job;            // inline job that is handing over it's stack
+    sx_fiber_stack* stacks[SX__JOB_STACK_COUNT];    // sx_array: free stacks of each class
+    sx__job_deque* deques;    // count = SX_JOB_PRIORITY_COUNT, owned by this thread
+    sx__job* job_cache;       // free jobs of this thread, linked with `next`
+    int num_cached_jobs;
+    sx_rng rng;               // random victim selection for stealing
+    int* victims;             // count = num_threads: thread indexes on the same node come first
+    int num_local_victims;
     int thread_index;
     uint32_t tid;
     uint32_t tags;
+    uint32_t num_executed;    // main thread: jobs run by the scheduler (see sx_job_pump)
     bool main_thrd;
 } sx__job_thread_data;
 
 typedef struct sx__job_pending {
-    sx_job_t counter;
+    sx__job_counter* counter;
+    int num_jobs;
     int range_size;
     int range_reminder;
+    int grain_size;
     sx_job_cb* callback;
     void* user;
     sx_job_priority priority;
     uint32_t tags;
+    sx_job_flags flags;
+    uint64_t deadline;
 } sx__job_pending;
 
+// dispatch that is deferred until all of it's dependencies are done
+typedef struct sx__job_deps {
+    sx__job_pending pending;
+    sx_atomic_uint32 num_remaining;
+    sx__job_waiter waiters[SX_JOB_MAX_DEPS];
+} sx__job_deps;
+
+// state of sx_job_mutex, sx_job_event and sx_job_sem
+typedef struct sx__job_sync {
+    sx_lock_t lock;
+    int value;                 // mutex: 1 if locked, event: 1 if set, semaphore: count
+    sx__job_waiter* first;     // jobs suspended on the object (FIFO), linked with waiter.next
+    sx__job_waiter* last;
+} sx__job_sync;
+
 typedef struct sx_job_context {
     const sx_alloc* alloc;
     sx_thread** threads;
     int num_threads;
-    int stack_sz;
-    sx_pool* job_pool;        // sx__job: not-growable !
-    sx_pool* counter_pool;    // int: growable
-    sx__job* waiting_list[SX_JOB_PRIORITY_COUNT];
-    sx__job* waiting_list_last[SX_JOB_PRIORITY_COUNT];
+    int stack_sizes[SX__JOB_STACK_COUNT];
+    sx__job* job_free;        // free list of sx__job (linked with `next`), guarded by job_lk
+    sx__job** job_pages;      // sx_array: pages of job_page_size jobs, addresses are stable
+    int job_page_size;
+    sx__job_counter* counters;    // count = max_handles
+    sx_atomic_uint64 counter_free;    // free list head: (tag << 32) | (index + 1)
+    sx_atomic_uint32 num_counters;    // number of handles in use
+    int max_handles;
+    sx_pool* deps_pool;       // sx__job_deps: growable
+    sx__job_deque* deques;    // count = (num_threads + 1) * SX_JOB_PRIORITY_COUNT
+    sx__job_resume_queue* resume_queues;    // count = num_threads + 1
+    sx__job_tag_queue* tag_queues;          // sx_array: never shrinks, guarded by job_lk
+    sx_atomic_uint32 num_tagged;            // number of jobs in tag_queues
+    sx__job* deadline_list[SX_JOB_PRIORITY_COUNT];    // jobs with deadlines, guarded by job_lk
+    sx__job* deadline_list_last[SX_JOB_PRIORITY_COUNT];
+    sx_atomic_uint32 num_deadlines;    // number of jobs in deadline_list
+    sx_atomic_uint64 next_deadline;    // earliest deadline in deadline_list (or earlier), job_lk
+    sx_atomic_uint64* served_tm;       // count = SX_JOB_PRIORITY_COUNT, one per cache line
+    uint64_t starvation_ns;            // 0: strict priorities
     uint32_t* tags;      // count = num_threads + 1
-    sx_lock_t job_lk;
-    sx_lock_t counter_lk;
+    int* thread_cpus;     // count = num_threads + 1: cpu id that the thread is pinned to or -1
+    int* thread_nodes;    // count = num_threads + 1: NUMA node of the thread's cpu
+    sx_lock_adaptive_t job_lk;
+    sx_lock_t deps_lk;
     sx_tls thread_tls;
-    sx_atomic_uint32 dummy_counter;
-    sx_sem sem;
+    sx__job_sleeper* sleepers;    // count = num_threads + 1 (main thread never parks)
+    sx_atomic_uint32 num_sleeping;
+    int idle_spin_count;
+    int idle_max_pause;
     int quit;
     sx_job_thread_init_cb* thread_init_cb;
     sx_job_thread_shutdown_cb* thread_shutdown_cb;
     void* thread_user;
-    sx__job_pending* pending;
+#if SX_CONFIG_JOBS_PROFILE
+    sx__job_profile_ring* profile_rings;    // count = num_threads + 1
+    uint32_t profile_capacity;              // power of two
+#endif
 } sx_job_context;
 
-static void sx__del_job(sx_job_context* ctx, sx__job* job)
+static inline sx_job_t sx__job_handle(sx_job_context* ctx, sx__job_counter* counter)
 {
-    sx_lock(ctx->job_lk) {
-        sx_pool_del(ctx->job_pool, job);
+    uint32_t index = (uint32_t)(counter - ctx->counters);
+    uint32_t gen = sx_atomic_load32_explicit(&counter->gen, SX_ATOMIC_MEMORYORDER_RELAXED);
+    return (sx_job_t)((gen << HANDLE_INDEX_BITS) | index);
+}
+
+#if SX_CONFIG_JOBS_PROFILE
+static void sx__job_profile_record(sx_job_context* ctx, sx__job_thread_data* tdata,
+                                   sx_job_profile_event_type type, sx_job_t handle, int job_index,
+                                   sx_job_priority priority, uint32_t arg)
+{
+    sx__job_profile_ring* ring = &ctx->profile_rings[tdata->thread_index];
+    uint64_t tm = sx_tm_now();
+    uint32_t head = sx_atomic_load32_explicit(&ring->head, SX_ATOMIC_MEMORYORDER_RELAXED);
+
+    sx_job_profile_event* ev = &ring->events[head & (ctx->profile_capacity - 1)];
+    ev->tm = tm;
+    ev->job = handle;
+    ev->job_index = job_index;
+    ev->arg = arg;
+    ev->thread_index = (uint16_t)tdata->thread_index;
+    ev->type = (uint8_t)type;
+    ev->priority = (uint8_t)priority;
+    sx_atomic_store32_explicit(&ring->head, head + 1, SX_ATOMIC_MEMORYORDER_RELEASE);
+
+    // totals are only written by this thread
+    sx_atomic_store32_explicit(
+        &ring->counts[type],
+        sx_atomic_load32_explicit(&ring->counts[type], SX_ATOMIC_MEMORYORDER_RELAXED) + 1,
+        SX_ATOMIC_MEMORYORDER_RELAXED);
+    sx_atomic_uint64* total = NULL;
+    switch (type) {
+    case SX_JOB_PROFILE_START:
+    case SX_JOB_PROFILE_RESUME:
+    case SX_JOB_PROFILE_IDLE_BEGIN:
+        ring->start_tm = tm;
+        break;
+    case SX_JOB_PROFILE_END:
+    case SX_JOB_PROFILE_WAIT:
+        total = &ring->busy_ticks;
+        break;
+    case SX_JOB_PROFILE_IDLE_END:
+        total = &ring->idle_ticks;
+        break;
+    default:
+        break;
+    }
+    if (total) {
+        uint64_t value = sx_atomic_load64_explicit(total, SX_ATOMIC_MEMORYORDER_RELAXED);
+        sx_atomic_store64_explicit(total, value + (tm - ring->start_tm),
+                                   SX_ATOMIC_MEMORYORDER_RELAXED);
     }
 }
 
-static void fiber_fn(sx_fiber_transfer transfer)
+static void sx__job_profile_record_idle(sx_job_context* ctx, sx__job_thread_data* tdata,
+                                        bool idle)
 {
-    sx__job* job = (sx__job*)transfer.user;
-    sx_job_context* ctx = job->ctx;
-    sx__job_thread_data* tdata = (sx__job_thread_data*)sx_tls_get(ctx->thread_tls);
+    sx__job_profile_ring* ring = &ctx->profile_rings[tdata->thread_index];
+    if (ring->idle != idle) {
+        ring->idle = idle;
+        sx__job_profile_record(ctx, tdata,
+                               idle ? SX_JOB_PROFILE_IDLE_BEGIN : SX_JOB_PROFILE_IDLE_END, 0, 0,
+                               0, 0);
+    }
+}
 
-    sx_assert(tdata->cur_job == job);
+#    define sx__job_profile_job(_ctx, _tdata, _type, _job, _arg)                                \
+        sx__job_profile_record(_ctx, _tdata, _type, sx__job_handle(_ctx, (_job)->counter),     \
+                               (_job)->job_index, (_job)->priority, _arg)
+#    define sx__job_profile_dispatch(_ctx, _tdata, _handle, _priority, _num_jobs)              \
+        sx__job_profile_record(_ctx, _tdata, SX_JOB_PROFILE_DISPATCH, _handle, 0, _priority,     \
+                               (uint32_t)(_num_jobs))
+#    define sx__job_profile_idle(_ctx, _tdata, _idle) \
+        sx__job_profile_record_idle(_ctx, _tdata, _idle)
+#else
+#    define sx__job_profile_job(_ctx, _tdata, _type, _job, _arg)
+#    define sx__job_profile_dispatch(_ctx, _tdata, _handle, _priority, _num_jobs)
+#    define sx__job_profile_idle(_ctx, _tdata, _idle)
+#endif    // SX_CONFIG_JOBS_PROFILE
+
+// moves a batch of free jobs from the global list to the thread's cache
+static void sx__job_cache_refill(sx_job_context* ctx, sx__job_thread_data* tdata)
+{
+    sx_lock_adaptive(ctx->job_lk) {
+        for (int i = 0; i < JOB_CACHE_BATCH; i++) {
+            if (!ctx->job_free) {
+                // grow by one page, jobs are never moved, so it's safe while they are in the queues
+                sx__job* page =
+                    (sx__job*)sx_malloc(ctx->alloc, sizeof(sx__job) * ctx->job_page_size);
+                if (!page) {
+                    sx_out_of_memory();
+                    break;
+                }
+                sx_array_push(ctx->alloc, ctx->job_pages, page);
+                for (int k = ctx->job_page_size - 1; k >= 0; k--) {
+                    page[k].next = ctx->job_free;
+                    ctx->job_free = &page[k];
+                }
+            }
 
-    job->selector_fiber = transfer.from;
-    tdata->selector_fiber = transfer.from;
-    tdata->cur_job = job;
+            sx__job* job = ctx->job_free;
+            ctx->job_free = job->next;
+            job->next = tdata->job_cache;
+            tdata->job_cache = job;
+            ++tdata->num_cached_jobs;
+        }
+    }
+}
 
-    // Run the actual job code
-    job->callback(job->range_start, job->range_end, tdata->thread_index, job->user);
-    job->done = 1;
+// job_lk must not be held by the caller, it's taken when the thread's cache is empty
+static sx__job* sx__job_alloc(sx_job_context* ctx, sx__job_thread_data* tdata)
+{
+    if (!tdata->job_cache) {
+        sx__job_cache_refill(ctx, tdata);
+        if (!tdata->job_cache)
+            return NULL;
+    }
+
+    sx__job* job = tdata->job_cache;
+    tdata->job_cache = job->next;
+    --tdata->num_cached_jobs;
+    return job;
+}
+
+static void sx__del_job(sx_job_context* ctx, sx__job_thread_data* tdata, sx__job* job)
+{
+    job->next = tdata->job_cache;
+    tdata->job_cache = job;
+    if (++tdata->num_cached_jobs <= JOB_CACHE_BATCH * 2)
+        return;
+
+    // keep one batch, so a thread that is dispatching right after doesn't refill immediately
+    sx__job* first = tdata->job_cache;
+    sx__job* last = first;
+    for (int i = 1; i < JOB_CACHE_BATCH; i++)
+        last = last->next;
+    tdata->job_cache = last->next;
+    tdata->num_cached_jobs -= JOB_CACHE_BATCH;
+
+    sx_lock_adaptive(ctx->job_lk) {
+        last->next = ctx->job_free;
+        ctx->job_free = first;
+    }
+}
+
+static sx__job_deque_array* sx__job_deque_new_array(const sx_alloc* alloc, int capacity)
+{
+    sx_assert(sx_ispow2(capacity));
+    sx__job_deque_array* arr = (sx__job_deque_array*)sx_malloc(
+        alloc, sizeof(sx__job_deque_array) + sizeof(sx_atomic_ptr) * (size_t)capacity);
+    if (!arr) {
+        sx_out_of_memory();
+        return NULL;
+    }
+    arr->mask = (uint32_t)capacity - 1;
+    arr->prev = NULL;
+    arr->items = (sx_atomic_ptr*)(arr + 1);
+    return arr;
+}
+
+static bool sx__job_deque_init(sx__job_deque* dq, const sx_alloc* alloc, int capacity)
+{
+    sx__job_deque_array* arr = sx__job_deque_new_array(alloc, capacity);
+    if (!arr)
+        return false;
+    dq->array = (uintptr_t)arr;
+    dq->top = dq->bottom = 0;
+    return true;
+}
+
+static void sx__job_deque_release(sx__job_deque* dq, const sx_alloc* alloc)
+{
+    sx__job_deque_array* arr = (sx__job_deque_array*)(uintptr_t)dq->array;
+    while (arr) {
+        sx__job_deque_array* prev = arr->prev;
+        sx_free(alloc, arr);
+        arr = prev;
+    }
+    dq->array = 0;
+}
+
+// owner thread only
+static bool sx__job_deque_push(sx__job_deque* dq, const sx_alloc* alloc, sx__job* job)
+{
+    uint32_t b = sx_atomic_load32_explicit(&dq->bottom, SX_ATOMIC_MEMORYORDER_RELAXED);
+    uint32_t t = sx_atomic_load32_explicit(&dq->top, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+    sx__job_deque_array* arr = (sx__job_deque_array*)(uintptr_t)sx_atomic_loadptr_explicit(
+        &dq->array, SX_ATOMIC_MEMORYORDER_RELAXED);
+
+    if ((b - t) > arr->mask) {
+        // full: double the size. old array is kept until the deque is released, because thieves
+        // may be reading from it
+        sx__job_deque_array* new_arr = sx__job_deque_new_array(alloc, (int)(arr->mask + 1) * 2);
+        if (!new_arr)
+            return false;
+        for (uint32_t i = t; i != b; i++) {
+            sx_atomic_storeptr_explicit(&new_arr->items[i & new_arr->mask],
+                                        sx_atomic_loadptr_explicit(&arr->items[i & arr->mask],
+                                                                   SX_ATOMIC_MEMORYORDER_RELAXED),
+                                        SX_ATOMIC_MEMORYORDER_RELAXED);
+        }
+        new_arr->prev = arr;
+        sx_atomic_storeptr_explicit(&dq->array, (uintptr_t)new_arr, SX_ATOMIC_MEMORYORDER_RELEASE);
+        arr = new_arr;
+    }
+
+    sx_atomic_storeptr_explicit(&arr->items[b & arr->mask], (uintptr_t)job,
+                                SX_ATOMIC_MEMORYORDER_RELAXED);
+    sx_atomic_thread_fence(SX_ATOMIC_MEMORYORDER_RELEASE);
+    sx_atomic_store32_explicit(&dq->bottom, b + 1, SX_ATOMIC_MEMORYORDER_RELAXED);
+    return true;
+}
+
+// owner thread only
+static sx__job* sx__job_deque_pop(sx__job_deque* dq)
+{
+    uint32_t b = sx_atomic_load32_explicit(&dq->bottom, SX_ATOMIC_MEMORYORDER_RELAXED) - 1;
+    sx_atomic_store32_explicit(&dq->bottom, b, SX_ATOMIC_MEMORYORDER_RELAXED);
+    sx_atomic_thread_fence(SX_ATOMIC_MEMORYORDER_SEQCST);
+    uint32_t t = sx_atomic_load32_explicit(&dq->top, SX_ATOMIC_MEMORYORDER_RELAXED);
+
+    sx__job* job = NULL;
+    if ((int32_t)(b - t) >= 0) {
+        sx__job_deque_array* arr = (sx__job_deque_array*)(uintptr_t)sx_atomic_loadptr_explicit(
+            &dq->array, SX_ATOMIC_MEMORYORDER_RELAXED);
+        job = (sx__job*)sx_atomic_loadptr_explicit(&arr->items[b & arr->mask],
+                                                   SX_ATOMIC_MEMORYORDER_RELAXED);
+        if (t == b) {
+            // last item in the deque, race against thieves
+            if (!sx_atomic_compare_exchange32_strong_explicit(&dq->top, &t, t + 1,
+                                                              SX_ATOMIC_MEMORYORDER_SEQCST,
+                                                              SX_ATOMIC_MEMORYORDER_RELAXED)) {
+                job = NULL;
+            }
+            sx_atomic_store32_explicit(&dq->bottom, b + 1, SX_ATOMIC_MEMORYORDER_RELAXED);
+        }
+    } else {
+        sx_atomic_store32_explicit(&dq->bottom, b + 1, SX_ATOMIC_MEMORYORDER_RELAXED);
+    }
+    return job;
+}
+
+// thieves may be stealing concurrently, so it's only a hint
+static inline bool sx__job_deque_empty(sx__job_deque* dq)
+{
+    uint32_t b = sx_atomic_load32_explicit(&dq->bottom, SX_ATOMIC_MEMORYORDER_RELAXED);
+    uint32_t t = sx_atomic_load32_explicit(&dq->top, SX_ATOMIC_MEMORYORDER_RELAXED);
+    return (int32_t)(b - t) <= 0;
+}
 
-    // Back to job caller
-    sx_fiber_switch(transfer.from, transfer.user);
+// any thread, sets `aborted` if lost the race to another thief or the owner
+static sx__job* sx__job_deque_steal(sx__job_deque* dq, bool* aborted)
+{
+    uint32_t t = sx_atomic_load32_explicit(&dq->top, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+    sx_atomic_thread_fence(SX_ATOMIC_MEMORYORDER_SEQCST);
+    uint32_t b = sx_atomic_load32_explicit(&dq->bottom, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+
+    if ((int32_t)(b - t) > 0) {
+        sx__job_deque_array* arr = (sx__job_deque_array*)(uintptr_t)sx_atomic_loadptr_explicit(
+            &dq->array, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+        sx__job* job = (sx__job*)sx_atomic_loadptr_explicit(&arr->items[t & arr->mask],
+                                                            SX_ATOMIC_MEMORYORDER_RELAXED);
+        if (!sx_atomic_compare_exchange32_strong_explicit(&dq->top, &t, t + 1,
+                                                          SX_ATOMIC_MEMORYORDER_SEQCST,
+                                                          SX_ATOMIC_MEMORYORDER_RELAXED)) {
+            *aborted = true;
+            return NULL;
+        }
+        return job;
+    }
+    return NULL;
 }
 
-static sx__job* sx__new_job(sx_job_context* ctx, int index, sx_job_cb* callback, void* user,
-                            int range_start, int range_end, sx_job_t counter, uint32_t tags,
-                            sx_job_priority priority)
+static sx__job* sx__new_job(sx_job_context* ctx, sx__job_thread_data* tdata, int index,
+                            const sx__job_pending* pending, int range_start, int range_end)
 {
-    sx__job* j = (sx__job*)sx_pool_new(ctx->job_pool);
+    sx__job* j = sx__job_alloc(ctx, tdata);
 
     if (j) {
         j->job_index = index;
-        j->owner_tid = 0;
-        j->tags = tags;
+        j->owner = 0;
+        j->tags = pending->tags;
         j->done = 0;
-        if (!j->stack_mem.sptr) {
-            // Initialize stack memory
-            if (!sx_fiber_stack_init(&j->stack_mem, ctx->stack_sz)) {
-                sx_out_of_memory();
-                return NULL;
-            }
-        }
-        j->fiber = sx_fiber_create(j->stack_mem, fiber_fn);
-        j->counter = counter;
-        j->wait_counter = &ctx->dummy_counter;
+        j->run_inline = (pending->flags & SX_JOB_FLAG_INLINE) ? true : false;
+        j->stack_class =
+            (pending->flags & SX_JOB_FLAG_SMALL_STACK) ? SX__JOB_STACK_SMALL : SX__JOB_STACK_LARGE;
+        j->stack_mem.sptr = NULL;
+        j->stack_mem.ssize = 0;
+        j->fiber = NULL;
+        j->counter = pending->counter;
+        j->waiter.job = j;
+        j->waiter.deps = NULL;
         j->ctx = ctx;
-        j->callback = callback;
-        j->user = user;
+        j->callback = pending->callback;
+        j->user = pending->user;
         j->range_start = range_start;
         j->range_end = range_end;
-        j->priority = priority;
+        j->grain_size = pending->grain_size;
+        j->priority = pending->priority;
+        j->deadline = pending->deadline;
         j->next = j->prev = NULL;
     }
     return j;
 }
 
+static bool sx__job_stack_acquire(sx_job_context* ctx, sx__job_thread_data* tdata,
+                                  sx__job_stack_class stack_class, sx_fiber_stack* stack)
+{
+    sx_fiber_stack* cache = tdata->stacks[stack_class];
+    int count = sx_array_count(cache);
+    if (count > 0) {
+        *stack = cache[count - 1];
+        sx_array_pop_last(cache);
+        return true;
+    }
+
+    if (!sx_fiber_stack_init(stack, (unsigned int)ctx->stack_sizes[stack_class])) {
+        sx_out_of_memory();
+        return false;
+    }
+    return true;
+}
+
+static void sx__job_stack_release(sx_job_context* ctx, sx__job_thread_data* tdata,
+                                  sx__job_stack_class stack_class, sx_fiber_stack* stack)
+{
+    if (sx_array_count(tdata->stacks[stack_class]) < MAX_CACHED_STACKS) {
+        sx_array_push(ctx->alloc, tdata->stacks[stack_class], *stack);
+    } else {
+        sx_fiber_stack_release(stack);
+    }
+    stack->sptr = NULL;
+    stack->ssize = 0;
+}
+
 static inline void sx__job_add_list(sx__job** pfirst, sx__job** plast, sx__job* node)
 {
     // Add to the end of the list
@@ -169,336 +663,1335 @@ static inline void sx__job_remove_list(sx__job** pfirst, sx__job** plast, sx__jo
     node->prev = node->next = NULL;
 }
 
-typedef struct sx__job_select_result {  
+// job_lk must be held by the caller
+static inline void sx__job_add_deadline_list(sx_job_context* ctx, sx__job* job)
+{
+    sx__job_add_list(&ctx->deadline_list[job->priority],
+                     &ctx->deadline_list_last[job->priority], job);
+    if (sx_atomic_load32_explicit(&ctx->num_deadlines, SX_ATOMIC_MEMORYORDER_RELAXED) == 0 ||
+        job->deadline <
+            sx_atomic_load64_explicit(&ctx->next_deadline, SX_ATOMIC_MEMORYORDER_RELAXED)) {
+        sx_atomic_store64_explicit(&ctx->next_deadline, job->deadline,
+                                   SX_ATOMIC_MEMORYORDER_RELAXED);
+    }
+    sx_atomic_fetch_add32_explicit(&ctx->num_deadlines, 1, SX_ATOMIC_MEMORYORDER_RELEASE);
+}
+
+// job_lk must be held by the caller
+static inline void sx__job_remove_deadline_list(sx_job_context* ctx, sx__job* job)
+{
+    sx__job_remove_list(&ctx->deadline_list[job->priority],
+                        &ctx->deadline_list_last[job->priority], job);
+    sx_atomic_fetch_sub32_explicit(&ctx->num_deadlines, 1, SX_ATOMIC_MEMORYORDER_RELAXED);
+}
+
+// job_lk must be held by the caller
+static void sx__job_add_tag_queue(sx_job_context* ctx, sx__job* job)
+{
+    sx__job_tag_queue* queue = NULL;
+    for (int i = 0, c = sx_array_count(ctx->tag_queues); i < c; i++) {
+        if (ctx->tag_queues[i].tags == job->tags) {
+            queue = &ctx->tag_queues[i];
+            break;
+        }
+    }
+
+    if (!queue) {
+        queue = sx_array_add(ctx->alloc, ctx->tag_queues, 1);
+        sx_assertf(queue, "out of memory for tag queues");
+        sx_memset(queue, 0x0, sizeof(sx__job_tag_queue));
+        queue->tags = job->tags;
+    }
+
+    sx__job_add_list(&queue->first[job->priority], &queue->last[job->priority], job);
+    sx_atomic_fetch_add32_explicit(&ctx->num_tagged, 1, SX_ATOMIC_MEMORYORDER_RELEASE);
+}
+
+// jobs with deadlines or tags go to the global lists, which are guarded by job_lk
+static inline bool sx__job_needs_lock(const sx__job* job)
+{
+    return job->deadline != 0 || job->tags != 0;
+}
+
+// Pushes a newly created job to the current thread's deque, or to the global deadline list or tag
+// queues if it has a deadline or tags. job_lk must be held by the caller for the latter
+// (see sx__job_needs_lock)
+static void sx__job_submit(sx_job_context* ctx, sx__job_thread_data* tdata, sx__job* job)
+{
+    if (job->deadline) {
+        sx__job_add_deadline_list(ctx, job);
+    } else if (job->tags) {
+        sx__job_add_tag_queue(ctx, job);
+    } else {
+        bool r = sx__job_deque_push(&tdata->deques[job->priority], ctx->alloc, job);
+        sx_assertf(r, "out of memory for job deque");
+        sx_unused(r);
+    }
+}
+
+// submits a list of new jobs that is linked with `next`
+static void sx__job_submit_list(sx_job_context* ctx, sx__job_thread_data* tdata, sx__job* first)
+{
+    while (first) {
+        sx__job* next = first->next;
+        first->next = NULL;
+        sx__job_submit(ctx, tdata, first);
+        first = next;
+    }
+}
+
+typedef struct sx__job_select_result {
     sx__job* job;
-    bool waiting_list_alive;
+    bool retry;    // a steal is aborted by other thieves, so there may be jobs left
 } sx__job_select_result;
 
+static bool sx__job_sleeper_claim(sx_job_context* ctx, sx__job_sleeper* sleeper)
+{
+    uint32_t expected = 1;
+    if (sx_atomic_load32_explicit(&sleeper->sleeping, SX_ATOMIC_MEMORYORDER_RELAXED) == 1 &&
+        sx_atomic_compare_exchange32_strong_explicit(&sleeper->sleeping, &expected, 0,
+                                                     SX_ATOMIC_MEMORYORDER_ACQREL,
+                                                     SX_ATOMIC_MEMORYORDER_RELAXED)) {
+        sx_atomic_fetch_sub32(&ctx->num_sleeping, 1);
+        return true;
+    }
+    return false;
+}
+
+// Wakes up to `count` parked workers that can run jobs with `tags`. Must be called after the jobs
+// are pushed. Does nothing if no worker is parked
+static void sx__job_wake(sx_job_context* ctx, int count, uint32_t tags)
+{
+    sx_atomic_thread_fence(SX_ATOMIC_MEMORYORDER_SEQCST);
+    if (sx_atomic_load32_explicit(&ctx->num_sleeping, SX_ATOMIC_MEMORYORDER_RELAXED) == 0)
+        return;
+
+    for (int i = 1, c = ctx->num_threads + 1; i < c && count > 0; i++) {
+        if (tags != 0 && !(ctx->tags[i] & tags))
+            continue;
+        if (sx__job_sleeper_claim(ctx, &ctx->sleepers[i])) {
+            sx_semaphore_post(&ctx->sleepers[i].sem, 1);
+            --count;
+        }
+    }
+}
 
-static sx__job_select_result sx__job_select(sx_job_context* ctx, uint32_t tid, uint32_t tags)
+// Wakes the thread that a resumed job is pinned to, if it's parked (main thread never parks)
+static void sx__job_wake_owner(sx_job_context* ctx, int thread_index)
 {
-    sx__job_select_result r = { 0 };
-    
-    sx_lock(ctx->job_lk) {
-        for (int pr = 0; pr < SX_JOB_PRIORITY_COUNT; pr++) {
-            sx__job* node = ctx->waiting_list[pr];
-            while (node) {
-                r.waiting_list_alive = true;
-                if (*node->wait_counter == 0) {    // job must not be waiting/depend on any jobs
-                    if ((node->owner_tid == 0 || node->owner_tid == tid) &&
-                        (node->tags == 0 || (node->tags & tags))) {
-                        r.job = node;
-                        sx__job_remove_list(&ctx->waiting_list[pr], &ctx->waiting_list_last[pr], node);
-                        pr = SX_JOB_PRIORITY_COUNT; // break out of the outer loop
+    sx_atomic_thread_fence(SX_ATOMIC_MEMORYORDER_SEQCST);
+    if (thread_index == 0 ||
+        sx_atomic_load32_explicit(&ctx->num_sleeping, SX_ATOMIC_MEMORYORDER_RELAXED) == 0) {
+        return;
+    }
+
+    if (sx__job_sleeper_claim(ctx, &ctx->sleepers[thread_index]))
+        sx_semaphore_post(&ctx->sleepers[thread_index].sem, 1);
+}
+
+// Pushes a suspended job to the resume queue of it's owner thread
+static void sx__job_resume(sx_job_context* ctx, sx__job* job)
+{
+    int thread_index = job->owner - 1;    // reset by the owner as soon as it takes the job
+    sx__job_resume_queue* queue = &ctx->resume_queues[thread_index];
+    sx_lock(queue->lock) {
+        sx__job_add_list(&queue->first[job->priority], &queue->last[job->priority], job);
+        sx_atomic_fetch_add32_explicit(&queue->count, 1, SX_ATOMIC_MEMORYORDER_RELEASE);
+    }
+    sx__job_wake_owner(ctx, thread_index);
+}
+
+// Checks if there is any job that this thread can run, without taking it
+static bool sx__job_has_work(sx_job_context* ctx, sx__job_thread_data* tdata)
+{
+    for (int i = 0, c = (ctx->num_threads + 1) * SX_JOB_PRIORITY_COUNT; i < c; i++) {
+        if (!sx__job_deque_empty(&ctx->deques[i]))
+            return true;
+    }
+
+    if (sx_atomic_load32_explicit(&ctx->resume_queues[tdata->thread_index].count,
+                                  SX_ATOMIC_MEMORYORDER_ACQUIRE) > 0) {
+        return true;
+    }
+
+    bool found = false;
+    if (sx_atomic_load32_explicit(&ctx->num_tagged, SX_ATOMIC_MEMORYORDER_ACQUIRE) > 0 ||
+        sx_atomic_load32_explicit(&ctx->num_deadlines, SX_ATOMIC_MEMORYORDER_ACQUIRE) > 0) {
+        sx_lock_adaptive(ctx->job_lk) {
+            for (int i = 0, c = sx_array_count(ctx->tag_queues); i < c && !found; i++) {
+                const sx__job_tag_queue* queue = &ctx->tag_queues[i];
+                if (!(queue->tags & tdata->tags))
+                    continue;
+                for (int pr = 0; pr < SX_JOB_PRIORITY_COUNT && !found; pr++)
+                    found = queue->first[pr] != NULL;
+            }
+            for (int pr = 0; pr < SX_JOB_PRIORITY_COUNT && !found; pr++) {
+                for (sx__job* node = ctx->deadline_list[pr]; node; node = node->next) {
+                    if (node->tags == 0 || (node->tags & tdata->tags)) {
+                        found = true;
                         break;
                     }
                 }
-                node = node->next;
-            }    // while(iterate nodes)
-        }        // foreach(priority)
-    } // lock
+            }
+        }
+    }
+    return found;
+}
+
+// Pushes the second half of the remaining range of a parallel_for job as a new job
+static bool sx__job_split(sx_job_context* ctx, sx__job_thread_data* tdata, sx__job* job)
+{
+    int mid = job->range_start + (job->range_end - job->range_start) / 2;
+    sx__job* split = sx__job_alloc(ctx, tdata);
+    if (!split)
+        return false;
+
+    *split = *job;
+    split->job_index = -1;
+    split->owner = 0;
+    split->stack_mem.sptr = NULL;
+    split->stack_mem.ssize = 0;
+    split->fiber = NULL;
+    split->waiter.job = split;
+    split->range_start = mid;
+    split->next = split->prev = NULL;
+
+    // current job is not finished yet, so the counter can't reach zero in between
+    sx_atomic_fetch_add32_explicit(&job->counter->value, 1, SX_ATOMIC_MEMORYORDER_RELAXED);
+    job->range_end = mid;
+
+    // split can be stolen and finished as soon as it's pushed
+    uint32_t tags = split->tags;
+    if (sx__job_needs_lock(split)) {
+        sx_lock_adaptive(ctx->job_lk) {
+            sx__job_submit(ctx, tdata, split);
+        }
+    } else {
+        sx__job_submit(ctx, tdata, split);
+    }
+
+    sx__job_wake(ctx, 1, tags);
+    return true;
+}
+
+// Runs the callback of the job. parallel_for jobs (grain_size > 0) are run in grain_size chunks
+// and the remaining range is split in half whenever the thread's deque is empty, which means that
+// the other threads have taken everything and are idle (lazy binary splitting)
+// Reference: "Lazy Binary-Splitting: A Run-Time Adaptive Work-Stealing Scheduler" (Tzannes et al.)
+static void sx__job_run(sx_job_context* ctx, sx__job_thread_data* tdata, sx__job* job)
+{
+    int grain_size = job->grain_size;
+    if (grain_size <= 0) {
+        job->callback(job->range_start, job->range_end, tdata->thread_index, job->user);
+        return;
+    }
+
+    sx__job_deque* dq = &tdata->deques[job->priority];
+    while (job->range_start < job->range_end) {
+        if (ctx->num_threads > 0 && (job->range_end - job->range_start) > grain_size * 2 &&
+            sx__job_deque_empty(dq)) {
+            sx__job_split(ctx, tdata, job);
+        }
+
+        int end = sx_min(job->range_start + grain_size, job->range_end);
+        job->callback(job->range_start, end, tdata->thread_index, job->user);
+        job->range_start = end;
+    }
+}
+
+static void fiber_fn(sx_fiber_transfer transfer)
+{
+    sx__job* job = (sx__job*)transfer.user;
+    sx_job_context* ctx = job->ctx;
+    sx__job_thread_data* tdata = (sx__job_thread_data*)sx_tls_get(ctx->thread_tls);
+
+    sx_assert(tdata->cur_job == job);
+
+    tdata->selector_fiber = transfer.from;
+
+    // Run the actual job code
+    sx__job_run(ctx, tdata, job);
+    job->done = 1;
+
+    // Back to job caller, tdata->selector_fiber is updated if we have waited inside the job
+    sx_fiber_switch(tdata->selector_fiber, transfer.user);
+}
+
+// Takes a job that is resumed after 'wait', from the thread's own queue
+static sx__job* sx__job_select_resumed(sx_job_context* ctx, sx__job_thread_data* tdata, int pr)
+{
+    sx__job_resume_queue* queue = &ctx->resume_queues[tdata->thread_index];
+    sx__job* job = NULL;
+    sx_lock(queue->lock) {
+        job = queue->first[pr];
+        if (job) {
+            sx__job_remove_list(&queue->first[pr], &queue->last[pr], job);
+            sx_atomic_fetch_sub32_explicit(&queue->count, 1, SX_ATOMIC_MEMORYORDER_RELAXED);
+        }
+    }
+    return job;
+}
+
+// Takes the first job of the tag queues that match the thread's tags
+// In the order of the queues, so a tags value that is dispatched first is preferred
+static sx__job* sx__job_select_tagged(sx_job_context* ctx, int pr, uint32_t tags)
+{
+    sx__job* job = NULL;
+    sx_lock_adaptive(ctx->job_lk) {
+        for (int i = 0, c = sx_array_count(ctx->tag_queues); i < c; i++) {
+            sx__job_tag_queue* queue = &ctx->tag_queues[i];
+            if ((queue->tags & tags) && queue->first[pr]) {
+                job = queue->first[pr];
+                sx__job_remove_list(&queue->first[pr], &queue->last[pr], job);
+                sx_atomic_fetch_sub32_explicit(&ctx->num_tagged, 1,
+                                               SX_ATOMIC_MEMORYORDER_RELAXED);
+                break;
+            }
+        }
+    }
+    return job;
+}
+
+// Takes a job with deadline, that is not late yet (see sx__job_select_late)
+static sx__job* sx__job_select_deadline_list(sx_job_context* ctx, int pr, uint32_t tags)
+{
+    sx__job* job = NULL;
+    sx_lock_adaptive(ctx->job_lk) {
+        for (sx__job* node = ctx->deadline_list[pr]; node; node = node->next) {
+            if (node->tags == 0 || (node->tags & tags)) {
+                job = node;
+                sx__job_remove_deadline_list(ctx, node);
+                break;
+            }
+        }
+    }
+    return job;
+}
+
+// Tries to steal from the victims, starting from a random one
+// `retry` is set if a steal was aborted by another thief, so the deque may still have items
+static sx__job* sx__job_steal(sx_job_context* ctx, sx__job_thread_data* tdata, int priority,
+                              const int* victims, int num_victims, bool* retry)
+{
+    if (num_victims == 0)
+        return NULL;
+
+    int start = (int)(sx_rng_gen(&tdata->rng) % (uint32_t)num_victims);
+    for (int i = 0; i < num_victims; i++) {
+        int victim = victims[(start + i) % num_victims];
+        bool aborted = false;
+        sx__job* job =
+            sx__job_deque_steal(&ctx->deques[victim * SX_JOB_PRIORITY_COUNT + priority], &aborted);
+        if (job) {
+            sx__job_profile_job(ctx, tdata, SX_JOB_PROFILE_STEAL, job, (uint32_t)victim);
+            return job;
+        }
+        if (aborted)
+            *retry = true;
+    }
+    return NULL;
+}
+
+// Picks the job with the earliest deadline from the deadline list, if it's late
+// Also refreshes next_deadline, which is only a lower bound after jobs are removed from the list
+static sx__job* sx__job_select_late(sx_job_context* ctx, uint32_t tags)
+{
+    uint64_t now = sx_os_clock_ns();
+    if (now < sx_atomic_load64_explicit(&ctx->next_deadline, SX_ATOMIC_MEMORYORDER_RELAXED))
+        return NULL;
+
+    sx__job* job = NULL;
+    sx_lock_adaptive(ctx->job_lk) {
+        for (int pr = 0; pr < SX_JOB_PRIORITY_COUNT; pr++) {
+            for (sx__job* node = ctx->deadline_list[pr]; node; node = node->next) {
+                if (node->deadline <= now && (node->tags == 0 || (node->tags & tags)) &&
+                    (!job || node->deadline < job->deadline)) {
+                    job = node;
+                }
+            }
+        }
+        if (job)
+            sx__job_remove_deadline_list(ctx, job);
+
+        uint64_t next_deadline = UINT64_MAX;
+        for (int pr = 0; pr < SX_JOB_PRIORITY_COUNT; pr++) {
+            for (sx__job* node = ctx->deadline_list[pr]; node; node = node->next)
+                next_deadline = sx_min(next_deadline, node->deadline);
+        }
+        sx_atomic_store64_explicit(&ctx->next_deadline, next_deadline,
+                                   SX_ATOMIC_MEMORYORDER_RELAXED);
+    }
+    return job;
+}
+
+// Selection order for each priority: own deque -> own resumed jobs -> tag queues -> jobs with
+// deadlines -> steal from other threads (same node first)
+static bool sx__job_select_priority(sx_job_context* ctx, sx__job_thread_data* tdata, int pr,
+                                    uint32_t tags, sx__job_select_result* r)
+{
+    int num_local = tdata->num_local_victims;
+    int num_remote = ctx->num_threads - num_local;
+
+    r->job = sx__job_deque_pop(&tdata->deques[pr]);
+    if (r->job)
+        return true;
+
+    if (sx_atomic_load32_explicit(&ctx->resume_queues[tdata->thread_index].count,
+                                  SX_ATOMIC_MEMORYORDER_ACQUIRE) > 0) {
+        r->job = sx__job_select_resumed(ctx, tdata, pr);
+        if (r->job)
+            return true;
+    }
+
+    if (sx_atomic_load32_explicit(&ctx->num_tagged, SX_ATOMIC_MEMORYORDER_ACQUIRE) > 0) {
+        r->job = sx__job_select_tagged(ctx, pr, tags);
+        if (r->job)
+            return true;
+    }
+
+    if (sx_atomic_load32_explicit(&ctx->num_deadlines, SX_ATOMIC_MEMORYORDER_ACQUIRE) > 0) {
+        r->job = sx__job_select_deadline_list(ctx, pr, tags);
+        if (r->job)
+            return true;
+    }
+
+    r->job = sx__job_steal(ctx, tdata, pr, tdata->victims, num_local, &r->retry);
+    if (r->job)
+        return true;
+    r->job = sx__job_steal(ctx, tdata, pr, tdata->victims + num_local, num_remote, &r->retry);
+    return r->job != NULL;
+}
+
+static inline sx_atomic_uint64* sx__job_served_tm(sx_job_context* ctx, int priority)
+{
+    return &ctx->served_tm[priority * (SX_CACHE_LINE_SIZE / sizeof(sx_atomic_uint64))];
+}
+
+static inline void sx__job_served(sx_job_context* ctx, int priority, uint64_t now)
+{
+    sx_atomic_uint64* tm = sx__job_served_tm(ctx, priority);
+    if (now - sx_atomic_load64_explicit(tm, SX_ATOMIC_MEMORYORDER_RELAXED) >
+        (ctx->starvation_ns >> 2)) {
+        sx_atomic_store64_explicit(tm, now, SX_ATOMIC_MEMORYORDER_RELAXED);
+    }
+}
+
+// Late jobs come first, then priorities from high to low. But if a lower priority is starving,
+// it's scanned first (see Priorities)
+static sx__job_select_result sx__job_select(sx_job_context* ctx, sx__job_thread_data* tdata,
+                                            uint32_t tags)
+{
+    sx__job_select_result r = { 0 };
+
+    if (sx_atomic_load32_explicit(&ctx->num_deadlines, SX_ATOMIC_MEMORYORDER_RELAXED) > 0) {
+        r.job = sx__job_select_late(ctx, tags);
+        if (r.job)
+            return r;
+    }
+
+    if (ctx->starvation_ns == 0) {
+        for (int pr = 0; pr < SX_JOB_PRIORITY_COUNT; pr++) {
+            if (sx__job_select_priority(ctx, tdata, pr, tags, &r))
+                return r;
+        }
+        return r;
+    }
+
+    uint64_t now = sx_os_clock_ns();
+    int first = 0;
+    for (int pr = SX_JOB_PRIORITY_COUNT - 1; pr > 0; pr--) {
+        uint64_t served_tm =
+            sx_atomic_load64_explicit(sx__job_served_tm(ctx, pr), SX_ATOMIC_MEMORYORDER_RELAXED);
+        if (now - served_tm > ctx->starvation_ns) {
+            first = pr;
+            break;
+        }
+    }
+
+    // order: first, then the higher priorities, then the lower ones
+    // all priorities that are scanned are served, either a job is found or there is nothing left
+    for (int i = 0; i < SX_JOB_PRIORITY_COUNT; i++) {
+        int pr = i == 0 ? first : (i <= first ? i - 1 : i);
+        bool found = sx__job_select_priority(ctx, tdata, pr, tags, &r);
+        sx__job_served(ctx, pr, now);
+        if (found)
+            return r;
+    }
 
     return r;
 }
 
+// Creates the jobs of a dispatch and pushes them to the ready queues
+// job_lk must be held by the caller
+static int sx__job_create_pending(sx_job_context* ctx, sx__job_thread_data* tdata,
+                                  const sx__job_pending* pending)
+{
+    int count = pending->num_jobs;
+    int range_reminder = pending->range_reminder;
+    int range_start = 0;
+    int range_end = pending->range_size + (range_reminder > 0 ? 1 : 0);
+    --range_reminder;
+
+    // jobs are created first, from the thread's cache, so job_lk is taken once for all the jobs
+    // that go to the global lists
+    sx__job* first = NULL;
+    sx__job* last = NULL;
+    for (int i = 0; i < count; i++) {
+        sx__job* job = sx__new_job(ctx, tdata, i, pending, range_start, range_end);
+        if (!job) {
+            sx_out_of_memory();
+            count = i;
+            break;
+        }
+        if (last)
+            last->next = job;
+        else
+            first = job;
+        last = job;
+        range_start = range_end;
+        range_end += (pending->range_size + (range_reminder > 0 ? 1 : 0));
+        --range_reminder;
+    }
+    sx_assert(count < pending->num_jobs || range_reminder <= 0);
+
+    if (first && sx__job_needs_lock(first)) {
+        sx_lock_adaptive(ctx->job_lk) {
+            sx__job_submit_list(ctx, tdata, first);
+        }
+    } else {
+        sx__job_submit_list(ctx, tdata, first);
+    }
+
+    return count;
+}
+
+// Pushes the jobs to the ready queues and wakes up the workers
+static void sx__job_dispatch_pending(sx_job_context* ctx, sx__job_thread_data* tdata,
+                                     const sx__job_pending* pending)
+{
+    int count = sx__job_create_pending(ctx, tdata, pending);
+    if (count > 0)
+        sx__job_wake(ctx, count, pending->tags);
+}
+
+static sx__job_counter* sx__job_counter_new(sx_job_context* ctx)
+{
+    sx_atomic_uint64 head =
+        sx_atomic_load64_explicit(&ctx->counter_free, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+    sx__job_counter* counter;
+    do {
+        uint32_t index = (uint32_t)(head & 0xffffffff);
+        if (index == 0)
+            return NULL;    // all handles are in use
+        counter = &ctx->counters[index - 1];
+        // next_free can be stale if the counter is taken by another thread, tag check fails then
+        uint64_t next =
+            sx_atomic_load32_explicit(&counter->next_free, SX_ATOMIC_MEMORYORDER_RELAXED);
+        uint64_t new_head = (((head >> 32) + 1) << 32) | next;
+        if (sx_atomic_compare_exchange64_weak_explicit(&ctx->counter_free, &head, new_head,
+                                                       SX_ATOMIC_MEMORYORDER_ACQUIRE,
+                                                       SX_ATOMIC_MEMORYORDER_ACQUIRE)) {
+            break;
+        }
+    } while (1);
+
+    sx_atomic_fetch_add32_explicit(&ctx->num_counters, 1, SX_ATOMIC_MEMORYORDER_RELAXED);
+    return counter;
+}
+
+static void sx__job_counter_del(sx_job_context* ctx, sx__job_counter* counter)
+{
+    // bump generation, so the deleted handle is not valid anymore
+    uint32_t gen = sx_atomic_load32_explicit(&counter->gen, SX_ATOMIC_MEMORYORDER_RELAXED) + 1;
+    if (gen > (0xffffffff >> HANDLE_INDEX_BITS))
+        gen = 1;
+    sx_atomic_store32_explicit(&counter->gen, gen, SX_ATOMIC_MEMORYORDER_RELAXED);
+
+    sx_atomic_fetch_sub32_explicit(&ctx->num_counters, 1, SX_ATOMIC_MEMORYORDER_RELAXED);
+
+    uint64_t index = (uint64_t)(counter - ctx->counters) + 1;
+    sx_atomic_uint64 head =
+        sx_atomic_load64_explicit(&ctx->counter_free, SX_ATOMIC_MEMORYORDER_RELAXED);
+    uint64_t new_head;
+    do {
+        sx_atomic_store32_explicit(&counter->next_free, (uint32_t)(head & 0xffffffff),
+                                   SX_ATOMIC_MEMORYORDER_RELAXED);
+        new_head = (((head >> 32) + 1) << 32) | index;
+    } while (!sx_atomic_compare_exchange64_weak_explicit(&ctx->counter_free, &head, new_head,
+                                                         SX_ATOMIC_MEMORYORDER_RELEASE,
+                                                         SX_ATOMIC_MEMORYORDER_RELAXED));
+}
+
+// returns NULL if the handle is invalid or deleted
+static inline sx__job_counter* sx__job_counter_get(sx_job_context* ctx, sx_job_t handle)
+{
+    uint32_t index = handle & HANDLE_INDEX_MASK;
+    uint32_t gen = handle >> HANDLE_INDEX_BITS;
+    if (gen == 0 || (int)index >= ctx->max_handles)
+        return NULL;
+    sx__job_counter* counter = &ctx->counters[index];
+    if (sx_atomic_load32_explicit(&counter->gen, SX_ATOMIC_MEMORYORDER_RELAXED) != gen)
+        return NULL;
+    return counter;
+}
+
+static inline bool sx__job_counter_done(sx__job_counter* counter)
+{
+    return sx_atomic_loadptr_explicit(&counter->waiters, SX_ATOMIC_MEMORYORDER_ACQUIRE) ==
+           WAITERS_CLOSED;
+}
+
+// Returns false if the counter is already done and the waiter is not added
+static bool sx__job_counter_add_waiter(sx__job_counter* counter, sx__job_waiter* waiter)
+{
+    sx_atomic_ptr head = sx_atomic_loadptr_explicit(&counter->waiters,
+                                                    SX_ATOMIC_MEMORYORDER_RELAXED);
+    do {
+        if (head == WAITERS_CLOSED)
+            return false;
+        waiter->next = (sx__job_waiter*)(uintptr_t)head;
+    } while (!sx_atomic_compare_exchangeptr_weak_explicit(&counter->waiters, &head,
+                                                          (uintptr_t)waiter,
+                                                          SX_ATOMIC_MEMORYORDER_RELEASE,
+                                                          SX_ATOMIC_MEMORYORDER_RELAXED));
+    return true;
+}
+
+static void sx__job_release_deps(sx_job_context* ctx, sx__job_thread_data* tdata,
+                                 sx__job_deps* deps)
+{
+    if (sx_atomic_fetch_sub32_explicit(&deps->num_remaining, 1, SX_ATOMIC_MEMORYORDER_ACQREL) ==
+        1) {
+        sx__job_pending pending = deps->pending;
+        sx_lock(ctx->deps_lk) {
+            sx_pool_del(ctx->deps_pool, deps);
+        }
+        sx__job_dispatch_pending(ctx, tdata, &pending);
+    }
+}
+
+// Called for every finished job. The thread that finishes the last job of the counter, closes the
+// waiter list and pushes the waiting jobs and dependent dispatches to the ready queues
+static void sx__job_counter_dec(sx_job_context* ctx, sx__job_thread_data* tdata,
+                                sx__job_counter* counter)
+{
+    if (sx_atomic_fetch_sub32_explicit(&counter->value, 1, SX_ATOMIC_MEMORYORDER_ACQREL) == 1) {
+        // the counter can be deleted by other threads after this point
+        sx__job_waiter* waiter = (sx__job_waiter*)(uintptr_t)sx_atomic_exchangeptr_explicit(
+            &counter->waiters, WAITERS_CLOSED, SX_ATOMIC_MEMORYORDER_ACQREL);
+
+        while (waiter) {
+            sx__job_waiter* next = waiter->next;
+            if (waiter->job) {
+                sx__job_resume(ctx, waiter->job);
+            } else {
+                sx__job_release_deps(ctx, tdata, waiter->deps);
+            }
+            waiter = next;
+        }
+    }
+}
+
+// Runs the job from beginning, or continues it after 'wait', must be called on selector fiber
+static void sx__job_exec(sx_job_context* ctx, sx__job_thread_data* tdata, sx__job* job)
+{
+    // Job is a slave (in wait mode), get back to it and remove slave mode
+    if (job->owner > 0) {
+        sx_assert(tdata->cur_job == NULL);
+        sx_assert(job->owner == tdata->thread_index + 1);
+        job->owner = 0;
+    }
+
+    tdata->cur_job = job;
+    job->deadline = 0;    // started, so it's not late anymore
+    sx__job_profile_job(ctx, tdata, job->fiber ? SX_JOB_PROFILE_RESUME : SX_JOB_PROFILE_START,
+                        job, 0);
+
+    if (job->run_inline && !job->fiber) {
+        // Run to completion on this stack, fiber is only assigned if the job is promoted in 'wait'
+        job->callback(job->range_start, job->range_end, tdata->thread_index, job->user);
+        job->done = 1;
+        tdata->cur_job = NULL;
+        sx__job_profile_job(ctx, tdata, SX_JOB_PROFILE_END, job, 0);
+
+        // The job has been promoted and resumed by another scheduler fiber, which is now left
+        // behind. Continue scheduling on this stack and release the other one
+        if (job->stack_mem.sptr) {
+            sx__job_stack_release(ctx, tdata, SX__JOB_STACK_LARGE, &tdata->selector_stack);
+            tdata->selector_stack = job->stack_mem;
+            tdata->selector_fiber = NULL;
+            job->stack_mem.sptr = NULL;
+            job->stack_mem.ssize = 0;
+        }
+
+        sx__job_counter_dec(ctx, tdata, job->counter);
+        sx__del_job(ctx, tdata, job);
+        return;
+    }
+
+    // First run: fetch a stack for the job
+    if (!job->fiber) {
+        if (!sx__job_stack_acquire(ctx, tdata, job->stack_class, &job->stack_mem)) {
+            sx_assertf(0, "Not enough memory for fiber stacks");
+            return;
+        }
+        job->fiber = sx_fiber_create(job->stack_mem, fiber_fn);
+    }
+
+    job->fiber = sx_fiber_switch(job->fiber, job).from;
+
+    // Delete the job and decrement job counter if it's done
+    // promoted inline jobs never get here, because they return to their original scheduler frame
+    if (job->done) {
+        tdata->cur_job = NULL;
+        sx__job_profile_job(ctx, tdata, SX_JOB_PROFILE_END, job, 0);
+        sx__job_stack_release(ctx, tdata, job->stack_class, &job->stack_mem);
+        sx__job_counter_dec(ctx, tdata, job->counter);
+        sx__del_job(ctx, tdata, job);
+    }
+}
+
+// The scheduler fiber has been started by the thread, or is replacing the stack of a promoted job
+static void sx__job_selector_enter(sx__job_thread_data* tdata, sx_fiber_transfer transfer)
+{
+    if (tdata->promoted_job) {
+        tdata->promoted_job->fiber = transfer.from;
+        tdata->promoted_job = NULL;
+    } else {
+        tdata->native_fiber = transfer.from;
+    }
+}
+
 static void sx__job_selector_main_thrd(sx_fiber_transfer transfer)
 {
-    sx_job_context* ctx = (sx_job_context*)transfer.user;
+    sx_job_context* ctx = (sx_job_context*)transfer.user;
+    sx__job_thread_data* tdata = (sx__job_thread_data*)sx_tls_get(ctx->thread_tls);
+    sx_assert(tdata);
+    sx__job_selector_enter(tdata, transfer);
+
+    // main thread's scheduler is persistent: run a single job, then get back to the waiting thread
+    for (;;) {
+        // Select the best job in the waiting list
+        sx__job_select_result r =
+            sx__job_select(ctx, tdata, ctx->num_threads > 0 ? tdata->tags : 0xffffffff);
+
+        if (r.job) {
+            sx__job_exec(ctx, tdata, r.job);
+            ++tdata->num_executed;
+        }
+
+        tdata->native_fiber = sx_fiber_switch(tdata->native_fiber, ctx).from;
+    }
+}
+
+//
+// Threads run this function to pick a job from the list and execute the job fiber
+static void sx__job_park(sx_job_context* ctx, sx__job_thread_data* tdata)
+{
+    sx__job_sleeper* sleeper = &ctx->sleepers[tdata->thread_index];
+
+    // announce, then check the queues for the last time. wakers do the opposite
+    sx_atomic_exchange32_explicit(&sleeper->sleeping, 1, SX_ATOMIC_MEMORYORDER_SEQCST);
+    sx_atomic_fetch_add32(&ctx->num_sleeping, 1);
+    sx_atomic_thread_fence(SX_ATOMIC_MEMORYORDER_SEQCST);
+
+    if (ctx->quit || sx__job_has_work(ctx, tdata)) {
+        if (sx__job_sleeper_claim(ctx, sleeper))
+            return;
+        // some other thread has claimed us in the meantime and is posting to the semaphore
+    }
+
+    sx_semaphore_wait(&sleeper->sem, -1);
+}
+
+static void sx__job_selector_fn(sx_fiber_transfer transfer)
+{
+    sx_job_context* ctx = (sx_job_context*)transfer.user;
+    sx__job_thread_data* tdata = (sx__job_thread_data*)sx_tls_get(ctx->thread_tls);
+    sx_assert(tdata);
+    sx__job_selector_enter(tdata, transfer);
+
+    int spin = 0;
+    int num_pauses = 1;
+    while (!ctx->quit) {
+        // Select the best job in the waiting list
+        sx__job_select_result r = sx__job_select(ctx, tdata, tdata->tags);
+
+        //
+        if (r.job) {
+            sx__job_profile_idle(ctx, tdata, false);
+            sx__job_exec(ctx, tdata, r.job);
+            spin = 0;
+            num_pauses = 1;
+        } else if (r.retry) {
+            // If we have a pending job, continue this loop one more time
+            sx_relax_cpu();
+        } else if (spin < ctx->idle_spin_count) {
+            sx__job_profile_idle(ctx, tdata, true);
+            for (int i = 0; i < num_pauses; i++)
+                sx_relax_cpu();
+            num_pauses = sx_min(num_pauses * 2, ctx->idle_max_pause);
+            ++spin;
+        } else {
+            sx__job_profile_idle(ctx, tdata, true);
+            sx__job_park(ctx, tdata);
+            spin = 0;
+            num_pauses = 1;
+        }
+    }
+
+    sx__job_profile_idle(ctx, tdata, false);
+
+    // Back to caller thread
+    sx_fiber_switch(tdata->native_fiber, ctx);
+}
+
+// Divides the work set into ranges, one for each thread that can run the jobs (based on tags)
+// Returns the number of jobs
+static int sx__job_ranges(sx_job_context* ctx, const sx_job_desc* desc, int grain_size,
+                          int* range_size, int* range_reminder)
+{
+    // check which threads are eligible to execute this task (based on tags)
+    int num_workers = 0;
+    if (desc->tags != 0) {
+        for (int i = 0, ic = ctx->num_threads + 1; i < ic; i++) {
+            if (ctx->tags[i] & desc->tags)
+                num_workers++;
+        }
+    } else {
+        num_workers = ctx->num_threads + 1;
+    }
+
+    // parallel_for: don't make initial ranges smaller than grain_size
+    if (grain_size > 0)
+        num_workers = sx_max(1, sx_min(num_workers, desc->count / grain_size));
+
+    *range_size = desc->count / num_workers;
+    *range_reminder = desc->count % num_workers;
+    int num_jobs = *range_size > 0 ? num_workers : (*range_reminder > 0 ? *range_reminder : 0);
+    sx_assert(num_jobs > 0);
+    return num_jobs;
+}
+
+static void sx__job_init_pending(sx_job_context* ctx, const sx_job_desc* desc, int grain_size,
+                                 sx__job_counter* counter, sx__job_pending* pending)
+{
+    int range_size, range_reminder;
+    int num_jobs = sx__job_ranges(ctx, desc, grain_size, &range_size, &range_reminder);
+    uint64_t deadline = 0;
+    if (desc->deadline_us > 0)
+        deadline = sx_os_clock_ns() + (uint64_t)desc->deadline_us * 1000;
+
+    SX_PRAGMA_DIAGNOSTIC_PUSH()
+    SX_PRAGMA_DIAGNOSTIC_IGNORED_MSVC(4204)     // nonstandard extension used: non-constant aggregate initializer
+    *pending = (sx__job_pending){ .counter = counter,
+                                  .num_jobs = num_jobs,
+                                  .range_size = range_size,
+                                  .range_reminder = range_reminder,
+                                  .grain_size = grain_size,
+                                  .callback = desc->callback,
+                                  .user = desc->user,
+                                  .priority = desc->priority,
+                                  .tags = desc->tags,
+                                  .flags = desc->flags,
+                                  .deadline = deadline };
+    SX_PRAGMA_DIAGNOSTIC_POP()
+}
+
+static sx__job_counter* sx__job_counter_start(sx_job_context* ctx, int num_jobs)
+{
+    sx__job_counter* counter = sx__job_counter_new(ctx);
+    if (!counter) {
+        sx_assertf(0, "Maximum job handles (%d) exceeded, increase max_handles", ctx->max_handles);
+        return NULL;
+    }
+
+    sx_atomic_storeptr_explicit(&counter->waiters, 0, SX_ATOMIC_MEMORYORDER_RELAXED);
+    sx_atomic_store32_explicit(&counter->value, (uint32_t)num_jobs, SX_ATOMIC_MEMORYORDER_RELEASE);
+    return counter;
+}
+
+static sx_job_t sx__job_dispatch(sx_job_context* ctx, const sx_job_desc* desc, int grain_size)
+{
+    sx_assert(desc->count > 0);
+    sx_assert(desc->callback);
+    sx_assertf(desc->num_deps <= SX_JOB_MAX_DEPS, "too many dependencies");
+
+    sx__job_thread_data* tdata = (sx__job_thread_data*)sx_tls_get(ctx->thread_tls);
+    sx_assertf(tdata, "Dispatch must be called within main thread or job threads");
+
+    // Divide job count into ranges and create a counter (job handle)
+    sx__job_pending pending;
+    sx__job_init_pending(ctx, desc, grain_size, NULL, &pending);
+    pending.counter = sx__job_counter_start(ctx, pending.num_jobs);
+    if (!pending.counter)
+        return 0;
+
+    sx_job_t handle = sx__job_handle(ctx, pending.counter);
+    sx__job_profile_dispatch(ctx, tdata, handle, desc->priority, pending.num_jobs);
+
+    if (desc->num_deps > 0) {
+        // Defer the dispatch until all dependencies are done
+        sx__job_deps* deps;
+        sx_lock(ctx->deps_lk) {
+            deps = (sx__job_deps*)sx_pool_new_and_grow(ctx->deps_pool, ctx->alloc);
+        }
+        if (!deps) {
+            sx_out_of_memory();
+            return 0;
+        }
+
+        deps->pending = pending;
+        // +1 reference, so the dispatch is not released before we add all the waiters
+        sx_atomic_store32_explicit(&deps->num_remaining, (uint32_t)desc->num_deps + 1,
+                                   SX_ATOMIC_MEMORYORDER_RELAXED);
+        for (int i = 0; i < desc->num_deps; i++) {
+            sx__job_waiter* waiter = &deps->waiters[i];
+            waiter->job = NULL;
+            waiter->deps = deps;
+            // deleted handles are already finished
+            sx__job_counter* dep = sx__job_counter_get(ctx, desc->deps[i]);
+            if (!dep || !sx__job_counter_add_waiter(dep, waiter)) {
+                sx_atomic_fetch_sub32_explicit(&deps->num_remaining, 1,
+                                               SX_ATOMIC_MEMORYORDER_RELAXED);
+            }
+        }
+        sx__job_release_deps(ctx, tdata, deps);
+    } else {
+        sx__job_dispatch_pending(ctx, tdata, &pending);
+    }
+
+    return handle;
+}
+
+sx_job_t sx_job_dispatch_batch(sx_job_context* ctx, const sx_job_desc* descs, int num_descs)
+{
+    sx_assert(num_descs > 0);
+
+    sx__job_thread_data* tdata = (sx__job_thread_data*)sx_tls_get(ctx->thread_tls);
+    sx_assertf(tdata, "Dispatch must be called within main thread or job threads");
+
+    // one counter for all jobs of the batch
+    int num_jobs = 0;
+    bool any_thread = false;
+    uint32_t wake_tags = 0;
+    for (int i = 0; i < num_descs; i++) {
+        const sx_job_desc* desc = &descs[i];
+        sx_assert(desc->count > 0);
+        sx_assert(desc->callback);
+        sx_assertf(desc->num_deps == 0, "dependencies are not supported in batches");
+
+        int range_size, range_reminder;
+        num_jobs += sx__job_ranges(ctx, desc, 0, &range_size, &range_reminder);
+        any_thread |= desc->tags == 0;
+        wake_tags |= desc->tags;
+    }
+
+    sx__job_counter* counter = sx__job_counter_start(ctx, num_jobs);
+    if (!counter)
+        return 0;
+    sx_job_t handle = sx__job_handle(ctx, counter);
+
+    // the counter can't reach zero before all the jobs are pushed, because it starts from the
+    // total count
+    int count = 0;
+    for (int i = 0; i < num_descs; i++) {
+        sx__job_pending pending;
+        sx__job_init_pending(ctx, &descs[i], 0, counter, &pending);
+        sx__job_profile_dispatch(ctx, tdata, handle, descs[i].priority, pending.num_jobs);
+        count += sx__job_create_pending(ctx, tdata, &pending);
+    }
+
+    if (count > 0)
+        sx__job_wake(ctx, count, any_thread ? 0 : wake_tags);
+    return handle;
+}
+
+int sx_job_num_handles(sx_job_context* ctx)
+{
+    return (int)sx_atomic_load32_explicit(&ctx->num_counters, SX_ATOMIC_MEMORYORDER_RELAXED);
+}
+
+sx_job_t sx_job_dispatch_desc(sx_job_context* ctx, const sx_job_desc* desc)
+{
+    return sx__job_dispatch(ctx, desc, 0);
+}
+
+sx_job_t sx_job_parallel_for(sx_job_context* ctx, const sx_job_desc* desc, int grain_size)
+{
+    sx_assert(grain_size > 0);
+    return sx__job_dispatch(ctx, desc, sx_max(grain_size, 1));
+}
+
+sx_job_t sx_job_dispatch(sx_job_context* ctx, int count, sx_job_cb* callback, void* user,
+                         sx_job_priority priority, unsigned int tags)
+{
+    SX_PRAGMA_DIAGNOSTIC_PUSH()
+    SX_PRAGMA_DIAGNOSTIC_IGNORED_MSVC(4204)     // nonstandard extension used: non-constant aggregate initializer
+    sx_job_desc desc = { .count = count,
+                         .callback = callback,
+                         .user = user,
+                         .priority = priority,
+                         .tags = tags };
+    SX_PRAGMA_DIAGNOSTIC_POP()   
+    return sx_job_dispatch_desc(ctx, &desc);
+}
+
+// Hands over the current scheduler stack to the inline job, and starts a new scheduler fiber
+// the job's fiber context is assigned by the new scheduler, see sx__job_selector_enter
+static void sx__job_promote(sx_job_context* ctx, sx__job_thread_data* tdata, sx__job* job)
+{
+    job->stack_mem = tdata->selector_stack;
+    if (!sx__job_stack_acquire(ctx, tdata, SX__JOB_STACK_LARGE, &tdata->selector_stack)) {
+        sx_assertf(0, "Not enough memory for fiber stacks");
+        return;
+    }
+    tdata->promoted_job = job;
+    tdata->selector_fiber = sx_fiber_create(
+        tdata->selector_stack, tdata->main_thrd ? sx__job_selector_main_thrd : sx__job_selector_fn);
+}
+
+void sx_job_wait_and_del(sx_job_context* ctx, sx_job_t job)
+{
     sx__job_thread_data* tdata = (sx__job_thread_data*)sx_tls_get(ctx->thread_tls);
-    sx_assert(tdata);
-
-    // Select the best job in the waiting list
-    sx__job_select_result r =
-        sx__job_select(ctx, tdata->tid, ctx->num_threads > 0 ? tdata->tags : 0xffffffff);
+    sx__job_counter* counter = sx__job_counter_get(ctx, job);
+    if (!counter) {
+        sx_assertf(0, "invalid job handle, probably deleted before");
+        return;
+    }
 
+    uint64_t prev_tm = sx_cycle_clock();
     
-    if (r.job) {
-        // Job is a slave (in wait mode), get back to it and remove slave mode
-        if (r.job->owner_tid > 0) {
-            sx_assert(tdata->cur_job == NULL);
-            r.job->owner_tid = 0;
+    while (!sx__job_counter_done(counter)) {
+        // If thread is running a job, make it slave to the thread so it can only be picked up by
+        // this thread. The job is suspended and added to the counter's waiters, and will be
+        // pushed to this thread's resume queue by the thread that finishes the counter
+        if (tdata->cur_job) {
+            sx__job* cur_job = tdata->cur_job;
+            cur_job->owner = tdata->thread_index + 1;
+            if (!sx__job_counter_add_waiter(counter, &cur_job->waiter)) {
+                cur_job->owner = 0;
+                break;    // counter is done in the meantime
+            }
+            sx__job_profile_job(ctx, tdata, SX_JOB_PROFILE_WAIT, cur_job, job);
+            tdata->cur_job = NULL;
+
+            // inline job is running on the scheduler's stack, it cannot be suspended without
+            // taking the stack with it
+            if (cur_job->run_inline && !cur_job->fiber)
+                sx__job_promote(ctx, tdata, cur_job);
         }
 
-        // Run the job from beginning, or continue after 'wait'
-        tdata->selector_fiber = r.job->selector_fiber;
-        tdata->cur_job = r.job;
-        r.job->fiber = sx_fiber_switch(r.job->fiber, r.job).from;
+        // Switch to selector loop
+        tdata->selector_fiber = sx_fiber_switch(tdata->selector_fiber, ctx).from;
 
-        // Delete the job and decrement job counter if it's done
-        if (r.job->done) {
-            tdata->cur_job = NULL;
-            sx_atomic_fetch_sub32(r.job->counter, 1);
-            sx__del_job(ctx, r.job);
+        uint64_t now_tm = sx_cycle_clock();
+        uint64_t diff = now_tm - prev_tm;
+        prev_tm = now_tm;
+        if (diff < 300) {
+            sx_relax_cpu(); // leave some room for the HT cpu cores to breathe
         }
     }
 
-    // before returning, set selector to NULL, so we know that we have to recreate the fiber
-    tdata->selector_fiber = NULL;       
-    sx_fiber_switch(transfer.from, transfer.user);
+    // All jobs are done, Delete the counter
+    sx__job_counter_del(ctx, counter);
 }
 
-//
-// Threads run this function to pick a job from the list and execute the job fiber
-static void sx__job_selector_fn(sx_fiber_transfer transfer)
+bool sx_job_test_and_del(sx_job_context* ctx, sx_job_t job)
 {
-    sx_job_context* ctx = (sx_job_context*)transfer.user;
-    sx__job_thread_data* tdata = (sx__job_thread_data*)sx_tls_get(ctx->thread_tls);
-    sx_assert(tdata);
-
-    while (!ctx->quit) {
-        sx_semaphore_wait(&ctx->sem, -1);    // Wait for a job
+    sx__job_counter* counter = sx__job_counter_get(ctx, job);
+    if (!counter) {
+        sx_assertf(0, "invalid job handle, probably deleted before");
+        return false;
+    }
 
-        // Select the best job in the waiting list
-        sx__job_select_result r = sx__job_select(ctx, tdata->tid, tdata->tags);
+    if (sx__job_counter_done(counter)) {
+        // All jobs are done, Delete the counter
+        sx__job_counter_del(ctx, counter);
+        return true;
+    }
 
-        //
-        if (r.job) {
-            // Job is a slave (in wait mode), get back to it and remove slave mode
-            if (r.job->owner_tid > 0) {
-                sx_assert(tdata->cur_job == NULL);
-                r.job->owner_tid = 0;
-            }
+    return false;
+}
 
-            // Run the job from beginning, or continue after 'wait'
-            tdata->selector_fiber = r.job->selector_fiber;
-            tdata->cur_job = r.job;
-            r.job->fiber = sx_fiber_switch(r.job->fiber, r.job).from;
+static_assert(sizeof(sx__job_sync) <= sizeof(sx_job_mutex), "sx_job_mutex size mismatch");
+static_assert(sizeof(sx__job_sync) <= sizeof(sx_job_event), "sx_job_event size mismatch");
+static_assert(sizeof(sx__job_sync) <= sizeof(sx_job_sem), "sx_job_sem size mismatch");
 
-            // Delete the job and decrement job counter if it's done
-            if (r.job->done) {
-                tdata->cur_job = NULL;
-                sx_atomic_fetch_sub32(r.job->counter, 1);
-                sx__del_job(ctx, r.job);
-            }
-        } else if (r.waiting_list_alive) {
-            // If we have a pending job, continue this loop one more time
-            sx_semaphore_post(&ctx->sem, 1);
-            sx_relax_cpu();
-        }
-    }
+static void sx__job_sync_init(sx__job_sync* sync, int value)
+{
+    sx_memset(sync, 0x0, sizeof(sx__job_sync));
+    sync->value = value;
+}
 
-    // Back to caller thread
-    sx_fiber_switch(transfer.from, transfer.user);
+static void sx__job_sync_release(sx__job_sync* sync)
+{
+    sx_assertf(sync->first == NULL, "there are still jobs waiting on the object");
+    sx_unused(sync);
 }
 
-sx_job_t sx_job_dispatch(sx_job_context* ctx, int count, sx_job_cb* callback, void* user,
-                         sx_job_priority priority, unsigned int tags)
+// Queues the running job in `sync` and suspends it, until it's resumed by sx__job_sync_resume
+// sync->lock must be held by the caller, it's released after the job is queued. Because the job
+// is pinned to this thread, it can't be picked up before it's fiber is switched out
+static void sx__job_sync_suspend(sx_job_context* ctx, sx__job_thread_data* tdata,
+                                 sx__job_sync* sync)
 {
-    sx_assert(count > 0);
+    sx__job* job = tdata->cur_job;
+    job->owner = tdata->thread_index + 1;
+    job->waiter.job = job;
+    job->waiter.next = NULL;
+    if (sync->last)
+        sync->last->next = &job->waiter;
+    else
+        sync->first = &job->waiter;
+    sync->last = &job->waiter;
+    sx_lock_exit(&sync->lock);
+
+    sx__job_profile_job(ctx, tdata, SX_JOB_PROFILE_WAIT, job, 0);
+    tdata->cur_job = NULL;
+    if (job->run_inline && !job->fiber)
+        sx__job_promote(ctx, tdata, job);
+
+    tdata->selector_fiber = sx_fiber_switch(tdata->selector_fiber, ctx).from;
+}
 
+// Takes the lock, if the object is available (`value` > 0) it's acquired and decremented by
+// `take` (mutex and semaphore) or left as is (event).
+// Otherwise the running job is suspended until the object is handed over to it by the signaling
+// thread. Callers that are not running a job (main thread outside of jobs), run other jobs
+// until the object is available
+static void sx__job_sync_wait(sx_job_context* ctx, sx__job_sync* sync, int take)
+{
     sx__job_thread_data* tdata = (sx__job_thread_data*)sx_tls_get(ctx->thread_tls);
+    sx_assertf(tdata, "must be called from main thread or job worker threads");
 
-    // Divide job count into ranges
-    // check which threads are eligible to execute this task (based on tags)
-    int num_workers = 0;
-    if (tags != 0) {
-        for (int i = 0, ic = ctx->num_threads + 1; i < ic; i++) {
-            if (ctx->tags[i] & tags)
-                num_workers++;
+    uint64_t prev_tm = sx_cycle_clock();
+    for (;;) {
+        sx_lock_enter(&sync->lock);
+        if (sync->value > 0) {
+            sync->value -= take;
+            sx_lock_exit(&sync->lock);
+            return;
         }
-    } else {
-        num_workers = ctx->num_threads + 1;
-    }
 
-    int range_size = count / num_workers;
-    int range_reminder = count % num_workers;
-    int num_jobs = range_size > 0 ? num_workers : (range_reminder > 0 ? range_reminder : 0);
-    sx_assert(num_jobs > 0);
-    sx_assertf(num_jobs <= ctx->job_pool->capacity,
-              "this amount of jobs at a time cannot be done. increase max_jobs");
+        if (tdata->cur_job) {
+            sx__job_sync_suspend(ctx, tdata, sync);
+            return;    // handed over by the signaling thread
+        }
+        sx_lock_exit(&sync->lock);
 
-    // Create a counter (job handle)
-    sx_job_t counter;
-    sx_lock(ctx->counter_lk) {
-        counter = (sx_job_t)sx_pool_new_and_grow(ctx->counter_pool, ctx->alloc);
-    }
+        tdata->selector_fiber = sx_fiber_switch(tdata->selector_fiber, ctx).from;
 
-    if (!counter) {
-        sx_assertf(0, "Maximum job instances exceeded");
-        return NULL;
+        uint64_t now_tm = sx_cycle_clock();
+        uint64_t diff = now_tm - prev_tm;
+        prev_tm = now_tm;
+        if (diff < 300) {
+            sx_relax_cpu();
+        }
     }
+}
 
-    sx_atomic_store32_explicit(counter, (uint32_t)num_jobs, SX_ATOMIC_MEMORYORDER_RELEASE);
-    sx_assertf(tdata, "Dispatch must be called within main thread or job threads");
-
-    // Another job is running on this thread. So depend the current running job to the new
-    // dispatches
-    if (tdata->cur_job)
-        tdata->cur_job->wait_counter = counter;
-
-    // Push jobs to the end of the list, so they can be collected by threads
-    sx_lock(ctx->job_lk) {
-        if (!sx_pool_fulln(ctx->job_pool, num_jobs)) {
-            int range_start = 0;
-            int range_end = range_size + (range_reminder > 0 ? 1 : 0);
-            --range_reminder;
-
-            for (int i = 0; i < num_jobs; i++) {
-                sx__job_add_list(&ctx->waiting_list[priority], &ctx->waiting_list_last[priority],
-                                 sx__new_job(ctx, i, callback, user, range_start, range_end, counter,
-                                             tags, priority));
-                range_start = range_end;
-                range_end += (range_size + (range_reminder > 0 ? 1 : 0));
-                --range_reminder;
-            }
-            sx_assert(range_reminder <= 0);
+static bool sx__job_sync_try(sx__job_sync* sync, int take)
+{
+    bool r = false;
+    sx_lock(sync->lock) {
+        if (sync->value > 0) {
+            sync->value -= take;
+            r = true;
+        }
+    }
+    return r;
+}
 
-            // Post to semaphore to worker threads start cur_job
-            sx_semaphore_post(&ctx->sem, num_jobs);
-        } else {
-            SX_PRAGMA_DIAGNOSTIC_PUSH()
-            SX_PRAGMA_DIAGNOSTIC_IGNORED_MSVC(4204)     // nonstandard extension used: non-constant aggregate initializer
-            sx__job_pending pending = { .counter = counter,
-                                        .range_size = range_size,
-                                        .range_reminder = range_reminder,
-                                        .callback = callback,
-                                        .user = user,
-                                        .priority = priority,
-                                        .tags = tags };
-            sx_array_push(ctx->alloc, ctx->pending, pending);
-            SX_PRAGMA_DIAGNOSTIC_POP()   
-        }
-    }   // lock
+// Detaches up to `count` waiting jobs from the object (-1: all), and decrements `count` for
+// each one. sync->lock must be held by the caller
+static sx__job_waiter* sx__job_sync_detach(sx__job_sync* sync, int* count)
+{
+    sx__job_waiter* first = sync->first;
+    sx__job_waiter* last = NULL;
+    while (sync->first && *count != 0) {
+        last = sync->first;
+        sync->first = last->next;
+        if (*count > 0)
+            --(*count);
+    }
 
-    return counter;
+    if (last)
+        last->next = NULL;
+    else
+        first = NULL;
+    if (sync->first == NULL)
+        sync->last = NULL;
+    return first;
 }
 
-static void sx__job_process_pending(sx_job_context* ctx)
+// Resumes the jobs that are detached from the object. The object is handed over to them (for
+// mutex and semaphore, `value` is not incremented for them), so it can't be taken by others in
+// between
+static void sx__job_sync_resume(sx_job_context* ctx, sx__job_waiter* first)
 {
-    // go through all pending jobs, and push the first one that we can into the job-list
-    for (int i = 0, c = sx_array_count(ctx->pending); i < c; i++) {
-        sx__job_pending pending = ctx->pending[i];
-
-        if (!sx_pool_fulln(ctx->job_pool, (int)sx_atomic_load32_explicit(pending.counter, SX_ATOMIC_MEMORYORDER_ACQUIRE))) {
-            int range_start = 0;
-            int range_end = pending.range_size + (pending.range_reminder > 0 ? 1 : 0);
-            --pending.range_reminder;
+    while (first) {
+        sx__job_waiter* next = first->next;
+        sx__job_resume(ctx, first->job);
+        first = next;
+    }
+}
 
-            sx_array_pop(ctx->pending, i);
+void sx_job_mutex_init(sx_job_mutex* mutex)
+{
+    sx__job_sync_init((sx__job_sync*)mutex->data, 1);
+}
 
-            int count = *pending.counter;
-            for (int k = 0; k < count; k++) {
-                sx__job_add_list(
-                    &ctx->waiting_list[pending.priority], &ctx->waiting_list_last[pending.priority],
-                    sx__new_job(ctx, k, pending.callback, pending.user, range_start, range_end,
-                                pending.counter, pending.tags, pending.priority));
+void sx_job_mutex_release(sx_job_mutex* mutex)
+{
+    sx__job_sync_release((sx__job_sync*)mutex->data);
+}
 
-                range_start = range_end;
-                range_end += (pending.range_size + (pending.range_reminder > 0 ? 1 : 0));
-                --pending.range_reminder;
-            }
+void sx_job_mutex_enter(sx_job_context* ctx, sx_job_mutex* mutex)
+{
+    sx__job_sync_wait(ctx, (sx__job_sync*)mutex->data, 1);
+}
 
-            sx_semaphore_post(&ctx->sem, count);
-            break;
-        }
+void sx_job_mutex_exit(sx_job_context* ctx, sx_job_mutex* mutex)
+{
+    sx__job_sync* sync = (sx__job_sync*)mutex->data;
+    sx__job_waiter* waiters = NULL;
+    int count = 1;
+    sx_lock(sync->lock) {
+        sx_assertf(sync->value == 0, "mutex is not locked");
+        waiters = sx__job_sync_detach(sync, &count);
+        sync->value += count;
     }
+    sx__job_sync_resume(ctx, waiters);
 }
 
-static void sx__job_process_pending_single(sx_job_context* ctx, int index)
+bool sx_job_mutex_try(sx_job_mutex* mutex)
 {
-    sx_lock(ctx->job_lk) {
-        // unlike sx__job_process_pending, only check the specific index to push into job-list
-        sx__job_pending pending = ctx->pending[index];
-        int count = (int)sx_atomic_load32_explicit(pending.counter, SX_ATOMIC_MEMORYORDER_ACQUIRE);
-        if (!sx_pool_fulln(ctx->job_pool, count)) {
-            sx_array_pop(ctx->pending, index);
-
-            int range_start = 0;
-            int range_end = pending.range_size + (pending.range_reminder > 0 ? 1 : 0);
-            --pending.range_reminder;
+    return sx__job_sync_try((sx__job_sync*)mutex->data, 1);
+}
 
-            for (int i = 0; i < count; i++) {
-                sx__job_add_list(
-                    &ctx->waiting_list[pending.priority], &ctx->waiting_list_last[pending.priority],
-                    sx__new_job(ctx, i, pending.callback, pending.user, range_start, range_end,
-                                pending.counter, pending.tags, pending.priority));
+void sx_job_event_init(sx_job_event* event, bool set)
+{
+    sx__job_sync_init((sx__job_sync*)event->data, set ? 1 : 0);
+}
 
-                range_start = range_end;
-                range_end += (pending.range_size + (pending.range_reminder > 0 ? 1 : 0));
-                --pending.range_reminder;
-            }
-            sx_semaphore_post(&ctx->sem, count);
-        }
-    } // lock
+void sx_job_event_release(sx_job_event* event)
+{
+    sx__job_sync_release((sx__job_sync*)event->data);
 }
 
-void sx_job_wait_and_del(sx_job_context* ctx, sx_job_t job)
+void sx_job_event_wait(sx_job_context* ctx, sx_job_event* event)
 {
-    sx__job_thread_data* tdata = (sx__job_thread_data*)sx_tls_get(ctx->thread_tls);
+    sx__job_sync_wait(ctx, (sx__job_sync*)event->data, 0);
+}
 
-    uint64_t prev_tm = sx_cycle_clock();
-    
-    while (sx_atomic_load32_explicit(job, SX_ATOMIC_MEMORYORDER_ACQUIRE) > 0) {
-        // check if the current job is the pending list
-        for (int i = 0, c = sx_array_count(ctx->pending); i < c; i++) {
-            if (ctx->pending[i].counter == job) {
-                sx__job_process_pending_single(ctx, i);
-                break;
-            }
-        }
+void sx_job_event_set(sx_job_context* ctx, sx_job_event* event)
+{
+    sx__job_sync* sync = (sx__job_sync*)event->data;
+    sx__job_waiter* waiters = NULL;
+    int count = -1;
+    sx_lock(sync->lock) {
+        waiters = sx__job_sync_detach(sync, &count);
+        sync->value = 1;
+    }
+    sx__job_sync_resume(ctx, waiters);
+}
 
-        // If thread is running a job, make it slave to the thread so it can only be picked up by
-        // this thread And push the job back to waiting_list
-        if (tdata->cur_job) {
-            sx__job* cur_job = tdata->cur_job;
-            tdata->cur_job = NULL;
-            cur_job->owner_tid = tdata->tid;
+void sx_job_event_reset(sx_job_event* event)
+{
+    sx__job_sync* sync = (sx__job_sync*)event->data;
+    sx_lock(sync->lock) {
+        sync->value = 0;
+    }
+}
 
-            sx_lock(ctx->job_lk) {
-                int list_idx = cur_job->priority;
-                sx__job_add_list(&ctx->waiting_list[list_idx], &ctx->waiting_list_last[list_idx],
-                                 cur_job);
-            }
+bool sx_job_event_test(sx_job_event* event)
+{
+    sx__job_sync* sync = (sx__job_sync*)event->data;
+    bool set = false;
+    sx_lock(sync->lock) {
+        set = sync->value > 0;
+    }
+    return set;
+}
 
-            if (!tdata->main_thrd)
-                sx_semaphore_post(&ctx->sem, 1);
-        }
+void sx_job_sem_init(sx_job_sem* sem, int count)
+{
+    sx_assert(count >= 0);
+    sx__job_sync_init((sx__job_sync*)sem->data, count);
+}
 
-        sx_fiber_switch(tdata->selector_fiber, ctx);    // Switch to selector loop
+void sx_job_sem_release(sx_job_sem* sem)
+{
+    sx__job_sync_release((sx__job_sync*)sem->data);
+}
 
-        if (!tdata->selector_fiber) {
-            tdata->selector_fiber = sx_fiber_create(tdata->selector_stack, sx__job_selector_main_thrd);
-        }
+void sx_job_sem_wait(sx_job_context* ctx, sx_job_sem* sem)
+{
+    sx__job_sync_wait(ctx, (sx__job_sync*)sem->data, 1);
+}
 
-        uint64_t now_tm = sx_cycle_clock();
-        uint64_t diff = now_tm - prev_tm;
-        prev_tm = now_tm;
-        if (diff < 300) {
-            sx_relax_cpu(); // leave some room for the HT cpu cores to breathe
-        }
-    }
+bool sx_job_sem_try(sx_job_sem* sem)
+{
+    return sx__job_sync_try((sx__job_sync*)sem->data, 1);
+}
 
-    // All jobs are done, Delete the counter
-    sx_lock(ctx->counter_lk) {
-        sx_pool_del(ctx->counter_pool, (void*)job);
+void sx_job_sem_post(sx_job_context* ctx, sx_job_sem* sem, int count)
+{
+    sx_assert(count > 0);
+    sx__job_sync* sync = (sx__job_sync*)sem->data;
+    sx__job_waiter* waiters = NULL;
+    sx_lock(sync->lock) {
+        waiters = sx__job_sync_detach(sync, &count);
+        sync->value += count;
     }
+    sx__job_sync_resume(ctx, waiters);
+}
 
-    // auto-dispatch pending jobs
-    sx_lock(ctx->job_lk) {
-        sx__job_process_pending(ctx);
+int sx_job_pump(sx_job_context* ctx, int budget_us)
+{
+    sx__job_thread_data* tdata = (sx__job_thread_data*)sx_tls_get(ctx->thread_tls);
+    sx_assertf(tdata && tdata->main_thrd, "only the thread that created the context can pump");
+    sx_assertf(!tdata->cur_job, "cannot pump inside jobs");
+
+    uint64_t end_tm =
+        budget_us > 0 ? (sx_os_clock_ns() + (uint64_t)budget_us * 1000) : 0;
+    int count = 0;
+    for (;;) {
+        // the scheduler runs a single job (or continues a suspended one) and switches back
+        uint32_t num_executed = tdata->num_executed;
+        tdata->selector_fiber = sx_fiber_switch(tdata->selector_fiber, ctx).from;
+        if (tdata->num_executed == num_executed)
+            break;
+        ++count;
+        if (end_tm == 0 || sx_os_clock_ns() >= end_tm)
+            break;
     }
+    return count;
 }
 
-bool sx_job_test_and_del(sx_job_context* ctx, sx_job_t job)
+// Returns the cpus that worker threads are pinned to, for each affinity policy
+static int sx__job_affinity_cpus(sx_job_affinity affinity, sx_os_cpu cpus[SX_OS_MAX_CPUS])
 {
-    if (sx_atomic_load32_explicit(job, SX_ATOMIC_MEMORYORDER_ACQUIRE) == 0) {
-        // All jobs are done, Delete the counter
-        sx_lock(ctx->counter_lk) {
-            sx_pool_del(ctx->counter_pool, (void*)job);
-        }
-
-        // auto-dispatch pending jobs
-        sx_lock(ctx->job_lk) {
-            sx__job_process_pending(ctx);
-        }
-        return true;
+    if (affinity == SX_JOB_AFFINITY_NONE)
+        return 0;
+
+    sx_os_topology topo;
+    sx_os_cpu_topology(&topo);
+
+    // topology is sorted by node, then SMT index. So with logical cores, workers fill all the
+    // physical cores of a node before they are put on SMT siblings
+    int num_cpus = 0;
+    for (int i = 0; i < topo.num_cpus; i++) {
+        if (affinity == SX_JOB_AFFINITY_PHYSICAL_CORES && topo.cpus[i].smt > 0)
+            continue;
+        cpus[num_cpus++] = topo.cpus[i];
     }
-
-    return false;
+    return num_cpus;
 }
 
-static sx__job_thread_data* sx__job_create_tdata(const sx_alloc* alloc, uint32_t tid, int index,
-                                                 bool main_thrd)
+static sx__job_thread_data* sx__job_create_tdata(sx_job_context* ctx, const sx_alloc* alloc,
+                                                 uint32_t tid, int index, bool main_thrd)
 {
     sx__job_thread_data* tdata =
         (sx__job_thread_data*)sx_malloc(alloc, sizeof(sx__job_thread_data));
@@ -511,8 +2004,31 @@ static sx__job_thread_data* sx__job_create_tdata(const sx_alloc* alloc, uint32_t
     tdata->tid = tid;
     tdata->tags = 0xffffffff;
     tdata->main_thrd = main_thrd;
+    tdata->deques = &ctx->deques[index * SX_JOB_PRIORITY_COUNT];
+    sx_rng_seed(&tdata->rng, tid);
+
+    // steal from threads on the same node first
+    if (ctx->num_threads > 0) {
+        tdata->victims = (int*)sx_malloc(alloc, sizeof(int) * ctx->num_threads);
+        if (!tdata->victims) {
+            sx_out_of_memory();
+            sx_free(alloc, tdata);
+            return NULL;
+        }
+        int num_victims = 0;
+        for (int pass = 0; pass < 2; pass++) {
+            for (int i = 0; i < ctx->num_threads + 1; i++) {
+                bool local = ctx->thread_nodes[i] == ctx->thread_nodes[index];
+                if (i != index && local == (pass == 0))
+                    tdata->victims[num_victims++] = i;
+            }
+            if (pass == 0)
+                tdata->num_local_victims = num_victims;
+        }
+    }
 
-    bool r = sx_fiber_stack_init(&tdata->selector_stack, (int)sx_os_minstacksz());
+    // inline jobs run on scheduler stacks, so they have to be as large as job stacks
+    bool r = sx__job_stack_acquire(ctx, tdata, SX__JOB_STACK_LARGE, &tdata->selector_stack);
     sx_assertf(r, "Not enough memory for temp stacks");
     sx_unused(r);
 
@@ -521,7 +2037,13 @@ static sx__job_thread_data* sx__job_create_tdata(const sx_alloc* alloc, uint32_t
 
 static void sx__job_destroy_tdata(sx__job_thread_data* tdata, const sx_alloc* alloc)
 {
+    for (int i = 0; i < SX__JOB_STACK_COUNT; i++) {
+        for (int k = 0, c = sx_array_count(tdata->stacks[i]); k < c; k++)
+            sx_fiber_stack_release(&tdata->stacks[i][k]);
+        sx_array_free(alloc, tdata->stacks[i]);
+    }
     sx_fiber_stack_release(&tdata->selector_stack);
+    sx_free(alloc, tdata->victims);
     sx_free(alloc, tdata);
 }
 
@@ -531,10 +2053,15 @@ static int sx__job_thread_fn(void* user1, void* user2)
     int index = (int)(intptr_t)user2;
 
     uint32_t thread_id = sx_thread_tid();
-    
+
+    // pin before creating thread data, so it's allocated on the thread's node
+    int cpu_id = ctx->thread_cpus[index + 1];
+    if (cpu_id >= 0 && !sx_thread_setaffinity(cpu_id))
+        sx_assertf(0, "Could not pin job thread(%d) to cpu %d", index + 1, cpu_id);
+
     // Create thread data
     // note: thread index #0 is reserved for main thread
-    sx__job_thread_data* tdata = sx__job_create_tdata(ctx->alloc, thread_id, index + 1, false);
+    sx__job_thread_data* tdata = sx__job_create_tdata(ctx, ctx->alloc, thread_id, index + 1, false);
     if (!tdata) {
         sx_assertf(tdata, "ThreadData create failed!");
         return -1;
@@ -566,17 +2093,133 @@ sx_job_context* sx_job_create_context(const sx_alloc* alloc, const sx_job_contex
     sx_memset(ctx, 0x0, sizeof(sx_job_context));
 
     ctx->alloc = alloc;
-    ctx->num_threads = desc->num_threads > 0 ? desc->num_threads : (sx_os_numcores() - 1);
+
+    // worker placement: cpus of the affinity policy, grouped by node
+    // thread #0 (main) is never pinned, it only keeps the first cpu free of workers
+    sx_os_cpu cpus[SX_OS_MAX_CPUS];
+    int num_cpus = sx__job_affinity_cpus(desc->affinity, cpus);
+    if (desc->num_threads > 0)
+        ctx->num_threads = desc->num_threads;
+    else
+        ctx->num_threads = (num_cpus > 0 ? num_cpus : sx_os_numcores()) - 1;
+
+    ctx->thread_cpus = (int*)sx_malloc(alloc, sizeof(int) * ((size_t)ctx->num_threads + 1));
+    ctx->thread_nodes = (int*)sx_malloc(alloc, sizeof(int) * ((size_t)ctx->num_threads + 1));
+    if (!ctx->thread_cpus || !ctx->thread_nodes) {
+        sx_out_of_memory();
+        return NULL;
+    }
+    for (int i = 0; i < ctx->num_threads + 1; i++) {
+        const sx_os_cpu* cpu = num_cpus > 0 ? &cpus[i % num_cpus] : NULL;
+        ctx->thread_cpus[i] = (cpu && i > 0) ? cpu->id : -1;
+        ctx->thread_nodes[i] = cpu ? cpu->node : 0;
+    }
     ctx->thread_tls = sx_tls_create();
-    ctx->stack_sz = desc->fiber_stack_sz > 0 ? desc->fiber_stack_sz : DEFAULT_FIBER_STACK_SIZE;
+    ctx->stack_sizes[SX__JOB_STACK_LARGE] =
+        desc->fiber_stack_sz > 0 ? desc->fiber_stack_sz : DEFAULT_FIBER_STACK_SIZE;
+    ctx->stack_sizes[SX__JOB_STACK_SMALL] = desc->small_fiber_stack_sz > 0
+                                                ? desc->small_fiber_stack_sz
+                                                : DEFAULT_SMALL_FIBER_STACK_SIZE;
     ctx->thread_init_cb = desc->thread_init_cb;
     ctx->thread_shutdown_cb = desc->thread_shutdown_cb;
     ctx->thread_user = desc->thread_user_data;
     int max_fibers = desc->max_fibers > 0 ? desc->max_fibers : DEFAULT_MAX_FIBERS;
+    int starvation_us = desc->starvation_us > 0 ? desc->starvation_us
+                      : desc->starvation_us < 0 ? 0 : DEFAULT_STARVATION_US;
+    ctx->starvation_ns = (uint64_t)starvation_us * 1000;
+    ctx->served_tm = (sx_atomic_uint64*)sx_aligned_malloc(
+        alloc, SX_CACHE_LINE_SIZE * SX_JOB_PRIORITY_COUNT, SX_CACHE_LINE_SIZE);
+    if (!ctx->served_tm) {
+        sx_out_of_memory();
+        return NULL;
+    }
+    for (int i = 0; i < SX_JOB_PRIORITY_COUNT; i++)
+        sx_atomic_store64_explicit(sx__job_served_tm(ctx, i),
+                                   starvation_us > 0 ? sx_os_clock_ns() : 0,
+                                   SX_ATOMIC_MEMORYORDER_RELAXED);
+
+    ctx->idle_spin_count = desc->idle_spin_count > 0 ? desc->idle_spin_count
+                         : desc->idle_spin_count < 0 ? 0 : DEFAULT_IDLE_SPIN_COUNT;
+    ctx->idle_max_pause = desc->idle_max_pause > 0 ? desc->idle_max_pause : DEFAULT_IDLE_MAX_PAUSE;
+    ctx->sleepers = (sx__job_sleeper*)sx_aligned_malloc(
+        alloc, sizeof(sx__job_sleeper) * ((size_t)ctx->num_threads + 1), SX_CACHE_LINE_SIZE);
+    if (!ctx->sleepers) {
+        sx_out_of_memory();
+        return NULL;
+    }
+    sx_memset(ctx->sleepers, 0x0, sizeof(sx__job_sleeper) * ((size_t)ctx->num_threads + 1));
+    for (int i = 0; i < ctx->num_threads + 1; i++)
+        sx_semaphore_init(&ctx->sleepers[i].sem);
+
+    ctx->resume_queues = (sx__job_resume_queue*)sx_aligned_malloc(
+        alloc, sizeof(sx__job_resume_queue) * ((size_t)ctx->num_threads + 1), SX_CACHE_LINE_SIZE);
+    if (!ctx->resume_queues) {
+        sx_out_of_memory();
+        return NULL;
+    }
+    sx_memset(ctx->resume_queues, 0x0,
+              sizeof(sx__job_resume_queue) * ((size_t)ctx->num_threads + 1));
+
+#if SX_CONFIG_JOBS_PROFILE
+    ctx->profile_capacity = (uint32_t)sx_nearest_pow2(
+        desc->profile_events > 0 ? desc->profile_events : DEFAULT_PROFILE_EVENTS);
+    ctx->profile_rings = (sx__job_profile_ring*)sx_aligned_malloc(
+        alloc, sizeof(sx__job_profile_ring) * ((size_t)ctx->num_threads + 1), SX_CACHE_LINE_SIZE);
+    if (!ctx->profile_rings) {
+        sx_out_of_memory();
+        return NULL;
+    }
+    sx_memset(ctx->profile_rings, 0x0,
+              sizeof(sx__job_profile_ring) * ((size_t)ctx->num_threads + 1));
+    for (int i = 0; i < ctx->num_threads + 1; i++) {
+        ctx->profile_rings[i].events =
+            (sx_job_profile_event*)sx_malloc(alloc, sizeof(sx_job_profile_event) *
+                                                        ctx->profile_capacity);
+        if (!ctx->profile_rings[i].events) {
+            sx_out_of_memory();
+            return NULL;
+        }
+    }
+#endif
 
-    sx_semaphore_init(&ctx->sem);
+    // pools
+    ctx->job_page_size = max_fibers;
+    ctx->deps_pool = sx_pool_create(alloc, sizeof(sx__job_deps), DEPS_POOL_SIZE);
+    if (!ctx->deps_pool)
+        return NULL;
+
+    // counters (job handles), all of them are in the free list at start
+    ctx->max_handles = sx_min(desc->max_handles > 0 ? desc->max_handles : DEFAULT_MAX_HANDLES,
+                              (int)HANDLE_INDEX_MASK + 1);
+    ctx->counters = (sx__job_counter*)sx_aligned_malloc(
+        alloc, sizeof(sx__job_counter) * (size_t)ctx->max_handles, SX_CACHE_LINE_SIZE);
+    if (!ctx->counters) {
+        sx_out_of_memory();
+        return NULL;
+    }
+    sx_memset(ctx->counters, 0x0, sizeof(sx__job_counter) * (size_t)ctx->max_handles);
+    for (int i = 0; i < ctx->max_handles; i++) {
+        ctx->counters[i].gen = 1;
+        ctx->counters[i].next_free = (i + 1 < ctx->max_handles) ? (uint32_t)(i + 2) : 0;
+    }
+    ctx->counter_free = 1;
+
+    // work-stealing deques: start with the size of a job page, they grow on demand
+    int num_deques = (ctx->num_threads + 1) * SX_JOB_PRIORITY_COUNT;
+    int deque_capacity = sx_nearest_pow2(max_fibers);
+    ctx->deques = (sx__job_deque*)sx_aligned_malloc(alloc, sizeof(sx__job_deque) * num_deques,
+                                                    SX_CACHE_LINE_SIZE);
+    if (!ctx->deques) {
+        sx_out_of_memory();
+        return NULL;
+    }
+    sx_memset(ctx->deques, 0x0, sizeof(sx__job_deque) * num_deques);
+    for (int i = 0; i < num_deques; i++) {
+        if (!sx__job_deque_init(&ctx->deques[i], alloc, deque_capacity))
+            return NULL;
+    }
 
-    sx__job_thread_data* main_tdata = sx__job_create_tdata(alloc, sx_thread_tid(), 0, true);
+    sx__job_thread_data* main_tdata = sx__job_create_tdata(ctx, alloc, sx_thread_tid(), 0, true);
     if (!main_tdata) {
         sx_free(alloc, ctx);
         return NULL;
@@ -585,13 +2228,6 @@ sx_job_context* sx_job_create_context(const sx_alloc* alloc, const sx_job_contex
     main_tdata->selector_fiber =
         sx_fiber_create(main_tdata->selector_stack, sx__job_selector_main_thrd);
 
-    // pools
-    ctx->job_pool = sx_pool_create(alloc, sizeof(sx__job), max_fibers);
-    ctx->counter_pool = sx_pool_create(alloc, sizeof(int), COUNTER_POOL_SIZE);
-    if (!ctx->job_pool || !ctx->counter_pool)
-        return NULL;
-    sx_memset(ctx->job_pool->pages->buff, 0x0, sizeof(sx__job) * max_fibers);
-
     // keep tags in an array for evaluating num_jobs
     ctx->tags = sx_malloc(alloc, sizeof(uint32_t) * ((size_t)ctx->num_threads + 1));
     sx_memset(ctx->tags, 0xff, sizeof(uint32_t) * ((size_t)ctx->num_threads + 1));
@@ -620,7 +2256,9 @@ void sx_job_destroy_context(sx_job_context* ctx, const sx_alloc* alloc)
 
     // signal selectors to finish the job and quit
     ctx->quit = 1;
-    sx_semaphore_post(&ctx->sem, ctx->num_threads + 1);
+    sx_atomic_thread_fence(SX_ATOMIC_MEMORYORDER_SEQCST);
+    for (int i = 1; i < ctx->num_threads + 1; i++)
+        sx_semaphore_post(&ctx->sleepers[i].sem, 1);
 
     // shutdown threads
     for (int i = 0; i < ctx->num_threads; i++) sx_thread_destroy(ctx->threads[i], alloc);
@@ -628,13 +2266,31 @@ void sx_job_destroy_context(sx_job_context* ctx, const sx_alloc* alloc)
 
     sx__job_destroy_tdata((sx__job_thread_data*)sx_tls_get(ctx->thread_tls), alloc);
 
-    // TODO: destroy job_pool's stack memories
-    sx_pool_destroy(ctx->job_pool, alloc);
-    sx_pool_destroy(ctx->counter_pool, alloc);
-    sx_semaphore_release(&ctx->sem);
-
+    for (int i = 0, c = sx_array_count(ctx->job_pages); i < c; i++)
+        sx_free(alloc, ctx->job_pages[i]);
+    sx_array_free(alloc, ctx->job_pages);
+    sx_aligned_free(alloc, ctx->counters, SX_CACHE_LINE_SIZE);
+    sx_pool_destroy(ctx->deps_pool, alloc);
+    for (int i = 0; i < ctx->num_threads + 1; i++)
+        sx_semaphore_release(&ctx->sleepers[i].sem);
+    sx_aligned_free(alloc, ctx->sleepers, SX_CACHE_LINE_SIZE);
+    sx_aligned_free(alloc, ctx->resume_queues, SX_CACHE_LINE_SIZE);
+    sx_array_free(alloc, ctx->tag_queues);
+
+#if SX_CONFIG_JOBS_PROFILE
+    for (int i = 0; i < ctx->num_threads + 1; i++)
+        sx_free(alloc, ctx->profile_rings[i].events);
+    sx_aligned_free(alloc, ctx->profile_rings, SX_CACHE_LINE_SIZE);
+#endif
+
+    for (int i = 0, c = (ctx->num_threads + 1) * SX_JOB_PRIORITY_COUNT; i < c; i++)
+        sx__job_deque_release(&ctx->deques[i], alloc);
+    sx_aligned_free(alloc, ctx->deques, SX_CACHE_LINE_SIZE);
+
+    sx_aligned_free(alloc, ctx->served_tm, SX_CACHE_LINE_SIZE);
     sx_free(alloc, ctx->tags);
-    sx_array_free(alloc, ctx->pending);
+    sx_free(alloc, ctx->thread_cpus);
+    sx_free(alloc, ctx->thread_nodes);
     sx_free(alloc, ctx);
 }
 
@@ -651,6 +2307,11 @@ void sx_job_set_current_thread_tags(sx_job_context* ctx, uint32_t tags)
     ctx->tags[tdata->thread_index] = tags;
 }
 
+bool sx_job_thread_in_context(sx_job_context* ctx)
+{
+    return sx_tls_get(ctx->thread_tls) != NULL;
+}
+
 int sx_job_thread_index(sx_job_context* ctx)
 {
     sx__job_thread_data* tdata = (sx__job_thread_data*)sx_tls_get(ctx->thread_tls);
@@ -664,3 +2325,200 @@ unsigned int sx_job_thread_id(sx_job_context* ctx)
     sx_assert(tdata);
     return tdata->tid;
 }
+
+int sx_job_profile_events(sx_job_context* ctx, int thread_index, sx_job_profile_event* events,
+                          int max_events)
+{
+    sx_assert(thread_index >= 0 && thread_index <= ctx->num_threads);
+#if SX_CONFIG_JOBS_PROFILE
+    sx__job_profile_ring* ring = &ctx->profile_rings[thread_index];
+    uint32_t capacity = ctx->profile_capacity;
+    uint32_t mask = capacity - 1;
+
+    uint32_t head = sx_atomic_load32_explicit(&ring->head, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+    uint32_t count = sx_min(sx_min(head, capacity), (uint32_t)max_events);
+    uint32_t first = head - count;
+    for (uint32_t i = 0; i < count; i++)
+        events[i] = ring->events[(first + i) & mask];
+
+    // the owner may have overwritten the oldest events while we were copying them
+    // the event at 'new_head' can be in the middle of writing too
+    sx_atomic_thread_fence(SX_ATOMIC_MEMORYORDER_ACQUIRE);
+    uint32_t new_head = sx_atomic_load32_explicit(&ring->head, SX_ATOMIC_MEMORYORDER_RELAXED);
+    if (new_head - first >= capacity) {
+        uint32_t num_dropped = sx_min(new_head - first - capacity + 1, count);
+        count -= num_dropped;
+        sx_memmove(events, events + num_dropped, sizeof(sx_job_profile_event) * count);
+    }
+    return (int)count;
+#else
+    sx_unused(ctx);
+    sx_unused(events);
+    sx_unused(max_events);
+    return 0;
+#endif
+}
+
+sx_job_profile_stats sx_job_profile_thread_stats(sx_job_context* ctx, int thread_index)
+{
+    sx_assert(thread_index >= 0 && thread_index <= ctx->num_threads);
+    sx_job_profile_stats stats;
+    sx_memset(&stats, 0x0, sizeof(stats));
+#if SX_CONFIG_JOBS_PROFILE
+    sx__job_profile_ring* ring = &ctx->profile_rings[thread_index];
+    for (int i = 0; i < SX_JOB_PROFILE_COUNT; i++)
+        stats.counts[i] =
+            sx_atomic_load32_explicit(&ring->counts[i], SX_ATOMIC_MEMORYORDER_RELAXED);
+    stats.busy_ms =
+        sx_tm_ms(sx_atomic_load64_explicit(&ring->busy_ticks, SX_ATOMIC_MEMORYORDER_RELAXED));
+    stats.idle_ms =
+        sx_tm_ms(sx_atomic_load64_explicit(&ring->idle_ticks, SX_ATOMIC_MEMORYORDER_RELAXED));
+#else
+    sx_unused(ctx);
+#endif
+    return stats;
+}
+
+#if SX_CONFIG_JOBS_PROFILE
+// writes a Chrome trace event, `fields` are added after the common fields (starting with a comma)
+static bool sx__job_profile_write_event(sx_file* file, char ph, double ts, int tid,
+                                        const char* fields)
+{
+    char line[256];
+    int len = sx_snprintf(line, sizeof(line),
+                          "{\"ph\":\"%c\",\"ts\":%.3f,\"pid\":0,\"tid\":%d%s},\n", ph, ts, tid,
+                          fields);
+    return sx_file_write(file, line, len) == len;
+}
+#endif
+
+bool sx_job_profile_save_trace(sx_job_context* ctx, const char* filepath)
+{
+#if SX_CONFIG_JOBS_PROFILE
+    sx_job_profile_event* events =
+        (sx_job_profile_event*)sx_malloc(ctx->alloc, sizeof(sx_job_profile_event) *
+                                                    ctx->profile_capacity);
+    if (!events) {
+        sx_out_of_memory();
+        return false;
+    }
+
+    sx_file file;
+    if (!sx_file_open(&file, filepath, SX_FILE_WRITE)) {
+        sx_free(ctx->alloc, events);
+        return false;
+    }
+
+    // jobs and idle periods are written as begin/end pairs, they never overlap on a thread,
+    // because a job is either running or suspended
+    const char* begin = "{\"traceEvents\":[\n";
+    bool r = sx_file_write(&file, begin, sx_strlen(begin)) == sx_strlen(begin);
+    char fields[128];
+    for (int t = 0; t < ctx->num_threads + 1 && r; t++) {
+        sx_snprintf(fields, sizeof(fields),
+                    ",\"name\":\"thread_name\",\"args\":{\"name\":\"%s(%d)\"}",
+                    t == 0 ? "main" : "sx_job_thread", t);
+        r = sx__job_profile_write_event(&file, 'M', 0, t, fields);
+
+        int num_events = sx_job_profile_events(ctx, t, events, (int)ctx->profile_capacity);
+        for (int i = 0; i < num_events && r; i++) {
+            const sx_job_profile_event* ev = &events[i];
+            double ts = sx_tm_us(ev->tm);
+            switch (ev->type) {
+            case SX_JOB_PROFILE_DISPATCH:
+                sx_snprintf(fields, sizeof(fields),
+                            ",\"name\":\"dispatch\",\"s\":\"t\",\"args\":{\"job\":%u,\"count\":%u}",
+                            ev->job, ev->arg);
+                r = sx__job_profile_write_event(&file, 'i', ts, t, fields);
+                break;
+            case SX_JOB_PROFILE_START:
+            case SX_JOB_PROFILE_RESUME:
+                sx_snprintf(fields, sizeof(fields),
+                            ",\"name\":\"job %u\","
+                            "\"args\":{\"index\":%d,\"priority\":%d,\"resumed\":%d}",
+                            ev->job, ev->job_index, ev->priority,
+                            ev->type == SX_JOB_PROFILE_RESUME ? 1 : 0);
+                r = sx__job_profile_write_event(&file, 'B', ts, t, fields);
+                break;
+            case SX_JOB_PROFILE_WAIT:
+                sx_snprintf(fields, sizeof(fields), ",\"args\":{\"wait\":%u}", ev->arg);
+                r = sx__job_profile_write_event(&file, 'E', ts, t, fields);
+                break;
+            case SX_JOB_PROFILE_STEAL:
+                sx_snprintf(fields, sizeof(fields),
+                            ",\"name\":\"steal\",\"s\":\"t\",\"args\":{\"job\":%u,\"from\":%u}",
+                            ev->job, ev->arg);
+                r = sx__job_profile_write_event(&file, 'i', ts, t, fields);
+                break;
+            case SX_JOB_PROFILE_IDLE_BEGIN:
+                r = sx__job_profile_write_event(&file, 'B', ts, t, ",\"name\":\"idle\"");
+                break;
+            case SX_JOB_PROFILE_END:
+            case SX_JOB_PROFILE_IDLE_END:
+                r = sx__job_profile_write_event(&file, 'E', ts, t, "");
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    // json doesn't allow trailing commas, so the last one is written without
+    const char* end =
+        "{\"ph\":\"M\",\"pid\":0,\"name\":\"process_name\",\"args\":{\"name\":\"sx_jobs\"}}]}\n";
+    r = r && sx_file_write(&file, end, sx_strlen(end)) == sx_strlen(end);
+
+    sx_file_close(&file);
+    sx_free(ctx->alloc, events);
+    return r;
+#else
+    sx_unused(ctx);
+    sx_unused(filepath);
+    return false;
+#endif
+}
+
+bool sx_job_profile_save_bin(sx_job_context* ctx, const char* filepath)
+{
+#if SX_CONFIG_JOBS_PROFILE
+    sx_job_profile_event* events =
+        (sx_job_profile_event*)sx_malloc(ctx->alloc, sizeof(sx_job_profile_event) *
+                                                    ctx->profile_capacity);
+    if (!events) {
+        sx_out_of_memory();
+        return false;
+    }
+
+    sx_file file;
+    if (!sx_file_open(&file, filepath, SX_FILE_WRITE)) {
+        sx_free(ctx->alloc, events);
+        return false;
+    }
+
+    // number of events is patched after all the threads are written
+    sx_job_profile_bin_header header = { .fourcc = sx_makefourcc('S', 'X', 'J', 'P'),
+                                         .version = 1,
+                                         .num_threads = (uint32_t)ctx->num_threads + 1 };
+    bool r = sx_file_write(&file, &header, sizeof(header)) == sizeof(header);
+    for (int t = 0; t < ctx->num_threads + 1 && r; t++) {
+        int num_events = sx_job_profile_events(ctx, t, events, (int)ctx->profile_capacity);
+        for (int i = 0; i < num_events; i++)
+            events[i].tm = (uint64_t)sx_tm_ns(events[i].tm);
+        int64_t size = (int64_t)sizeof(sx_job_profile_event) * num_events;
+        r = sx_file_write(&file, events, size) == size;
+        header.num_events += (uint32_t)num_events;
+    }
+    if (r) {
+        sx_file_seek(&file, 0, SX_WHENCE_BEGIN);
+        r = sx_file_write(&file, &header, sizeof(header)) == sizeof(header);
+    }
+
+    sx_file_close(&file);
+    sx_free(ctx->alloc, events);
+    return r;
+#else
+    sx_unused(ctx);
+    sx_unused(filepath);
+    return false;
+#endif
+}
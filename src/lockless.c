@@ -1,105 +1,176 @@
 #include "sx/lockless.h"
 #include "sx/atomic.h"
 #include "sx/allocator.h"
+#include "sx/math-scalar.h"
+#include "sx/os.h"    // sx_os_clock_ns
+#include "sx/threads.h"
+
+#ifndef SX_LOCK_ADAPTIVE_SPIN_COUNT
+#    define SX_LOCK_ADAPTIVE_SPIN_COUNT 10    // backoff rounds before the thread is parked
+#endif
+#define SX_LOCK_ADAPTIVE_MAX_BACKOFF 64       // maximum number of pauses in each round
+
+// adaptive spinlock
+// state goes to 2 when a thread parks, so exit knows it has to wake someone. The woken thread
+// can't know if there are other sleepers, so it keeps the state at 2 too, which costs a spare
+// wake call at worst
+void sx__lock_adaptive_enter_slow(sx_lock_adaptive_t* lock)
+{
+#if SX_CONFIG_LOCK_STATS
+    uint64_t start_tm = sx_os_clock_ns();
+    uint64_t num_parks = 0;
+#endif
+    uint64_t num_spins = 0;
+    uint32_t backoff = 1;
+    bool locked = false;
+
+    for (int i = 0; i < SX_LOCK_ADAPTIVE_SPIN_COUNT && !locked; i++) {
+        for (uint32_t k = 0; k < backoff; k++)
+            sx_relax_cpu();
+        num_spins += backoff;
+        backoff = sx_min(backoff << 1, (uint32_t)SX_LOCK_ADAPTIVE_MAX_BACKOFF);
+
+        uint32_t state = sx_atomic_load32_explicit(&lock->state, SX_ATOMIC_MEMORYORDER_RELAXED);
+        if (state == 0) {
+            locked = sx_atomic_compare_exchange32_strong_explicit(&lock->state, &state, 1,
+                                                                  SX_ATOMIC_MEMORYORDER_ACQUIRE,
+                                                                  SX_ATOMIC_MEMORYORDER_RELAXED);
+        } else if (state == 2) {
+            break;    // others are already parked, so there's no point to spin
+        }
+    }
 
-// single producer/single consumer - self contained queue
-// Reference:
-// http://www.drdobbs.com/parallel/writing-lock-free-code-a-corrected-queue/210604448?pgno=1
-typedef struct sx__queue_spsc_node {
-    struct sx__queue_spsc_node* next;
-} sx__queue_spsc_node;
-
-typedef struct sx__queue_spsc_bin {
-    sx__queue_spsc_node** ptrs;
-    uint8_t* buff;
-    struct sx__queue_spsc_bin* next;
-    int iter;
-    int _reserved;
-} sx__queue_spsc_bin;
+    if (!locked) {
+        while (sx_atomic_exchange32_explicit(&lock->state, 2, SX_ATOMIC_MEMORYORDER_ACQUIRE) != 0) {
+            sx_futex_wait(&lock->state, 2, -1);
+#if SX_CONFIG_LOCK_STATS
+            ++num_parks;
+#endif
+        }
+    }
 
-typedef struct sx_queue_spsc {
-    sx__queue_spsc_node** ptrs;
-    uint8_t* buff;
-    int iter;
+#if SX_CONFIG_LOCK_STATS
+    uint64_t wait_tm = sx_os_clock_ns() - start_tm;
+    ++lock->stats.num_contended;
+    lock->stats.num_spins += num_spins;
+    lock->stats.num_parks += num_parks;
+    lock->stats.max_wait = sx_max(lock->stats.max_wait, wait_tm);
+#else
+    sx_unused(num_spins);
+#endif
+}
+
+void sx__lock_adaptive_wake(sx_lock_adaptive_t* lock)
+{
+    sx_futex_wake(&lock->state, false);
+}
+
+bool sx_lock_adaptive_stats(sx_lock_adaptive_t* lock, sx_lock_stats* stats)
+{
+#if SX_CONFIG_LOCK_STATS
+    sx_lock_adaptive(*lock) {
+        *stats = lock->stats;
+    }
+    return true;
+#else
+    sx_unused(lock);
+    sx_memset(stats, 0x0, sizeof(sx_lock_stats));
+    return false;
+#endif
+}
+
+void sx_lock_adaptive_reset_stats(sx_lock_adaptive_t* lock)
+{
+#if SX_CONFIG_LOCK_STATS
+    sx_lock_adaptive(*lock) {
+        sx_memset(&lock->stats, 0x0, sizeof(sx_lock_stats));
+    }
+#else
+    sx_unused(lock);
+#endif
+}
+
+
+// single producer/single consumer - self contained queue
+// Reference: https://github.com/cameron314/readerwriterqueue
+// Items are stored in power-of-two ring blocks that are linked in a circle. Producer only moves to
+// the next block when the current one is full, and only if the consumer is not in it, so all the
+// blocks between the producer and the consumer are drained and can be reused.
+// Indexes are 32bit and wrap around. Each side keeps a cached copy of the other side's index, and
+// only reads the shared one (cache miss) when the cached copy says the block is full/empty
+typedef struct sx__queue_spsc_block {
+    struct sx__queue_spsc_block* next;    // only changed by producer when it's the tail block
+    uint8_t* data;
+    uint32_t mask;
     int capacity;
-    int stride;
-    int buff_size;
+    uint8_t _pad1[SX_CACHE_LINE_SIZE - sizeof(void*) * 2 - sizeof(uint32_t) - sizeof(int)];
+
+    // consumer
+    sx_atomic_uint32 front;
+    uint32_t local_tail;
+    uint8_t _pad2[SX_CACHE_LINE_SIZE - sizeof(uint32_t) * 2];
 
-    sx__queue_spsc_node* first;
-    sx_atomic_ptr last;
-    sx_atomic_ptr divider;
+    // producer
+    sx_atomic_uint32 tail;
+    uint32_t local_front;
+    uint8_t _pad3[SX_CACHE_LINE_SIZE - sizeof(uint32_t) * 2];
+} sx__queue_spsc_block;    // followed by item data
 
-    sx__queue_spsc_bin* grow_bins;    // linked-list of bins, if queue is grown
+typedef struct sx_queue_spsc {
+    int item_sz;
+    int stride;
+    uint8_t _pad1[SX_CACHE_LINE_SIZE - sizeof(int) * 2];
+    sx_atomic_ptr front_block;    // consumer
+    uint8_t _pad2[SX_CACHE_LINE_SIZE - sizeof(sx_atomic_ptr)];
+    sx_atomic_ptr tail_block;     // producer
+    uint8_t _pad3[SX_CACHE_LINE_SIZE - sizeof(sx_atomic_ptr)];
 } sx_queue_spsc;
 
-static sx__queue_spsc_bin* sx__queue_spsc_create_bin(const sx_alloc* alloc, int item_sz, int capacity)
+static sx__queue_spsc_block* sx__queue_spsc_create_block(const sx_alloc* alloc, int stride,
+                                                         int capacity)
 {
-    sx_assert(capacity % 16 == 0);
+    sx_assert(sx_ispow2(capacity));
 
-    uint8_t* buff = (uint8_t*)sx_malloc(
-        alloc, sizeof(sx__queue_spsc_bin) + (item_sz + sizeof(void*) + sizeof(sx__queue_spsc_node)) * capacity);
+    uint8_t* buff = (uint8_t*)sx_aligned_malloc(
+        alloc, sizeof(sx__queue_spsc_block) + (size_t)stride * (size_t)capacity, SX_CACHE_LINE_SIZE);
     if (!buff) {
         sx_out_of_memory();
         return NULL;
     }
-    sx__queue_spsc_bin* bin = (sx__queue_spsc_bin*)buff;
-    buff += sizeof(sx__queue_spsc_bin);
-    bin->ptrs = (sx__queue_spsc_node**)buff;
-    buff += sizeof(sx__queue_spsc_node*) * capacity;
-    bin->buff = buff;
-    bin->next = NULL;
-
-    bin->iter = capacity;
-
-    for (int i = 0; i < capacity; i++) {
-        bin->ptrs[capacity - i - 1] =
-            (sx__queue_spsc_node*)(bin->buff + (sizeof(sx__queue_spsc_node) + item_sz) * i);
-    }
 
-    return bin;
-}
-
-static void sx__queue_spsc_destroy_bin(sx__queue_spsc_bin* bin, const sx_alloc* alloc)
-{
-    sx_assert(bin);
-    sx_free(alloc, bin);
+    sx__queue_spsc_block* block = (sx__queue_spsc_block*)buff;
+    sx_memset(block, 0x0, sizeof(sx__queue_spsc_block));
+    block->next = block;
+    block->data = buff + sizeof(sx__queue_spsc_block);
+    block->mask = (uint32_t)capacity - 1;
+    block->capacity = capacity;
+    return block;
 }
 
 sx_queue_spsc* sx_queue_spsc_create(const sx_alloc* alloc, int item_sz, int capacity)
 {
     sx_assert(item_sz > 0);
+    sx_assert(capacity > 0 && capacity <= (1 << 30));
 
-    capacity = sx_align_mask(capacity, 15);
-    uint8_t* buff = (uint8_t*)sx_malloc(
-        alloc,
-        sizeof(sx_queue_spsc) + (item_sz + sizeof(void*) + sizeof(sx__queue_spsc_node)) * capacity);
-    if (!buff) {
+    sx_queue_spsc* queue =
+        (sx_queue_spsc*)sx_aligned_malloc(alloc, sizeof(sx_queue_spsc), SX_CACHE_LINE_SIZE);
+    if (!queue) {
         sx_out_of_memory();
         return NULL;
     }
+    sx_memset(queue, 0x0, sizeof(sx_queue_spsc));
 
-    sx_queue_spsc* queue = (sx_queue_spsc*)buff;
-    buff += sizeof(sx_queue_spsc);
-    queue->ptrs = (sx__queue_spsc_node**)buff;
-    buff += sizeof(sx__queue_spsc_node*) * capacity;
-    queue->buff = buff;
+    // keep items aligned to their natural alignment, so reserve/peek pointers can be used directly
+    queue->item_sz = item_sz;
+    queue->stride = item_sz >= 8 ? sx_align_mask(item_sz, 7) : sx_nearest_pow2(item_sz);
 
-    queue->iter = capacity;
-    queue->capacity = capacity;
-    queue->stride = item_sz;
-    queue->buff_size = (item_sz + (int)sizeof(sx__queue_spsc_node))*capacity;
-
-    for (int i = 0; i < capacity; i++) {
-        queue->ptrs[capacity - i - 1] =
-            (sx__queue_spsc_node*)(queue->buff + (sizeof(sx__queue_spsc_node) + item_sz) * i);
+    sx__queue_spsc_block* block =
+        sx__queue_spsc_create_block(alloc, queue->stride, sx_nearest_pow2(sx_max(capacity, 2)));
+    if (!block) {
+        sx_aligned_free(alloc, queue, SX_CACHE_LINE_SIZE);
+        return NULL;
     }
-
-    // initialize dummy node
-    sx__queue_spsc_node* node = queue->ptrs[--queue->iter];
-    node->next = NULL;
-    queue->first = node;
-    queue->divider = queue->last = (uintptr_t)node;
-    queue->grow_bins = NULL;
+    queue->front_block = queue->tail_block = (uintptr_t)block;
 
     return queue;
 }
@@ -107,120 +178,429 @@ sx_queue_spsc* sx_queue_spsc_create(const sx_alloc* alloc, int item_sz, int capa
 void sx_queue_spsc_destroy(sx_queue_spsc* queue, const sx_alloc* alloc)
 {
     if (queue) {
-        if (queue->grow_bins) {
-            sx__queue_spsc_bin* bin = queue->grow_bins;
-            while (bin) {
-                sx__queue_spsc_bin* next = bin->next;
-                sx__queue_spsc_destroy_bin(bin, alloc);
-                bin = next;
-            }
-        }
-
-        queue->capacity = queue->iter = 0;
-        sx_free(alloc, queue);
+        sx__queue_spsc_block* first = (sx__queue_spsc_block*)queue->front_block;
+        sx__queue_spsc_block* block = first;
+        do {
+            sx__queue_spsc_block* next = block->next;
+            sx_aligned_free(alloc, block, SX_CACHE_LINE_SIZE);
+            block = next;
+        } while (block != first);
+
+        sx_aligned_free(alloc, queue, SX_CACHE_LINE_SIZE);
     }
 }
 
-bool sx_queue_spsc_produce(sx_queue_spsc* queue, const void* data)
+void* sx_queue_spsc_produce_reserve(sx_queue_spsc* queue)
 {
-    sx__queue_spsc_node* node = NULL;
-    sx__queue_spsc_bin* node_bin = NULL;
-    if (queue->iter > 0) {
-        node = queue->ptrs[--queue->iter];
-    } else {
-        // look in bins
-        sx__queue_spsc_bin* bin = queue->grow_bins;
-        while (bin && !node) {
-            if (bin->iter > 0) {
-                node = bin->ptrs[--bin->iter];
-                node_bin = bin;
+    sx__queue_spsc_block* block = (sx__queue_spsc_block*)sx_atomic_loadptr_explicit(
+        &queue->tail_block, SX_ATOMIC_MEMORYORDER_RELAXED);
+    uint32_t tail = sx_atomic_load32_explicit(&block->tail, SX_ATOMIC_MEMORYORDER_RELAXED);
+
+    if (tail - block->local_front == (uint32_t)block->capacity) {
+        block->local_front =
+            sx_atomic_load32_explicit(&block->front, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+        if (tail - block->local_front == (uint32_t)block->capacity) {
+            sx__queue_spsc_block* next = block->next;
+            if ((uintptr_t)next == sx_atomic_loadptr_explicit(&queue->front_block,
+                                                              SX_ATOMIC_MEMORYORDER_ACQUIRE)) {
+                return NULL;    // full
             }
-            bin = bin->next;
+
+            // consumer has left this block, so it's drained
+            tail = sx_atomic_load32_explicit(&next->tail, SX_ATOMIC_MEMORYORDER_RELAXED);
+            next->local_front = sx_atomic_load32_explicit(&next->front, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+            sx_assert(next->local_front == tail);
+            sx_atomic_storeptr_explicit(&queue->tail_block, (uintptr_t)next,
+                                        SX_ATOMIC_MEMORYORDER_RELEASE);
+            block = next;
         }
     }
 
-    if (node) {
-        sx_memcpy(node + 1, data, queue->stride);
-        node->next = NULL;
-
-        sx__queue_spsc_node* last = (sx__queue_spsc_node*)sx_atomic_exchangeptr(&queue->last, (uintptr_t)node);
-        last->next = node;
-
-        // trim/remove un-used nodes up to the divider
-        while ((uintptr_t)queue->first != sx_atomic_loadptr_explicit(&queue->divider, SX_ATOMIC_MEMORYORDER_ACQUIRE)) {
-            sx__queue_spsc_node* first = (sx__queue_spsc_node*)queue->first;
-            queue->first = first->next;
-
-            uintptr_t first_ptr = (uintptr_t)first;
-            if (first_ptr >= (uintptr_t)queue->buff && first_ptr < (uintptr_t)(queue->buff + queue->buff_size)) {
-                sx_assert(queue->iter != queue->capacity);
-                queue->ptrs[queue->iter++] = first;
-            } else {
-                // find the right bin
-                sx__queue_spsc_bin* bin = queue->grow_bins;
-                while (bin) {
-                    if (first_ptr >= (uintptr_t)bin->buff && first_ptr < (uintptr_t)(bin->buff + queue->buff_size)) {
-                        sx_assert(bin->iter != queue->capacity);
-                        bin->ptrs[bin->iter++] = first;
-                        break;
-                    }
-                    bin = bin->next;
-                }
-                sx_assertf(bin, "item does not belong to queue buffers ?!");
+    return block->data + (size_t)(tail & block->mask) * (size_t)queue->stride;
+}
+
+void sx_queue_spsc_produce_commit(sx_queue_spsc* queue)
+{
+    sx__queue_spsc_block* block = (sx__queue_spsc_block*)sx_atomic_loadptr_explicit(
+        &queue->tail_block, SX_ATOMIC_MEMORYORDER_RELAXED);
+    uint32_t tail = sx_atomic_load32_explicit(&block->tail, SX_ATOMIC_MEMORYORDER_RELAXED);
+    sx_assert(tail - block->local_front < (uint32_t)block->capacity);
+    sx_atomic_store32_explicit(&block->tail, tail + 1, SX_ATOMIC_MEMORYORDER_RELEASE);
+}
+
+void* sx_queue_spsc_consume_peek(sx_queue_spsc* queue)
+{
+    sx__queue_spsc_block* block = (sx__queue_spsc_block*)sx_atomic_loadptr_explicit(
+        &queue->front_block, SX_ATOMIC_MEMORYORDER_RELAXED);
+    uint32_t front = sx_atomic_load32_explicit(&block->front, SX_ATOMIC_MEMORYORDER_RELAXED);
+
+    if (front == block->local_tail) {
+        block->local_tail = sx_atomic_load32_explicit(&block->tail, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+        if (front == block->local_tail) {
+            if ((uintptr_t)block == sx_atomic_loadptr_explicit(&queue->tail_block,
+                                                               SX_ATOMIC_MEMORYORDER_ACQUIRE)) {
+                return NULL;    // empty
+            }
+
+            // producer has moved on, so it may have written more items before it left the block
+            block->local_tail =
+                sx_atomic_load32_explicit(&block->tail, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+            if (front == block->local_tail) {
+                block = block->next;
+                sx_atomic_storeptr_explicit(&queue->front_block, (uintptr_t)block,
+                                            SX_ATOMIC_MEMORYORDER_RELEASE);
+                front = sx_atomic_load32_explicit(&block->front, SX_ATOMIC_MEMORYORDER_RELAXED);
+                block->local_tail =
+                    sx_atomic_load32_explicit(&block->tail, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+                if (front == block->local_tail)
+                    return NULL;    // producer has moved here, but not committed the item yet
             }
         }
-        return true;
-    } else {
-        return false;
     }
+
+    return block->data + (size_t)(front & block->mask) * (size_t)queue->stride;
 }
 
-bool sx_queue_spsc_consume(sx_queue_spsc* queue, void* data)
+void sx_queue_spsc_consume_commit(sx_queue_spsc* queue)
 {
-    if (queue->divider != sx_atomic_loadptr_explicit(&queue->last, SX_ATOMIC_MEMORYORDER_ACQUIRE)) {
-        sx__queue_spsc_node* divider = (sx__queue_spsc_node*)queue->divider;
-        sx_assert(divider->next);
-        sx_memcpy(data, divider->next + 1, queue->stride);
+    sx__queue_spsc_block* block = (sx__queue_spsc_block*)sx_atomic_loadptr_explicit(
+        &queue->front_block, SX_ATOMIC_MEMORYORDER_RELAXED);
+    uint32_t front = sx_atomic_load32_explicit(&block->front, SX_ATOMIC_MEMORYORDER_RELAXED);
+    sx_assert(front != block->local_tail);
+    sx_atomic_store32_explicit(&block->front, front + 1, SX_ATOMIC_MEMORYORDER_RELEASE);
+}
 
-        sx_atomic_storeptr_explicit(&queue->divider, (uintptr_t)divider->next, SX_ATOMIC_MEMORYORDER_RELEASE);
+bool sx_queue_spsc_produce(sx_queue_spsc* queue, const void* data)
+{
+    void* item = sx_queue_spsc_produce_reserve(queue);
+    if (item) {
+        sx_memcpy(item, data, queue->item_sz);
+        sx_queue_spsc_produce_commit(queue);
         return true;
     }
+    return false;
+}
 
+bool sx_queue_spsc_consume(sx_queue_spsc* queue, void* data)
+{
+    const void* item = sx_queue_spsc_consume_peek(queue);
+    if (item) {
+        sx_memcpy(data, item, queue->item_sz);
+        sx_queue_spsc_consume_commit(queue);
+        return true;
+    }
     return false;
 }
 
+// inserts a new block after the producer's block, consumer never reads `next` of the tail block
+// before the producer has moved past it (release on tail_block)
 bool sx_queue_spsc_grow(sx_queue_spsc* queue, const sx_alloc* alloc)
 {
-    sx__queue_spsc_bin* bin = sx__queue_spsc_create_bin(alloc, queue->stride, queue->capacity);
-    if (bin) {
-        if (queue->grow_bins) {
-            sx__queue_spsc_bin* last = queue->grow_bins;
-            while (last->next) last = last->next;
-            last->next = bin;
-        } else {
-            queue->grow_bins = bin;
-        }
+    sx__queue_spsc_block* tail_block = (sx__queue_spsc_block*)sx_atomic_loadptr_explicit(
+        &queue->tail_block, SX_ATOMIC_MEMORYORDER_RELAXED);
+    sx__queue_spsc_block* block =
+        sx__queue_spsc_create_block(alloc, queue->stride, tail_block->capacity);
+    if (block) {
+        block->next = tail_block->next;
+        tail_block->next = block;
         return true;
     } else {
         return false;
     }
 }
 
-bool sx_queue_spsc_full(const sx_queue_spsc* queue)
+bool sx_queue_spsc_full(const sx_queue_spsc* _queue)
 {
-    if (queue->iter > 0) {
-        return false;
-    } else {
-        // look in bins
-        sx__queue_spsc_bin* bin = queue->grow_bins;
-        while (bin) {
-            if (bin->iter > 0)
-                return false;
-            bin = bin->next;
+    sx_queue_spsc* queue = (sx_queue_spsc*)_queue;    // atomic loads don't take const pointers
+    sx__queue_spsc_block* block = (sx__queue_spsc_block*)sx_atomic_loadptr_explicit(
+        &queue->tail_block, SX_ATOMIC_MEMORYORDER_RELAXED);
+    uint32_t tail = sx_atomic_load32_explicit(&block->tail, SX_ATOMIC_MEMORYORDER_RELAXED);
+    uint32_t front = sx_atomic_load32_explicit(&block->front, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+    return tail - front == (uint32_t)block->capacity &&
+           (uintptr_t)block->next ==
+               sx_atomic_loadptr_explicit(&queue->front_block, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+}
+
+// multi-producer/multi-consumer bounded queue
+// positions are 32bit and wrap around, so they are always compared by their signed difference
+typedef struct sx__queue_mpmc_cell {
+    sx_atomic_uint32 seq;
+    uint32_t _reserved;
+} sx__queue_mpmc_cell;    // followed by item data
+
+typedef struct sx_queue_mpmc {
+    uint8_t* cells;
+    uint32_t mask;
+    int stride;
+    int item_sz;
+    uint8_t _pad1[SX_CACHE_LINE_SIZE - sizeof(uint8_t*) - sizeof(uint32_t) - sizeof(int) * 2];
+    sx_atomic_uint32 enqueue_pos;
+    uint8_t _pad2[SX_CACHE_LINE_SIZE - sizeof(sx_atomic_uint32)];
+    sx_atomic_uint32 dequeue_pos;
+    uint8_t _pad3[SX_CACHE_LINE_SIZE - sizeof(sx_atomic_uint32)];
+} sx_queue_mpmc;
+
+static inline sx__queue_mpmc_cell* sx__queue_mpmc_get_cell(sx_queue_mpmc* queue, uint32_t pos)
+{
+    return (sx__queue_mpmc_cell*)(queue->cells + (size_t)(pos & queue->mask) * (size_t)queue->stride);
+}
+
+sx_queue_mpmc* sx_queue_mpmc_create(const sx_alloc* alloc, int item_sz, int capacity)
+{
+    sx_assert(item_sz > 0);
+    sx_assert(capacity > 1 && capacity <= (1 << 30));
+
+    capacity = sx_nearest_pow2(capacity);
+    int stride = sx_align_mask((int)sizeof(sx__queue_mpmc_cell) + item_sz, 7);
+    uint8_t* buff = (uint8_t*)sx_aligned_malloc(
+        alloc, sizeof(sx_queue_mpmc) + (size_t)stride * (size_t)capacity, SX_CACHE_LINE_SIZE);
+    if (!buff) {
+        sx_out_of_memory();
+        return NULL;
+    }
+
+    sx_queue_mpmc* queue = (sx_queue_mpmc*)buff;
+    sx_memset(queue, 0x0, sizeof(sx_queue_mpmc));
+    queue->cells = buff + sizeof(sx_queue_mpmc);
+    queue->mask = (uint32_t)capacity - 1;
+    queue->stride = stride;
+    queue->item_sz = item_sz;
+
+    for (int i = 0; i < capacity; i++) {
+        sx_atomic_store32_explicit(&sx__queue_mpmc_get_cell(queue, (uint32_t)i)->seq, (uint32_t)i,
+                                   SX_ATOMIC_MEMORYORDER_RELAXED);
+    }
+
+    return queue;
+}
+
+void sx_queue_mpmc_destroy(sx_queue_mpmc* queue, const sx_alloc* alloc)
+{
+    if (queue) {
+        sx_aligned_free(alloc, queue, SX_CACHE_LINE_SIZE);
+    }
+}
+
+int sx_queue_mpmc_capacity(const sx_queue_mpmc* queue)
+{
+    return (int)queue->mask + 1;
+}
+
+bool sx_queue_mpmc_produce(sx_queue_mpmc* queue, const void* data)
+{
+    sx__queue_mpmc_cell* cell;
+    uint32_t pos = sx_atomic_load32_explicit(&queue->enqueue_pos, SX_ATOMIC_MEMORYORDER_RELAXED);
+    while (1) {
+        cell = sx__queue_mpmc_get_cell(queue, pos);
+        uint32_t seq = sx_atomic_load32_explicit(&cell->seq, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0) {
+            if (sx_atomic_compare_exchange32_strong_explicit(&queue->enqueue_pos, &pos, pos + 1,
+                                                             SX_ATOMIC_MEMORYORDER_RELAXED,
+                                                             SX_ATOMIC_MEMORYORDER_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;    // full
+        } else {
+            pos = sx_atomic_load32_explicit(&queue->enqueue_pos, SX_ATOMIC_MEMORYORDER_RELAXED);
+        }
+    }
+
+    sx_memcpy(cell + 1, data, queue->item_sz);
+    sx_atomic_store32_explicit(&cell->seq, pos + 1, SX_ATOMIC_MEMORYORDER_RELEASE);
+    return true;
+}
+
+bool sx_queue_mpmc_consume(sx_queue_mpmc* queue, void* data)
+{
+    sx__queue_mpmc_cell* cell;
+    uint32_t pos = sx_atomic_load32_explicit(&queue->dequeue_pos, SX_ATOMIC_MEMORYORDER_RELAXED);
+    while (1) {
+        cell = sx__queue_mpmc_get_cell(queue, pos);
+        uint32_t seq = sx_atomic_load32_explicit(&cell->seq, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+        int32_t diff = (int32_t)(seq - (pos + 1));
+        if (diff == 0) {
+            if (sx_atomic_compare_exchange32_strong_explicit(&queue->dequeue_pos, &pos, pos + 1,
+                                                             SX_ATOMIC_MEMORYORDER_RELAXED,
+                                                             SX_ATOMIC_MEMORYORDER_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;    // empty
+        } else {
+            pos = sx_atomic_load32_explicit(&queue->dequeue_pos, SX_ATOMIC_MEMORYORDER_RELAXED);
         }
     }
 
+    sx_memcpy(data, cell + 1, queue->item_sz);
+    sx_atomic_store32_explicit(&cell->seq, pos + queue->mask + 1, SX_ATOMIC_MEMORYORDER_RELEASE);
     return true;
 }
 
+// Batches claim a run of cells that are all ready (free for producers, full for consumers) with a
+// single CAS on the position. Cells can't change their state before the CAS, because that needs
+// the position that we are about to claim
+int sx_queue_mpmc_produce_batch(sx_queue_mpmc* queue, const void* data, int count)
+{
+    sx_assert(count >= 0);
+
+    uint32_t pos = sx_atomic_load32_explicit(&queue->enqueue_pos, SX_ATOMIC_MEMORYORDER_RELAXED);
+    uint32_t n;
+    while (1) {
+        n = 0;
+        while (n < (uint32_t)count) {
+            sx__queue_mpmc_cell* cell = sx__queue_mpmc_get_cell(queue, pos + n);
+            uint32_t seq = sx_atomic_load32_explicit(&cell->seq, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+            if (seq != pos + n)
+                break;
+            ++n;
+        }
+
+        if (n == 0) {
+            sx__queue_mpmc_cell* cell = sx__queue_mpmc_get_cell(queue, pos);
+            uint32_t seq = sx_atomic_load32_explicit(&cell->seq, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+            if ((int32_t)(seq - pos) < 0 || count == 0)
+                return 0;    // full
+            pos = sx_atomic_load32_explicit(&queue->enqueue_pos, SX_ATOMIC_MEMORYORDER_RELAXED);
+        } else if (sx_atomic_compare_exchange32_strong_explicit(&queue->enqueue_pos, &pos, pos + n,
+                                                                SX_ATOMIC_MEMORYORDER_RELAXED,
+                                                                SX_ATOMIC_MEMORYORDER_RELAXED)) {
+            break;
+        }
+    }
+
+    const uint8_t* src = (const uint8_t*)data;
+    for (uint32_t i = 0; i < n; i++) {
+        sx__queue_mpmc_cell* cell = sx__queue_mpmc_get_cell(queue, pos + i);
+        sx_memcpy(cell + 1, src + (size_t)i * (size_t)queue->item_sz, queue->item_sz);
+        sx_atomic_store32_explicit(&cell->seq, pos + i + 1, SX_ATOMIC_MEMORYORDER_RELEASE);
+    }
+    return (int)n;
+}
+
+int sx_queue_mpmc_consume_batch(sx_queue_mpmc* queue, void* data, int max_count)
+{
+    sx_assert(max_count >= 0);
+
+    uint32_t pos = sx_atomic_load32_explicit(&queue->dequeue_pos, SX_ATOMIC_MEMORYORDER_RELAXED);
+    uint32_t n;
+    while (1) {
+        n = 0;
+        while (n < (uint32_t)max_count) {
+            sx__queue_mpmc_cell* cell = sx__queue_mpmc_get_cell(queue, pos + n);
+            uint32_t seq = sx_atomic_load32_explicit(&cell->seq, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+            if (seq != pos + n + 1)
+                break;
+            ++n;
+        }
+
+        if (n == 0) {
+            sx__queue_mpmc_cell* cell = sx__queue_mpmc_get_cell(queue, pos);
+            uint32_t seq = sx_atomic_load32_explicit(&cell->seq, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+            if ((int32_t)(seq - (pos + 1)) < 0 || max_count == 0)
+                return 0;    // empty
+            pos = sx_atomic_load32_explicit(&queue->dequeue_pos, SX_ATOMIC_MEMORYORDER_RELAXED);
+        } else if (sx_atomic_compare_exchange32_strong_explicit(&queue->dequeue_pos, &pos, pos + n,
+                                                                SX_ATOMIC_MEMORYORDER_RELAXED,
+                                                                SX_ATOMIC_MEMORYORDER_RELAXED)) {
+            break;
+        }
+    }
+
+    uint8_t* dst = (uint8_t*)data;
+    for (uint32_t i = 0; i < n; i++) {
+        sx__queue_mpmc_cell* cell = sx__queue_mpmc_get_cell(queue, pos + i);
+        sx_memcpy(dst + (size_t)i * (size_t)queue->item_sz, cell + 1, queue->item_sz);
+        sx_atomic_store32_explicit(&cell->seq, pos + i + queue->mask + 1,
+                                   SX_ATOMIC_MEMORYORDER_RELEASE);
+    }
+    return (int)n;
+}
+
+// multi-producer/single-consumer intrusive queue
+// `head` is the last produced node (producers), `tail` is the next node to consume (consumer).
+// stub node is put back into the list whenever the consumer would take the last node, so the list
+// is never empty and producers don't have to deal with the consumer
+typedef struct sx_queue_mpsc {
+    sx_atomic_ptr head;
+    uint8_t _pad1[SX_CACHE_LINE_SIZE - sizeof(sx_atomic_ptr)];
+    sx_queue_mpsc_node* tail;
+    sx_queue_mpsc_node stub;
+    uint8_t _pad2[SX_CACHE_LINE_SIZE - sizeof(void*) - sizeof(sx_queue_mpsc_node)];
+} sx_queue_mpsc;
+
+sx_queue_mpsc* sx_queue_mpsc_create(const sx_alloc* alloc)
+{
+    sx_queue_mpsc* queue =
+        (sx_queue_mpsc*)sx_aligned_malloc(alloc, sizeof(sx_queue_mpsc), SX_CACHE_LINE_SIZE);
+    if (!queue) {
+        sx_out_of_memory();
+        return NULL;
+    }
+
+    sx_memset(queue, 0x0, sizeof(sx_queue_mpsc));
+    queue->head = (uintptr_t)&queue->stub;
+    queue->tail = &queue->stub;
+    return queue;
+}
+
+void sx_queue_mpsc_destroy(sx_queue_mpsc* queue, const sx_alloc* alloc)
+{
+    if (queue) {
+        sx_aligned_free(alloc, queue, SX_CACHE_LINE_SIZE);
+    }
+}
+
+void sx_queue_mpsc_produce(sx_queue_mpsc* queue, sx_queue_mpsc_node* node)
+{
+    sx_atomic_storeptr_explicit(&node->next, 0, SX_ATOMIC_MEMORYORDER_RELAXED);
+    sx_queue_mpsc_node* prev = (sx_queue_mpsc_node*)sx_atomic_exchangeptr_explicit(
+        &queue->head, (uintptr_t)node, SX_ATOMIC_MEMORYORDER_ACQREL);
+    sx_atomic_storeptr_explicit(&prev->next, (uintptr_t)node, SX_ATOMIC_MEMORYORDER_RELEASE);
+}
+
+sx_queue_mpsc_node* sx_queue_mpsc_consume(sx_queue_mpsc* queue)
+{
+    sx_queue_mpsc_node* tail = queue->tail;
+    sx_queue_mpsc_node* next = (sx_queue_mpsc_node*)sx_atomic_loadptr_explicit(
+        &tail->next, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+
+    if (tail == &queue->stub) {
+        if (!next)
+            return NULL;    // empty
+        queue->tail = tail = next;
+        next = (sx_queue_mpsc_node*)sx_atomic_loadptr_explicit(&tail->next,
+                                                               SX_ATOMIC_MEMORYORDER_ACQUIRE);
+    }
+
+    if (next) {
+        queue->tail = next;
+        return tail;
+    }
+
+    // `tail` is the last linked node: if it's not the head, a producer is still linking its node
+    if ((uintptr_t)tail !=
+        sx_atomic_loadptr_explicit(&queue->head, SX_ATOMIC_MEMORYORDER_ACQUIRE)) {
+        return NULL;
+    }
+
+    sx_queue_mpsc_produce(queue, &queue->stub);
+    next = (sx_queue_mpsc_node*)sx_atomic_loadptr_explicit(&tail->next,
+                                                           SX_ATOMIC_MEMORYORDER_ACQUIRE);
+    if (next) {
+        queue->tail = next;
+        return tail;
+    }
+    return NULL;
+}
 
+int sx_queue_mpsc_consume_batch(sx_queue_mpsc* queue, sx_queue_mpsc_node** nodes, int max_count)
+{
+    int count = 0;
+    sx_queue_mpsc_node* node;
+    while (count < max_count && (node = sx_queue_mpsc_consume(queue)) != NULL) {
+        nodes[count++] = node;
+    }
+    return count;
+}
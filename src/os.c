@@ -231,6 +231,24 @@ void sx_os_sleep(int ms)
 #endif    // SX_PLATFORM_
 }
 
+uint64_t sx_os_clock_ns(void)
+{
+#if SX_PLATFORM_WINDOWS
+    static LARGE_INTEGER freq;
+    if (freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);    // fixed at boot, so racing threads get the same value
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    uint64_t f = (uint64_t)freq.QuadPart;
+    uint64_t c = (uint64_t)counter.QuadPart;
+    return (c / f) * 1000000000 + (c % f) * 1000000000 / f;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif    // SX_PLATFORM_
+}
+
 sx_pinfo sx_os_exec(const char* const* argv)
 {
 #if SX_PLATFORM_LINUX || SX_PLATFORM_HURD
@@ -683,3 +701,226 @@ int sx_os_numcores(void)
     return 1;
 #endif
 }
+
+// cpus are filled with raw ids of the OS in `core` (unique for each physical core) and `node`,
+// in the order of cpu ids. this function maps them to indexes, calculates SMT indexes and sorts
+static int sx__os_cpu_cmp(const void* a, const void* b)
+{
+    const sx_os_cpu* ca = (const sx_os_cpu*)a;
+    const sx_os_cpu* cb = (const sx_os_cpu*)b;
+    if (ca->node != cb->node)
+        return ca->node - cb->node;
+    if (ca->smt != cb->smt)
+        return ca->smt - cb->smt;
+    if (ca->core != cb->core)
+        return ca->core - cb->core;
+    return ca->id - cb->id;
+}
+
+static void sx__os_cpu_topology_finish(sx_os_topology* topo)
+{
+    int cores[SX_OS_MAX_CPUS];
+    int nodes[SX_OS_MAX_CPUS];
+    int num_cores = 0;
+    int num_nodes = 0;
+
+    for (int i = 0; i < topo->num_cpus; i++) {
+        sx_os_cpu* cpu = &topo->cpus[i];
+        int core = 0, node = 0;
+
+        while (core < num_cores && cores[core] != cpu->core)
+            core++;
+        if (core == num_cores)
+            cores[num_cores++] = cpu->core;
+
+        while (node < num_nodes && nodes[node] != cpu->node)
+            node++;
+        if (node == num_nodes)
+            nodes[num_nodes++] = cpu->node;
+
+        cpu->core = core;
+        cpu->node = node;
+
+        // siblings with lower ids come first
+        cpu->smt = 0;
+        for (int k = 0; k < i; k++) {
+            if (topo->cpus[k].core == core)
+                cpu->smt++;
+        }
+    }
+
+    topo->num_cores = num_cores;
+    topo->num_nodes = num_nodes;
+    qsort(topo->cpus, (size_t)topo->num_cpus, sizeof(sx_os_cpu), sx__os_cpu_cmp);
+}
+
+#if SX_PLATFORM_LINUX || SX_PLATFORM_RPI || SX_PLATFORM_ANDROID
+static int sx__os_read_text(const char* filepath, char* buff, int size)
+{
+    FILE* f = fopen(filepath, "rb");
+    if (!f)
+        return 0;
+    size_t len = fread(buff, 1, (size_t)size - 1, f);
+    fclose(f);
+    buff[len] = '\0';
+    return (int)len;
+}
+
+static int sx__os_read_int(const char* filepath, int default_value)
+{
+    char buff[32];
+    return sx__os_read_text(filepath, buff, sizeof(buff)) > 0 ? atoi(buff) : default_value;
+}
+
+// parses linux cpu/node lists (example: "0-3,8,10-11") into a bitset
+static bool sx__os_parse_cpulist(const char* str, uint64_t mask[SX_OS_MAX_CPUS / 64])
+{
+    sx_memset(mask, 0x0, sizeof(uint64_t) * (SX_OS_MAX_CPUS / 64));
+    bool found = false;
+    char* s = (char*)str;
+    while (*s) {
+        while (*s == ' ' || *s == '\t' || *s == ',')
+            s++;
+        if (*s < '0' || *s > '9')
+            break;
+        int first = (int)strtol(s, &s, 10);
+        int last = first;
+        if (*s == '-')
+            last = (int)strtol(s + 1, &s, 10);
+        for (int i = first; i <= last && i < SX_OS_MAX_CPUS; i++)
+            mask[i >> 6] |= 1ull << (i & 63);
+        found = true;
+    }
+    return found;
+}
+
+static bool sx__os_cpu_topology_linux(sx_os_topology* topo)
+{
+    char buff[4096];
+    char filepath[128];
+    uint64_t mask[SX_OS_MAX_CPUS / 64];
+
+    // cpus that the process is allowed to run on (taskset, cgroup cpusets), falls back to online
+    // cpus if the status file doesn't have the entry
+    bool found = false;
+    if (sx__os_read_text("/proc/self/status", buff, sizeof(buff)) > 0) {
+        const char* allowed = sx_strstr(buff, "Cpus_allowed_list:");
+        if (allowed)
+            found = sx__os_parse_cpulist(allowed + sx_strlen("Cpus_allowed_list:"), mask);
+    }
+    if (!found) {
+        if (sx__os_read_text("/sys/devices/system/cpu/online", buff, sizeof(buff)) == 0 ||
+            !sx__os_parse_cpulist(buff, mask)) {
+            return false;
+        }
+    }
+
+    topo->num_cpus = 0;
+    for (int i = 0; i < SX_OS_MAX_CPUS; i++) {
+        if (!(mask[i >> 6] & (1ull << (i & 63))))
+            continue;
+        sx_snprintf(filepath, sizeof(filepath),
+                    "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", i);
+        int package = sx__os_read_int(filepath, 0);
+        sx_snprintf(filepath, sizeof(filepath), "/sys/devices/system/cpu/cpu%d/topology/core_id",
+                    i);
+        int core_id = sx__os_read_int(filepath, i);
+
+        // core_id is only unique inside the package
+        topo->cpus[topo->num_cpus++] =
+            (sx_os_cpu){ .id = i, .core = (package << 16) | (core_id & 0xffff), .node = 0 };
+    }
+
+    // kernels without NUMA support don't have node entries, everything stays on node 0
+    uint64_t node_mask[SX_OS_MAX_CPUS / 64];
+    if (sx__os_read_text("/sys/devices/system/node/online", buff, sizeof(buff)) > 0 &&
+        sx__os_parse_cpulist(buff, node_mask)) {
+        for (int n = 0; n < SX_OS_MAX_CPUS; n++) {
+            if (!(node_mask[n >> 6] & (1ull << (n & 63))))
+                continue;
+            sx_snprintf(filepath, sizeof(filepath), "/sys/devices/system/node/node%d/cpulist", n);
+            if (sx__os_read_text(filepath, buff, sizeof(buff)) == 0 ||
+                !sx__os_parse_cpulist(buff, mask)) {
+                continue;
+            }
+            for (int i = 0; i < topo->num_cpus; i++) {
+                int id = topo->cpus[i].id;
+                if (mask[id >> 6] & (1ull << (id & 63)))
+                    topo->cpus[i].node = n;
+            }
+        }
+    }
+
+    return topo->num_cpus > 0;
+}
+#elif SX_PLATFORM_WINDOWS
+static bool sx__os_cpu_topology_win(sx_os_topology* topo)
+{
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION infos[SX_OS_MAX_CPUS];
+    DWORD size = sizeof(infos);
+    if (!GetLogicalProcessorInformation(infos, &size))
+        return false;
+
+    DWORD_PTR process_mask, system_mask;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+        return false;
+
+    // only the processor group of the process is visible here (maximum of 64 cpus)
+    int cpu_cores[64];
+    int cpu_nodes[64];
+    for (int i = 0; i < 64; i++) {
+        cpu_cores[i] = -1;
+        cpu_nodes[i] = 0;
+    }
+
+    int num_infos = (int)(size / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+    int num_cores = 0;
+    for (int i = 0; i < num_infos; i++) {
+        const SYSTEM_LOGICAL_PROCESSOR_INFORMATION* info = &infos[i];
+        for (int k = 0; k < (int)(sizeof(ULONG_PTR) * 8) && k < 64; k++) {
+            if (!(info->ProcessorMask & ((ULONG_PTR)1 << k)))
+                continue;
+            if (info->Relationship == RelationProcessorCore)
+                cpu_cores[k] = num_cores;
+            else if (info->Relationship == RelationNumaNode)
+                cpu_nodes[k] = (int)info->NumaNode.NodeNumber;
+        }
+        if (info->Relationship == RelationProcessorCore)
+            num_cores++;
+    }
+
+    topo->num_cpus = 0;
+    for (int i = 0; i < (int)(sizeof(DWORD_PTR) * 8) && i < 64; i++) {
+        if (cpu_cores[i] == -1 || !(process_mask & ((DWORD_PTR)1 << i)))
+            continue;
+        topo->cpus[topo->num_cpus++] =
+            (sx_os_cpu){ .id = i, .core = cpu_cores[i], .node = cpu_nodes[i] };
+    }
+
+    return topo->num_cpus > 0;
+}
+#endif
+
+bool sx_os_cpu_topology(sx_os_topology* topo)
+{
+    sx_assert(topo);
+    sx_memset(topo, 0x0, sizeof(sx_os_topology));
+
+#if SX_PLATFORM_LINUX || SX_PLATFORM_RPI || SX_PLATFORM_ANDROID
+    bool r = sx__os_cpu_topology_linux(topo);
+#elif SX_PLATFORM_WINDOWS
+    bool r = sx__os_cpu_topology_win(topo);
+#else
+    bool r = false;
+#endif
+
+    // fallback: no SMT, no NUMA
+    if (!r) {
+        topo->num_cpus = sx_clamp(sx_os_numcores(), 1, SX_OS_MAX_CPUS);
+        for (int i = 0; i < topo->num_cpus; i++)
+            topo->cpus[i] = (sx_os_cpu){ .id = i, .core = i, .node = 0 };
+    }
+
+    sx__os_cpu_topology_finish(topo);
+    return r;
+}
@@ -18,6 +18,7 @@
 #elif SX_PLATFORM_POSIX
 #    define __USE_GNU
 #    include <errno.h>
+#    include <limits.h>
 #    include <pthread.h>
 #    include <semaphore.h>
 #    include <sys/prctl.h>
@@ -26,7 +27,8 @@
 #    if defined(__FreeBSD__)
 #        include <pthread_np.h>
 #    endif
-#    if SX_PLATFORM_LINUX || SX_PLATFORM_RPI
+#    if SX_PLATFORM_LINUX || SX_PLATFORM_RPI || SX_PLATFORM_ANDROID
+#        include <linux/futex.h>
 #        include <sys/syscall.h>    // syscall
 #    endif
 #elif SX_PLATFORM_WINDOWS
@@ -727,3 +729,413 @@ uint32_t sx_thread_tid(void)
 #endif    // SX_PLATFORM_
 }
 
+
+bool sx_thread_setaffinity(int cpu_id)
+{
+    sx_assert(cpu_id >= 0);
+#if SX_PLATFORM_WINDOWS
+    if (cpu_id >= (int)(sizeof(DWORD_PTR) * 8))
+        return false;
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu_id) != 0;
+#elif SX_PLATFORM_LINUX || SX_PLATFORM_RPI || SX_PLATFORM_STEAMLINK
+    if (cpu_id >= CPU_SETSIZE)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu_id, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif SX_PLATFORM_ANDROID
+    if (cpu_id >= CPU_SETSIZE)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu_id, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    // OSX doesn't support pinning threads to cpus, only affinity hints
+    sx_unused(cpu_id);
+    return false;
+#endif    // SX_PLATFORM_
+}
+
+// Futex
+#if SX_PLATFORM_LINUX || SX_PLATFORM_RPI || SX_PLATFORM_ANDROID
+bool sx_futex_wait(uint32_t* addr, uint32_t expected, int msecs)
+{
+    struct timespec ts;
+    if (msecs >= 0) {
+        ts.tv_sec = msecs / 1000;
+        ts.tv_nsec = (long)(msecs % 1000) * 1000000;
+    }
+    long r = syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, msecs >= 0 ? &ts : NULL,
+                     NULL, 0);
+    return r == 0 || errno != ETIMEDOUT;
+}
+
+void sx_futex_wake(uint32_t* addr, bool wake_all)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, wake_all ? INT_MAX : 1, NULL, NULL, 0);
+}
+#elif SX_PLATFORM_WINDOWS && _WIN32_WINNT >= 0x0602
+bool sx_futex_wait(uint32_t* addr, uint32_t expected, int msecs)
+{
+    return WaitOnAddress(addr, &expected, sizeof(uint32_t), msecs < 0 ? INFINITE : (DWORD)msecs) ||
+           GetLastError() != ERROR_TIMEOUT;
+}
+
+void sx_futex_wake(uint32_t* addr, bool wake_all)
+{
+    if (wake_all)
+        WakeByAddressAll(addr);
+    else
+        WakeByAddressSingle(addr);
+}
+#elif SX_PLATFORM_POSIX
+// addresses are hashed into buckets of mutex/cond pairs. Waiters check the value while holding the
+// bucket mutex and wakers take the same mutex before broadcast, so no wake-up gets lost
+#    define SX__FUTEX_NUM_BUCKETS 64
+
+typedef struct sx__futex_bucket {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} sx__futex_bucket;
+
+static sx__futex_bucket g_futex_buckets[SX__FUTEX_NUM_BUCKETS];
+static pthread_once_t g_futex_once = PTHREAD_ONCE_INIT;
+
+static void sx__futex_init(void)
+{
+    for (int i = 0; i < SX__FUTEX_NUM_BUCKETS; i++) {
+        pthread_mutex_init(&g_futex_buckets[i].mutex, NULL);
+        pthread_cond_init(&g_futex_buckets[i].cond, NULL);
+    }
+}
+
+static sx__futex_bucket* sx__futex_get_bucket(uint32_t* addr)
+{
+    pthread_once(&g_futex_once, sx__futex_init);
+    return &g_futex_buckets[((uintptr_t)addr >> 2) % SX__FUTEX_NUM_BUCKETS];
+}
+
+bool sx_futex_wait(uint32_t* addr, uint32_t expected, int msecs)
+{
+    sx__futex_bucket* bucket = sx__futex_get_bucket(addr);
+    bool timed_out = false;
+    pthread_mutex_lock(&bucket->mutex);
+    if (sx_atomic_load32_explicit(addr, SX_ATOMIC_MEMORYORDER_RELAXED) == expected) {
+        if (msecs < 0) {
+            pthread_cond_wait(&bucket->cond, &bucket->mutex);
+        } else {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            sx__tm_add(&ts, msecs);
+            timed_out = pthread_cond_timedwait(&bucket->cond, &bucket->mutex, &ts) == ETIMEDOUT;
+        }
+    }
+    pthread_mutex_unlock(&bucket->mutex);
+    return !timed_out;
+}
+
+void sx_futex_wake(uint32_t* addr, bool wake_all)
+{
+    sx_unused(wake_all);    // other addresses may share the bucket, so always wake everyone
+    sx__futex_bucket* bucket = sx__futex_get_bucket(addr);
+    pthread_mutex_lock(&bucket->mutex);
+    pthread_cond_broadcast(&bucket->cond);
+    pthread_mutex_unlock(&bucket->mutex);
+}
+#else
+bool sx_futex_wait(uint32_t* addr, uint32_t expected, int msecs)
+{
+    sx_unused(msecs);
+    if (sx_atomic_load32_explicit(addr, SX_ATOMIC_MEMORYORDER_RELAXED) == expected)
+        sx_thread_yield();
+    return true;
+}
+
+void sx_futex_wake(uint32_t* addr, bool wake_all)
+{
+    sx_unused(addr);
+    sx_unused(wake_all);
+}
+#endif    // SX_PLATFORM_
+
+// returns the time left until `deadline` in msecs for sx_futex_wait, -1 (infinite) if there's no
+// deadline. deadline is in msecs of a monotonic clock
+static inline uint64_t sx__thread_now_ms(void)
+{
+    return sx_os_clock_ns() / 1000000;
+}
+
+static int sx__thread_remaining_ms(uint64_t deadline, int msecs)
+{
+    if (msecs < 0)
+        return -1;
+    uint64_t now = sx__thread_now_ms();
+    return now < deadline ? (int)(deadline - now) : 0;
+}
+
+// RW lock
+// Fast paths are a single CAS on `state`. Threads that can't get the lock spin for a while, then
+// count themselves in num_waiting_readers/writers and park on reader_seq/writer_seq. Wakers bump
+// the seq before the wake call, so a waiter that read the seq before checking the lock state
+// doesn't miss the wake. Waiting counters and state are accessed with seq_cst on both sides, so
+// either the waker sees the waiter's counter or the waiter sees the new state
+#define SX__RWLOCK_WRITER 0x80000000u
+#define SX__LOCK_SPIN_COUNT 100
+
+static bool sx__rwlock_read_try(sx_rwlock* lock, sx_atomic_memory_order order)
+{
+    uint32_t state = sx_atomic_load32_explicit(&lock->state, order);
+    while (!(state & SX__RWLOCK_WRITER) &&
+           !(lock->prefer_writers &&
+             sx_atomic_load32_explicit(&lock->num_waiting_writers, order) > 0)) {
+        if (sx_atomic_compare_exchange32_strong_explicit(&lock->state, &state, state + 1,
+                                                         SX_ATOMIC_MEMORYORDER_ACQUIRE,
+                                                         SX_ATOMIC_MEMORYORDER_RELAXED)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool sx__rwlock_write_try(sx_rwlock* lock, sx_atomic_memory_order order)
+{
+    uint32_t state = 0;
+    return sx_atomic_load32_explicit(&lock->state, order) == 0 &&
+           sx_atomic_compare_exchange32_strong_explicit(&lock->state, &state, SX__RWLOCK_WRITER,
+                                                        SX_ATOMIC_MEMORYORDER_ACQUIRE,
+                                                        SX_ATOMIC_MEMORYORDER_RELAXED);
+}
+
+static void sx__rwlock_wake_readers(sx_rwlock* lock)
+{
+    if (sx_atomic_load32_explicit(&lock->num_waiting_readers, SX_ATOMIC_MEMORYORDER_SEQCST) > 0) {
+        sx_atomic_fetch_add32_explicit(&lock->reader_seq, 1, SX_ATOMIC_MEMORYORDER_SEQCST);
+        sx_futex_wake(&lock->reader_seq, true);
+    }
+}
+
+static void sx__rwlock_wake_writer(sx_rwlock* lock)
+{
+    sx_atomic_fetch_add32_explicit(&lock->writer_seq, 1, SX_ATOMIC_MEMORYORDER_SEQCST);
+    sx_futex_wake(&lock->writer_seq, false);
+}
+
+void sx_rwlock_init(sx_rwlock* lock, bool prefer_writers)
+{
+    sx_memset(lock, 0x0, sizeof(sx_rwlock));
+    lock->prefer_writers = prefer_writers;
+}
+
+void sx_rwlock_release(sx_rwlock* lock)
+{
+    sx_unused(lock);
+    sx_assertf(lock->state == 0, "RW lock is still locked");
+}
+
+bool sx_rwlock_read_try(sx_rwlock* lock)
+{
+    return sx__rwlock_read_try(lock, SX_ATOMIC_MEMORYORDER_RELAXED);
+}
+
+bool sx_rwlock_read_enter_timed(sx_rwlock* lock, int msecs)
+{
+    for (int i = 0; i < SX__LOCK_SPIN_COUNT; i++) {
+        if (sx__rwlock_read_try(lock, SX_ATOMIC_MEMORYORDER_RELAXED))
+            return true;
+        sx_relax_cpu();
+    }
+
+    uint64_t deadline = msecs >= 0 ? (sx__thread_now_ms() + (uint64_t)msecs) : 0;
+    bool locked = false;
+    sx_atomic_fetch_add32_explicit(&lock->num_waiting_readers, 1, SX_ATOMIC_MEMORYORDER_SEQCST);
+    while (1) {
+        uint32_t seq = sx_atomic_load32_explicit(&lock->reader_seq, SX_ATOMIC_MEMORYORDER_SEQCST);
+        if ((locked = sx__rwlock_read_try(lock, SX_ATOMIC_MEMORYORDER_SEQCST)) != false)
+            break;
+        int remaining = sx__thread_remaining_ms(deadline, msecs);
+        if (remaining == 0)
+            break;
+        sx_futex_wait(&lock->reader_seq, seq, remaining);
+    }
+    sx_atomic_fetch_sub32_explicit(&lock->num_waiting_readers, 1, SX_ATOMIC_MEMORYORDER_SEQCST);
+    return locked;
+}
+
+void sx_rwlock_read_enter(sx_rwlock* lock)
+{
+    if (!sx__rwlock_read_try(lock, SX_ATOMIC_MEMORYORDER_RELAXED))
+        sx_rwlock_read_enter_timed(lock, -1);
+}
+
+void sx_rwlock_read_exit(sx_rwlock* lock)
+{
+    uint32_t state =
+        sx_atomic_fetch_sub32_explicit(&lock->state, 1, SX_ATOMIC_MEMORYORDER_SEQCST) - 1;
+    sx_assertf(!(state & SX__RWLOCK_WRITER), "RW lock is not read locked");
+    if (state == 0 &&
+        sx_atomic_load32_explicit(&lock->num_waiting_writers, SX_ATOMIC_MEMORYORDER_SEQCST) > 0) {
+        sx__rwlock_wake_writer(lock);
+    }
+}
+
+bool sx_rwlock_write_try(sx_rwlock* lock)
+{
+    return sx__rwlock_write_try(lock, SX_ATOMIC_MEMORYORDER_RELAXED);
+}
+
+bool sx_rwlock_write_enter_timed(sx_rwlock* lock, int msecs)
+{
+    for (int i = 0; i < SX__LOCK_SPIN_COUNT; i++) {
+        if (sx__rwlock_write_try(lock, SX_ATOMIC_MEMORYORDER_RELAXED))
+            return true;
+        sx_relax_cpu();
+    }
+
+    uint64_t deadline = msecs >= 0 ? (sx__thread_now_ms() + (uint64_t)msecs) : 0;
+    bool locked = false;
+    sx_atomic_fetch_add32_explicit(&lock->num_waiting_writers, 1, SX_ATOMIC_MEMORYORDER_SEQCST);
+    while (1) {
+        uint32_t seq = sx_atomic_load32_explicit(&lock->writer_seq, SX_ATOMIC_MEMORYORDER_SEQCST);
+        if ((locked = sx__rwlock_write_try(lock, SX_ATOMIC_MEMORYORDER_SEQCST)) != false)
+            break;
+        int remaining = sx__thread_remaining_ms(deadline, msecs);
+        if (remaining == 0)
+            break;
+        sx_futex_wait(&lock->writer_seq, seq, remaining);
+    }
+    sx_atomic_fetch_sub32_explicit(&lock->num_waiting_writers, 1, SX_ATOMIC_MEMORYORDER_SEQCST);
+
+    // readers may have been waiting for us to get out of the way (prefer_writers)
+    if (!locked)
+        sx__rwlock_wake_readers(lock);
+    return locked;
+}
+
+void sx_rwlock_write_enter(sx_rwlock* lock)
+{
+    if (!sx__rwlock_write_try(lock, SX_ATOMIC_MEMORYORDER_RELAXED))
+        sx_rwlock_write_enter_timed(lock, -1);
+}
+
+void sx_rwlock_write_exit(sx_rwlock* lock)
+{
+    sx_assertf(lock->state == SX__RWLOCK_WRITER, "RW lock is not write locked");
+    sx_atomic_store32_explicit(&lock->state, 0, SX_ATOMIC_MEMORYORDER_SEQCST);
+
+    // with prefer_writers, readers would only park again while writers are waiting
+    bool writers_waiting =
+        sx_atomic_load32_explicit(&lock->num_waiting_writers, SX_ATOMIC_MEMORYORDER_SEQCST) > 0;
+    if (writers_waiting)
+        sx__rwlock_wake_writer(lock);
+    if (!writers_waiting || !lock->prefer_writers)
+        sx__rwlock_wake_readers(lock);
+}
+
+// Seqlock
+// Writers take the lock by moving `seq` from even to odd with a CAS, and make it even again on
+// exit. Readers copy the data between two loads of `seq` and retry if it was odd or has changed.
+// The fences keep the data accesses inside the seq updates on both sides
+void sx_seqlock_init(sx_seqlock* lock)
+{
+    sx_memset(lock, 0x0, sizeof(sx_seqlock));
+}
+
+uint32_t sx_seqlock_read_begin(sx_seqlock* lock)
+{
+    uint32_t seq;
+    int spin = 0;
+    while ((seq = sx_atomic_load32_explicit(&lock->seq, SX_ATOMIC_MEMORYORDER_ACQUIRE)) & 1) {
+        if (++spin < SX__LOCK_SPIN_COUNT) {
+            sx_relax_cpu();
+        } else {
+            sx_thread_yield();
+            spin = 0;
+        }
+    }
+    return seq;
+}
+
+bool sx_seqlock_read_retry(sx_seqlock* lock, uint32_t seq)
+{
+    sx_atomic_thread_fence(SX_ATOMIC_MEMORYORDER_ACQUIRE);
+    return sx_atomic_load32_explicit(&lock->seq, SX_ATOMIC_MEMORYORDER_RELAXED) != seq;
+}
+
+void sx_seqlock_read(sx_seqlock* lock, void* dst, const void* src, size_t size)
+{
+    uint32_t seq;
+    do {
+        seq = sx_seqlock_read_begin(lock);
+        sx_memcpy(dst, src, size);
+    } while (sx_seqlock_read_retry(lock, seq));
+}
+
+bool sx_seqlock_read_try(sx_seqlock* lock, void* dst, const void* src, size_t size)
+{
+    uint32_t seq = sx_atomic_load32_explicit(&lock->seq, SX_ATOMIC_MEMORYORDER_ACQUIRE);
+    if (seq & 1)
+        return false;
+    sx_memcpy(dst, src, size);
+    return !sx_seqlock_read_retry(lock, seq);
+}
+
+bool sx_seqlock_write_try(sx_seqlock* lock)
+{
+    uint32_t seq = sx_atomic_load32_explicit(&lock->seq, SX_ATOMIC_MEMORYORDER_SEQCST);
+    if (!(seq & 1) && sx_atomic_compare_exchange32_strong_explicit(&lock->seq, &seq, seq + 1,
+                                                                   SX_ATOMIC_MEMORYORDER_ACQUIRE,
+                                                                   SX_ATOMIC_MEMORYORDER_RELAXED)) {
+        sx_atomic_thread_fence(SX_ATOMIC_MEMORYORDER_RELEASE);
+        return true;
+    }
+    return false;
+}
+
+bool sx_seqlock_write_enter_timed(sx_seqlock* lock, int msecs)
+{
+    for (int i = 0; i < SX__LOCK_SPIN_COUNT; i++) {
+        if (sx_seqlock_write_try(lock))
+            return true;
+        sx_relax_cpu();
+    }
+
+    uint64_t deadline = msecs >= 0 ? (sx__thread_now_ms() + (uint64_t)msecs) : 0;
+    bool locked = false;
+    sx_atomic_fetch_add32_explicit(&lock->num_waiting_writers, 1, SX_ATOMIC_MEMORYORDER_SEQCST);
+    while (1) {
+        uint32_t seq = sx_atomic_load32_explicit(&lock->seq, SX_ATOMIC_MEMORYORDER_SEQCST);
+        if (!(seq & 1) && (locked = sx_seqlock_write_try(lock)) != false)
+            break;
+        int remaining = sx__thread_remaining_ms(deadline, msecs);
+        if (remaining == 0)
+            break;
+        if (seq & 1)
+            sx_futex_wait(&lock->seq, seq, remaining);
+    }
+    sx_atomic_fetch_sub32_explicit(&lock->num_waiting_writers, 1, SX_ATOMIC_MEMORYORDER_SEQCST);
+    return locked;
+}
+
+void sx_seqlock_write_enter(sx_seqlock* lock)
+{
+    if (!sx_seqlock_write_try(lock))
+        sx_seqlock_write_enter_timed(lock, -1);
+}
+
+void sx_seqlock_write_exit(sx_seqlock* lock)
+{
+    uint32_t seq = sx_atomic_load32_explicit(&lock->seq, SX_ATOMIC_MEMORYORDER_RELAXED);
+    sx_assertf(seq & 1, "seqlock is not write locked");
+    sx_atomic_store32_explicit(&lock->seq, seq + 1, SX_ATOMIC_MEMORYORDER_SEQCST);
+    if (sx_atomic_load32_explicit(&lock->num_waiting_writers, SX_ATOMIC_MEMORYORDER_SEQCST) > 0)
+        sx_futex_wake(&lock->seq, false);
+}
+
+void sx_seqlock_write(sx_seqlock* lock, void* dst, const void* src, size_t size)
+{
+    sx_seqlock_write_enter(lock);
+    sx_memcpy(dst, src, size);
+    sx_seqlock_write_exit(lock);
+}
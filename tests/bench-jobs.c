@@ -0,0 +1,340 @@
+#include "sx/allocator.h"
+#include "sx/atomic.h"
+#include "sx/jobs.h"
+#include "sx/timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+// Benchmark suite of the job system, runs every benchmark with 1..N cores (worker threads + main)
+// and reports the distribution of the samples (mean, p50, p99, p999, max) in microseconds:
+//      latency             dispatch of a single empty job, until it starts running
+//      fork_join           dispatch one empty job per core (x4) and wait for all of them
+//      fork_join_inline    same as fork_join, with SX_JOB_FLAG_INLINE jobs
+//      nested_wait         chain of NESTED_DEPTH jobs, each one dispatches the next and waits
+//      skewed_dispatch     work set with uneven costs, divided into one range per core
+//      skewed_parallel_for same work set with sx_job_parallel_for
+//      producers           every core dispatches empty jobs at the same time, time of each
+//                          sx_job_dispatch call
+//      systems_dispatch    NUM_SYSTEMS different small jobs per frame, one dispatch for each
+//      systems_batch       same frame with a single sx_job_dispatch_batch
+// usage: bench-jobs [-c max_cores] [-n num_samples] [-b benchmark] [-f table|csv|json]
+// (see bench.h)
+
+#define FORK_JOIN_JOBS_PER_CORE 4
+#define NESTED_DEPTH 16
+#define SKEWED_COUNT 4096
+#define SKEWED_GRAIN 8
+#define NUM_SYSTEMS 200
+#define PRODUCER_BATCH 16
+
+typedef struct bench_context {
+    sx_job_context* ctx;
+    int cores;
+    int num_samples;    // number of samples that are left to take
+} bench_context;
+
+// takes one or more samples (sx_tm_now ticks), returns the number of samples
+typedef int(bench_fn)(bench_context* bench, uint64_t* samples);
+
+typedef struct bench_desc {
+    const char* name;
+    bench_fn* fn;
+    int sample_div;    // heavy benchmarks take fewer samples: num_samples / sample_div
+} bench_desc;
+
+static sx_job_context* g_ctx;
+static int g_producer_samples;
+
+static void empty_job_fn(int range_start, int range_end, int thread_index, void* user)
+{
+    sx_unused(range_start);
+    sx_unused(range_end);
+    sx_unused(thread_index);
+    sx_unused(user);
+}
+
+static void start_tm_job_fn(int range_start, int range_end, int thread_index, void* user)
+{
+    sx_unused(range_start);
+    sx_unused(range_end);
+    sx_unused(thread_index);
+    *((uint64_t*)user) = sx_tm_now();
+}
+
+static void nested_job_fn(int range_start, int range_end, int thread_index, void* user)
+{
+    sx_unused(range_start);
+    sx_unused(range_end);
+    sx_unused(thread_index);
+    int depth = (int)(intptr_t)user;
+    if (depth > 1) {
+        sx_job_wait_and_del(g_ctx, sx_job_dispatch(g_ctx, 1, nested_job_fn,
+                                                   (void*)(intptr_t)(depth - 1),
+                                                   SX_JOB_PRIORITY_NORMAL, 0));
+    }
+}
+
+// first 1/8 of the items are 64x more expensive than the rest
+static void skewed_job_fn(int range_start, int range_end, int thread_index, void* user)
+{
+    sx_unused(thread_index);
+    sx_unused(user);
+    for (int i = range_start; i < range_end; i++) {
+        int cost = i < SKEWED_COUNT / 8 ? 64 : 1;
+        volatile uint32_t h = (uint32_t)i;
+        for (int k = 0; k < cost * 64; k++)
+            h = h * 0x9E3779B1u + 1;
+    }
+}
+
+static void system_job_fn(int range_start, int range_end, int thread_index, void* user)
+{
+    sx_unused(thread_index);
+    volatile uint32_t h = (uint32_t)(uintptr_t)user;
+    for (int i = range_start; i < range_end; i++)
+        h = h * 0x9E3779B1u + 1;
+}
+
+// every producer takes g_producer_samples samples, dispatching and waiting in batches
+static void producer_job_fn(int range_start, int range_end, int thread_index, void* user)
+{
+    sx_unused(thread_index);
+    uint64_t* samples = user;
+    sx_job_t jobs[PRODUCER_BATCH];
+    for (int p = range_start; p < range_end; p++) {
+        uint64_t* psamples = samples + p * g_producer_samples;
+        for (int i = 0; i < g_producer_samples; i += PRODUCER_BATCH) {
+            int count = sx_min(PRODUCER_BATCH, g_producer_samples - i);
+            for (int k = 0; k < count; k++) {
+                uint64_t start_tm = sx_tm_now();
+                jobs[k] = sx_job_dispatch(g_ctx, 1, empty_job_fn, NULL, SX_JOB_PRIORITY_NORMAL, 0);
+                psamples[i + k] = sx_tm_since(start_tm);
+            }
+            for (int k = 0; k < count; k++)
+                sx_job_wait_and_del(g_ctx, jobs[k]);
+        }
+    }
+}
+
+static int bench_latency(bench_context* bench, uint64_t* samples)
+{
+    uint64_t job_tm = 0;
+    uint64_t start_tm = sx_tm_now();
+    sx_job_wait_and_del(bench->ctx, sx_job_dispatch(bench->ctx, 1, start_tm_job_fn, &job_tm,
+                                                    SX_JOB_PRIORITY_NORMAL, 0));
+    samples[0] = sx_tm_diff(job_tm, start_tm);
+    return 1;
+}
+
+static int bench_fork_join_flags(bench_context* bench, uint64_t* samples, sx_job_flags flags)
+{
+    sx_job_desc desc = { .count = bench->cores * FORK_JOIN_JOBS_PER_CORE,
+                         .callback = empty_job_fn,
+                         .priority = SX_JOB_PRIORITY_NORMAL,
+                         .flags = flags };
+    uint64_t start_tm = sx_tm_now();
+    sx_job_wait_and_del(bench->ctx, sx_job_dispatch_desc(bench->ctx, &desc));
+    samples[0] = sx_tm_since(start_tm);
+    return 1;
+}
+
+static int bench_fork_join(bench_context* bench, uint64_t* samples)
+{
+    return bench_fork_join_flags(bench, samples, 0);
+}
+
+static int bench_fork_join_inline(bench_context* bench, uint64_t* samples)
+{
+    return bench_fork_join_flags(bench, samples, SX_JOB_FLAG_INLINE);
+}
+
+static int bench_nested_wait(bench_context* bench, uint64_t* samples)
+{
+    uint64_t start_tm = sx_tm_now();
+    sx_job_wait_and_del(bench->ctx, sx_job_dispatch(bench->ctx, 1, nested_job_fn,
+                                                    (void*)(intptr_t)NESTED_DEPTH,
+                                                    SX_JOB_PRIORITY_NORMAL, 0));
+    samples[0] = sx_tm_since(start_tm);
+    return 1;
+}
+
+static int bench_skewed(bench_context* bench, uint64_t* samples, bool parallel_for)
+{
+    sx_job_desc desc = { .count = SKEWED_COUNT,
+                         .callback = skewed_job_fn,
+                         .priority = SX_JOB_PRIORITY_NORMAL,
+                         .flags = SX_JOB_FLAG_INLINE };
+    uint64_t start_tm = sx_tm_now();
+    sx_job_t job = parallel_for ? sx_job_parallel_for(bench->ctx, &desc, SKEWED_GRAIN)
+                                : sx_job_dispatch_desc(bench->ctx, &desc);
+    sx_job_wait_and_del(bench->ctx, job);
+    samples[0] = sx_tm_since(start_tm);
+    return 1;
+}
+
+static int bench_skewed_dispatch(bench_context* bench, uint64_t* samples)
+{
+    return bench_skewed(bench, samples, false);
+}
+
+static int bench_skewed_parallel_for(bench_context* bench, uint64_t* samples)
+{
+    return bench_skewed(bench, samples, true);
+}
+
+// every core is a producer, takes all the samples that are left in one run
+static int bench_producers(bench_context* bench, uint64_t* samples)
+{
+    int num_producers = sx_min(bench->cores, bench->num_samples);
+    g_producer_samples = bench->num_samples / num_producers;
+    sx_job_wait_and_del(bench->ctx, sx_job_dispatch(bench->ctx, num_producers, producer_job_fn,
+                                                    samples, SX_JOB_PRIORITY_HIGH, 0));
+    return g_producer_samples * num_producers;
+}
+
+static int bench_systems(bench_context* bench, uint64_t* samples, bool batch)
+{
+    sx_job_desc descs[NUM_SYSTEMS];
+    for (int i = 0; i < NUM_SYSTEMS; i++) {
+        descs[i] = (sx_job_desc){ .count = 1,
+                                  .callback = system_job_fn,
+                                  .user = (void*)(uintptr_t)i,
+                                  .priority = SX_JOB_PRIORITY_NORMAL,
+                                  .flags = SX_JOB_FLAG_INLINE };
+    }
+
+    uint64_t start_tm = sx_tm_now();
+    if (batch) {
+        sx_job_wait_and_del(bench->ctx, sx_job_dispatch_batch(bench->ctx, descs, NUM_SYSTEMS));
+    } else {
+        sx_job_t jobs[NUM_SYSTEMS];
+        for (int i = 0; i < NUM_SYSTEMS; i++)
+            jobs[i] = sx_job_dispatch_desc(bench->ctx, &descs[i]);
+        for (int i = 0; i < NUM_SYSTEMS; i++)
+            sx_job_wait_and_del(bench->ctx, jobs[i]);
+    }
+    samples[0] = sx_tm_since(start_tm);
+    return 1;
+}
+
+static int bench_systems_dispatch(bench_context* bench, uint64_t* samples)
+{
+    return bench_systems(bench, samples, false);
+}
+
+static int bench_systems_batch(bench_context* bench, uint64_t* samples)
+{
+    return bench_systems(bench, samples, true);
+}
+
+static const bench_desc k_benchmarks[] = {
+    { "latency", bench_latency, 1 },
+    { "fork_join", bench_fork_join, 1 },
+    { "fork_join_inline", bench_fork_join_inline, 1 },
+    { "nested_wait", bench_nested_wait, 4 },
+    { "skewed_dispatch", bench_skewed_dispatch, 40 },
+    { "skewed_parallel_for", bench_skewed_parallel_for, 40 },
+    { "producers", bench_producers, 1 },
+    { "systems_dispatch", bench_systems_dispatch, 10 },
+    { "systems_batch", bench_systems_batch, 10 },
+};
+#define NUM_BENCHMARKS (int)(sizeof(k_benchmarks) / sizeof(bench_desc))
+
+static const bench_column k_columns[] = {
+    { "cores", "cores", BENCH_COLUMN_INT, 5 },
+    { "samples", "samples", BENCH_COLUMN_INT, 8 },
+    { "mean(us)", "mean_us", BENCH_COLUMN_FLOAT, 10 },
+    { "p50(us)", "p50_us", BENCH_COLUMN_FLOAT, 10 },
+    { "p99(us)", "p99_us", BENCH_COLUMN_FLOAT, 10 },
+    { "p999(us)", "p999_us", BENCH_COLUMN_FLOAT, 10 },
+    { "max(us)", "max_us", BENCH_COLUMN_FLOAT, 10 },
+};
+
+static int compare_ticks(const void* a, const void* b)
+{
+    uint64_t ta = *((const uint64_t*)a);
+    uint64_t tb = *((const uint64_t*)b);
+    return ta < tb ? -1 : (ta > tb ? 1 : 0);
+}
+
+// nearest-rank percentile of the sorted samples
+static double percentile_us(const uint64_t* samples, int count, double p)
+{
+    int index = (int)(p * (double)count + 0.999999) - 1;
+    return sx_tm_us(samples[sx_clamp(index, 0, count - 1)]);
+}
+
+static bool run_benchmark(int index, int cores, int num_samples, bench_value* values)
+{
+    const bench_desc* desc = &k_benchmarks[index];
+    const sx_alloc* alloc = sx_alloc_malloc();
+    sx_job_context* ctx = sx_job_create_context(
+        alloc, &(sx_job_context_desc){ .num_threads = cores - 1,
+                                       .max_fibers = 1024,
+                                       .max_handles = 4096 });
+    if (!ctx) {
+        puts("Error: sx_job_create_context failed!");
+        exit(-1);
+    }
+    g_ctx = ctx;
+
+    num_samples = sx_max(num_samples / desc->sample_div, cores);
+    uint64_t* samples = sx_malloc(alloc, sizeof(uint64_t) * (size_t)num_samples);
+    sx_assert_always(samples);
+    bench_context bench = { .ctx = ctx, .cores = cores };
+
+    // warm up: fills the job pool and stack caches, and wakes up the workers
+    bench.num_samples = sx_max(num_samples / 10, 1);
+    while (bench.num_samples > 0)
+        bench.num_samples -= desc->fn(&bench, samples);
+
+    int count = 0;
+    while (count < num_samples) {
+        bench.num_samples = num_samples - count;
+        count += desc->fn(&bench, samples + count);
+    }
+
+    sx_job_destroy_context(ctx, alloc);
+
+    qsort(samples, (size_t)count, sizeof(uint64_t), compare_ticks);
+    uint64_t total = 0;
+    for (int i = 0; i < count; i++)
+        total += samples[i];
+
+    values[0].i = cores;
+    values[1].i = count;
+    values[2].f = sx_tm_us(total) / (double)count;
+    values[3].f = percentile_us(samples, count, 0.5);
+    values[4].f = percentile_us(samples, count, 0.99);
+    values[5].f = percentile_us(samples, count, 0.999);
+    values[6].f = sx_tm_us(samples[count - 1]);
+    sx_free(alloc, samples);
+    return true;
+}
+
+static const char* benchmark_name(int index)
+{
+    return k_benchmarks[index].name;
+}
+
+static const bench_suite k_suite = {
+    .name = benchmark_name,
+    .run = run_benchmark,
+    .num_benchmarks = NUM_BENCHMARKS,
+    .columns = k_columns,
+    .num_columns = (int)(sizeof(k_columns) / sizeof(bench_column)),
+    .threads_opt = 'c',
+    .threads_name = "cores",
+    .threads_help = "maximum number of cores (default: all)",
+    .count_name = "samples",
+    .count_help = "number of samples for each benchmark (default: 2000)",
+    .default_count = 2000,
+};
+
+int main(int argc, char* argv[])
+{
+    return bench_main(argc, argv, &k_suite);
+}
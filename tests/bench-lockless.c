@@ -0,0 +1,473 @@
+#include "sx/allocator.h"
+#include "sx/atomic.h"
+#include "sx/lockless.h"
+#include "sx/pool.h"
+#include "sx/string.h"
+#include "sx/threads.h"
+#include "sx/timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+// Benchmark suite of lockless.h containers against their sx_lock_t + array counterparts
+// Runs every benchmark with 1..N producer threads and as many consumers (one consumer for the
+// single-consumer queues) and reports the throughput in millions of items per second:
+//      spsc                sx_queue_spsc, single producer and consumer only
+//      spsc_reserve        sx_queue_spsc, items are written/read in place with reserve/peek
+//      spsc_locked         sx_queue_spsc, producers are serialized with sx_lock_t
+//      mpsc                sx_queue_mpsc, items are sx_pool objects
+//      mpsc_batch          sx_queue_mpsc, consumer drains BATCH_SIZE items at a time
+//      mpmc                sx_queue_mpmc, one item at a time
+//      mpmc_batch          sx_queue_mpmc, BATCH_SIZE items with each produce/consume
+//      locked              ring buffer guarded by sx_lock_t, one item at a time
+//      locked_batch        ring buffer guarded by sx_lock_t, BATCH_SIZE items with each lock
+// usage: bench-lockless [-t max_threads] [-n num_items] [-b benchmark] [-f table|csv|json]
+// (see bench.h)
+
+#define QUEUE_CAPACITY 1024
+#define BATCH_SIZE 32
+#define SPIN_COUNT 64    // failed attempts before we yield the thread
+
+typedef struct bench_context bench_context;
+
+// queue interface that benchmarks run on, functions return the number of produced/consumed items
+typedef struct bench_queue_api {
+    void* (*create)(const sx_alloc* alloc, const bench_context* bench);
+    void (*destroy)(void* queue, const sx_alloc* alloc);
+    int (*produce)(void* queue, const uint64_t* items, int count);
+    int (*consume)(void* queue, uint64_t* items, int max_count);
+} bench_queue_api;
+
+typedef struct bench_desc {
+    const char* name;
+    const bench_queue_api* api;
+    int batch_size;
+    int max_threads;      // 0: no limit
+    int num_consumers;    // 0: same as producers
+} bench_desc;
+
+struct bench_context {
+    const bench_desc* desc;
+    void* queue;
+    int items_per_producer;
+    int total_items;
+    sx_atomic_uint32 start;
+    sx_atomic_uint32 num_consumed;
+    sx_atomic_uint64 produced_sum;
+    sx_atomic_uint64 consumed_sum;
+};
+
+//
+// sx_queue_mpmc
+static void* mpmc_create(const sx_alloc* alloc, const bench_context* bench)
+{
+    sx_unused(bench);
+    return sx_queue_mpmc_create(alloc, sizeof(uint64_t), QUEUE_CAPACITY);
+}
+
+static void mpmc_destroy(void* queue, const sx_alloc* alloc)
+{
+    sx_queue_mpmc_destroy(queue, alloc);
+}
+
+static int mpmc_produce(void* queue, const uint64_t* items, int count)
+{
+    return count == 1 ? (int)sx_queue_mpmc_produce(queue, items)
+                      : sx_queue_mpmc_produce_batch(queue, items, count);
+}
+
+static int mpmc_consume(void* queue, uint64_t* items, int max_count)
+{
+    return max_count == 1 ? (int)sx_queue_mpmc_consume(queue, items)
+                          : sx_queue_mpmc_consume_batch(queue, items, max_count);
+}
+
+static const bench_queue_api k_mpmc_api = { mpmc_create, mpmc_destroy, mpmc_produce,
+                                            mpmc_consume };
+
+//
+// sx_lock_t + ring buffer
+typedef struct locked_queue {
+    sx_lock_t lock;
+    uint64_t* items;
+    int capacity;
+    int head;
+    int count;
+} locked_queue;
+
+static void* locked_create(const sx_alloc* alloc, const bench_context* bench)
+{
+    sx_unused(bench);
+    const int capacity = QUEUE_CAPACITY;
+    locked_queue* queue = sx_aligned_malloc(alloc, sizeof(locked_queue), SX_CACHE_LINE_SIZE);
+    sx_assert_always(queue);
+    sx_memset(queue, 0x0, sizeof(locked_queue));
+    queue->items = sx_malloc(alloc, sizeof(uint64_t) * (size_t)capacity);
+    sx_assert_always(queue->items);
+    queue->capacity = capacity;
+    return queue;
+}
+
+static void locked_destroy(void* _queue, const sx_alloc* alloc)
+{
+    locked_queue* queue = _queue;
+    sx_free(alloc, queue->items);
+    sx_aligned_free(alloc, queue, SX_CACHE_LINE_SIZE);
+}
+
+static int locked_produce(void* _queue, const uint64_t* items, int count)
+{
+    locked_queue* queue = _queue;
+    int n = 0;
+    sx_lock(queue->lock) {
+        n = sx_min(count, queue->capacity - queue->count);
+        for (int i = 0; i < n; i++)
+            queue->items[(queue->head + queue->count + i) % queue->capacity] = items[i];
+        queue->count += n;
+    }
+    return n;
+}
+
+static int locked_consume(void* _queue, uint64_t* items, int max_count)
+{
+    locked_queue* queue = _queue;
+    int n = 0;
+    sx_lock(queue->lock) {
+        n = sx_min(max_count, queue->count);
+        for (int i = 0; i < n; i++)
+            items[i] = queue->items[(queue->head + i) % queue->capacity];
+        queue->head = (queue->head + n) % queue->capacity;
+        queue->count -= n;
+    }
+    return n;
+}
+
+static const bench_queue_api k_locked_api = { locked_create, locked_destroy, locked_produce,
+                                              locked_consume };
+
+//
+// sx_queue_spsc
+static void* spsc_create(const sx_alloc* alloc, const bench_context* bench)
+{
+    sx_unused(bench);
+    return sx_queue_spsc_create(alloc, sizeof(uint64_t), QUEUE_CAPACITY);
+}
+
+static void spsc_destroy(void* queue, const sx_alloc* alloc)
+{
+    sx_queue_spsc_destroy(queue, alloc);
+}
+
+static int spsc_produce(void* queue, const uint64_t* items, int count)
+{
+    sx_unused(count);
+    return (int)sx_queue_spsc_produce(queue, items);
+}
+
+static int spsc_consume(void* queue, uint64_t* items, int max_count)
+{
+    sx_unused(max_count);
+    return (int)sx_queue_spsc_consume(queue, items);
+}
+
+static const bench_queue_api k_spsc_api = { spsc_create, spsc_destroy, spsc_produce,
+                                            spsc_consume };
+
+static int spsc_produce_reserve(void* queue, const uint64_t* items, int count)
+{
+    sx_unused(count);
+    uint64_t* item = sx_queue_spsc_produce_reserve(queue);
+    if (item) {
+        *item = items[0];
+        sx_queue_spsc_produce_commit(queue);
+        return 1;
+    }
+    return 0;
+}
+
+static int spsc_consume_peek(void* queue, uint64_t* items, int max_count)
+{
+    sx_unused(max_count);
+    const uint64_t* item = sx_queue_spsc_consume_peek(queue);
+    if (item) {
+        items[0] = *item;
+        sx_queue_spsc_consume_commit(queue);
+        return 1;
+    }
+    return 0;
+}
+
+static const bench_queue_api k_spsc_reserve_api = { spsc_create, spsc_destroy,
+                                                    spsc_produce_reserve, spsc_consume_peek };
+
+//
+// sx_queue_spsc + sx_lock_t on producers side, the way we used to funnel events to one thread
+typedef struct spsc_locked_queue {
+    sx_lock_t lock;
+    sx_queue_spsc* queue;
+} spsc_locked_queue;
+
+static void* spsc_locked_create(const sx_alloc* alloc, const bench_context* bench)
+{
+    spsc_locked_queue* queue =
+        sx_aligned_malloc(alloc, sizeof(spsc_locked_queue), SX_CACHE_LINE_SIZE);
+    sx_assert_always(queue);
+    sx_memset(queue, 0x0, sizeof(spsc_locked_queue));
+    queue->queue = spsc_create(alloc, bench);
+    return queue;
+}
+
+static void spsc_locked_destroy(void* _queue, const sx_alloc* alloc)
+{
+    spsc_locked_queue* queue = _queue;
+    sx_queue_spsc_destroy(queue->queue, alloc);
+    sx_aligned_free(alloc, queue, SX_CACHE_LINE_SIZE);
+}
+
+static int spsc_locked_produce(void* _queue, const uint64_t* items, int count)
+{
+    sx_unused(count);
+    spsc_locked_queue* queue = _queue;
+    bool produced = false;
+    sx_lock(queue->lock) {
+        produced = sx_queue_spsc_produce(queue->queue, items);
+    }
+    return (int)produced;
+}
+
+static int spsc_locked_consume(void* _queue, uint64_t* items, int max_count)
+{
+    sx_unused(max_count);
+    spsc_locked_queue* queue = _queue;
+    return (int)sx_queue_spsc_consume(queue->queue, items);
+}
+
+static const bench_queue_api k_spsc_locked_api = { spsc_locked_create, spsc_locked_destroy,
+                                                   spsc_locked_produce, spsc_locked_consume };
+
+//
+// sx_queue_mpsc
+// all items are fetched from the pool before the run, so producers index them by their value
+typedef struct mpsc_item {
+    sx_queue_mpsc_node node;
+    uint64_t value;
+} mpsc_item;
+
+typedef struct mpsc_queue {
+    sx_queue_mpsc* queue;
+    sx_pool* pool;
+    mpsc_item** items;
+    int items_per_producer;
+} mpsc_queue;
+
+static void* mpsc_create(const sx_alloc* alloc, const bench_context* bench)
+{
+    mpsc_queue* queue = sx_malloc(alloc, sizeof(mpsc_queue));
+    sx_assert_always(queue);
+    queue->queue = sx_queue_mpsc_create(alloc);
+    queue->pool = sx_pool_create(alloc, sizeof(mpsc_item), bench->total_items);
+    queue->items = sx_malloc(alloc, sizeof(mpsc_item*) * (size_t)bench->total_items);
+    sx_assert_always(queue->queue && queue->pool && queue->items);
+    queue->items_per_producer = bench->items_per_producer;
+    for (int i = 0; i < bench->total_items; i++)
+        queue->items[i] = sx_pool_new(queue->pool);
+    return queue;
+}
+
+static void mpsc_destroy(void* _queue, const sx_alloc* alloc)
+{
+    mpsc_queue* queue = _queue;
+    sx_free(alloc, queue->items);
+    sx_pool_destroy(queue->pool, alloc);
+    sx_queue_mpsc_destroy(queue->queue, alloc);
+    sx_free(alloc, queue);
+}
+
+static int mpsc_produce(void* _queue, const uint64_t* items, int count)
+{
+    mpsc_queue* queue = _queue;
+    for (int i = 0; i < count; i++) {
+        int index = (int)(items[i] >> 32) * queue->items_per_producer + (int)(items[i] & 0xffffffff);
+        mpsc_item* item = queue->items[index];
+        item->value = items[i];
+        sx_queue_mpsc_produce(queue->queue, &item->node);
+    }
+    return count;
+}
+
+static int mpsc_consume(void* _queue, uint64_t* items, int max_count)
+{
+    mpsc_queue* queue = _queue;
+    sx_queue_mpsc_node* nodes[BATCH_SIZE];
+    int n = max_count == 1 ? (int)((nodes[0] = sx_queue_mpsc_consume(queue->queue)) != NULL)
+                           : sx_queue_mpsc_consume_batch(queue->queue, nodes, max_count);
+    for (int i = 0; i < n; i++)
+        items[i] = ((mpsc_item*)nodes[i])->value;
+    return n;
+}
+
+static const bench_queue_api k_mpsc_api = { mpsc_create, mpsc_destroy, mpsc_produce,
+                                            mpsc_consume };
+
+static const bench_desc k_benchmarks[] = {
+    { "spsc", &k_spsc_api, 1, 1, 1 },
+    { "spsc_reserve", &k_spsc_reserve_api, 1, 1, 1 },
+    { "spsc_locked", &k_spsc_locked_api, 1, 0, 1 },
+    { "mpsc", &k_mpsc_api, 1, 0, 1 },
+    { "mpsc_batch", &k_mpsc_api, BATCH_SIZE, 0, 1 },
+    { "mpmc", &k_mpmc_api, 1, 0, 0 },
+    { "mpmc_batch", &k_mpmc_api, BATCH_SIZE, 0, 0 },
+    { "locked", &k_locked_api, 1, 0, 0 },
+    { "locked_batch", &k_locked_api, BATCH_SIZE, 0, 0 },
+};
+#define NUM_BENCHMARKS (int)(sizeof(k_benchmarks) / sizeof(k_benchmarks[0]))
+
+static const bench_column k_columns[] = {
+    { "threads", "threads", BENCH_COLUMN_INT, 7 },
+    { "items", "items", BENCH_COLUMN_INT, 10 },
+    { "time(ms)", "time_ms", BENCH_COLUMN_FLOAT, 10 },
+    { "mitems/s", "mitems_per_sec", BENCH_COLUMN_FLOAT, 12 },
+    { "valid", "valid", BENCH_COLUMN_BOOL, 6 },
+};
+
+static void backoff(int* num_fails)
+{
+    if (++(*num_fails) < SPIN_COUNT) {
+        sx_relax_cpu();
+    } else {
+        sx_thread_yield();
+        *num_fails = 0;
+    }
+}
+
+static void wait_start(bench_context* bench)
+{
+    while (!sx_atomic_load32_explicit(&bench->start, SX_ATOMIC_MEMORYORDER_ACQUIRE))
+        sx_thread_yield();
+}
+
+static int producer_thread_fn(void* user1, void* user2)
+{
+    bench_context* bench = user1;
+    uint64_t producer_id = (uint64_t)(uintptr_t)user2;
+    const bench_desc* desc = bench->desc;
+    uint64_t items[BATCH_SIZE];
+    uint64_t sum = 0;
+    wait_start(bench);
+
+    int num_fails = 0;
+    for (int i = 0; i < bench->items_per_producer;) {
+        int count = sx_min(desc->batch_size, bench->items_per_producer - i);
+        for (int k = 0; k < count; k++)
+            items[k] = (producer_id << 32) | (uint64_t)(i + k);
+
+        int n = desc->api->produce(bench->queue, items, count);
+        if (n > 0) {
+            for (int k = 0; k < n; k++)
+                sum += items[k];
+            i += n;
+        } else {
+            backoff(&num_fails);
+        }
+    }
+
+    sx_atomic_fetch_add64(&bench->produced_sum, sum);
+    return 0;
+}
+
+static int consumer_thread_fn(void* user1, void* user2)
+{
+    sx_unused(user2);
+    bench_context* bench = user1;
+    const bench_desc* desc = bench->desc;
+    uint64_t items[BATCH_SIZE];
+    uint64_t sum = 0;
+    wait_start(bench);
+
+    int num_fails = 0;
+    while (sx_atomic_load32_explicit(&bench->num_consumed, SX_ATOMIC_MEMORYORDER_RELAXED) <
+           (uint32_t)bench->total_items) {
+        int n = desc->api->consume(bench->queue, items, desc->batch_size);
+        if (n > 0) {
+            for (int k = 0; k < n; k++)
+                sum += items[k];
+            sx_atomic_fetch_add32(&bench->num_consumed, (uint32_t)n);
+        } else {
+            backoff(&num_fails);
+        }
+    }
+
+    sx_atomic_fetch_add64(&bench->consumed_sum, sum);
+    return 0;
+}
+
+static bool run_benchmark(int index, int threads, int num_items, bench_value* values)
+{
+    const bench_desc* desc = &k_benchmarks[index];
+    const sx_alloc* alloc = sx_alloc_malloc();
+    bench_context bench = { .desc = desc, .items_per_producer = sx_max(num_items / threads, 1) };
+    bench.total_items = bench.items_per_producer * threads;
+    bench.queue = desc->api->create(alloc, &bench);
+
+    int num_consumers = desc->num_consumers > 0 ? desc->num_consumers : threads;
+    int num_thrds = threads + num_consumers;
+    sx_thread** thrds = sx_malloc(alloc, sizeof(sx_thread*) * (size_t)num_thrds);
+    sx_assert_always(thrds);
+    for (int i = 0; i < num_thrds; i++) {
+        thrds[i] = i < threads ? sx_thread_create(alloc, producer_thread_fn, &bench, 0,
+                                                  "producer", (void*)(uintptr_t)i)
+                               : sx_thread_create(alloc, consumer_thread_fn, &bench, 0,
+                                                  "consumer", NULL);
+    }
+
+    uint64_t start_tm = sx_tm_now();
+    sx_atomic_store32_explicit(&bench.start, 1, SX_ATOMIC_MEMORYORDER_RELEASE);
+    for (int i = 0; i < num_thrds; i++)
+        sx_thread_destroy(thrds[i], alloc);
+    double ms = sx_tm_ms(sx_tm_since(start_tm));
+
+    sx_free(alloc, thrds);
+    desc->api->destroy(bench.queue, alloc);
+
+    bool valid = bench.produced_sum == bench.consumed_sum &&
+                 bench.num_consumed == (uint32_t)bench.total_items;
+    values[0].i = threads;
+    values[1].i = bench.total_items;
+    values[2].f = ms;
+    values[3].f = (double)bench.total_items / (ms * 1000.0);
+    values[4].b = valid;
+    return valid;
+}
+
+static const char* benchmark_name(int index)
+{
+    return k_benchmarks[index].name;
+}
+
+static int benchmark_max_threads(int index, int max_threads)
+{
+    int limit = k_benchmarks[index].max_threads;
+    return limit > 0 ? sx_min(limit, max_threads) : max_threads;
+}
+
+static const bench_suite k_suite = {
+    .name = benchmark_name,
+    .run = run_benchmark,
+    .max_threads = benchmark_max_threads,
+    .num_benchmarks = NUM_BENCHMARKS,
+    .columns = k_columns,
+    .num_columns = (int)(sizeof(k_columns) / sizeof(bench_column)),
+    .threads_opt = 't',
+    .threads_name = "threads",
+    .threads_help = "maximum number of threads on each side (default: num cores)",
+    .count_name = "items",
+    .count_help = "number of items for each benchmark (default: 1000000)",
+    .default_count = 1000000,
+};
+
+int main(int argc, char* argv[])
+{
+    return bench_main(argc, argv, &k_suite);
+}
@@ -0,0 +1,365 @@
+#include "sx/allocator.h"
+#include "sx/atomic.h"
+#include "sx/lockless.h"
+#include "sx/string.h"
+#include "sx/threads.h"
+#include "sx/timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+// Benchmark suite of locks, runs every benchmark with 1..N threads that all hammer the same lock
+// with a short critical section and a bit of work outside of it. Writers increment all of the
+// shared data and readers copy it and check that it's consistent. Reports the throughput in
+// millions of lock operations per second:
+//      spinlock            sx_lock_t, writes only
+//      adaptive            sx_lock_adaptive_t, writes only. Also prints contention stats when the
+//                          library is built with SX_CONFIG_LOCK_STATS=1
+//      mutex               sx_mutex, writes only
+//      mutex_90r           sx_mutex, 90% reads and 10% writes
+//      rwlock_90r          sx_rwlock, 90% reads and 10% writes
+//      rwlock_wp_90r       sx_rwlock with prefer_writers, 90% reads and 10% writes
+//      seqlock_90r         sx_seqlock, 90% reads and 10% writes
+// usage: bench-locks [-t max_threads] [-n num_ops] [-b benchmark] [-f table|csv|json]
+// (see bench.h)
+
+#define SHARED_DATA_SIZE 8
+#define WORK_ITERS 64    // work between the lock operations
+
+typedef struct bench_lock_api {
+    void* (*create)(const sx_alloc* alloc);
+    void (*destroy)(void* lock, const sx_alloc* alloc);
+    void (*enter)(void* lock);
+    void (*exit)(void* lock);
+    void (*read)(void* lock, void* dst, const void* src, size_t size);    // NULL: enter/exit
+} bench_lock_api;
+
+typedef struct bench_desc {
+    const char* name;
+    const bench_lock_api* api;
+    int read_pct;
+} bench_desc;
+
+typedef struct bench_context {
+    const bench_desc* desc;
+    void* lock;
+    int ops_per_thread;
+    sx_atomic_uint32 start;
+    sx_atomic_uint32 num_inconsistent_reads;
+    uint64_t data[SHARED_DATA_SIZE];    // guarded by lock
+} bench_context;
+
+//
+// sx_lock_t
+static void* spinlock_create(const sx_alloc* alloc)
+{
+    sx_lock_t* lock = sx_aligned_malloc(alloc, sizeof(sx_lock_t), SX_CACHE_LINE_SIZE);
+    sx_assert_always(lock);
+    *lock = 0;
+    return lock;
+}
+
+static void spinlock_destroy(void* lock, const sx_alloc* alloc)
+{
+    sx_aligned_free(alloc, lock, SX_CACHE_LINE_SIZE);
+}
+
+static void spinlock_enter(void* lock)
+{
+    sx_lock_enter(lock);
+}
+
+static void spinlock_exit(void* lock)
+{
+    sx_lock_exit(lock);
+}
+
+static const bench_lock_api k_spinlock_api = { spinlock_create, spinlock_destroy, spinlock_enter,
+                                               spinlock_exit, NULL };
+
+//
+// sx_lock_adaptive_t
+static void* adaptive_create(const sx_alloc* alloc)
+{
+    sx_lock_adaptive_t* lock =
+        sx_aligned_malloc(alloc, sizeof(sx_lock_adaptive_t), SX_CACHE_LINE_SIZE);
+    sx_assert_always(lock);
+    sx_memset(lock, 0x0, sizeof(sx_lock_adaptive_t));
+    return lock;
+}
+
+static void adaptive_destroy(void* lock, const sx_alloc* alloc)
+{
+    sx_lock_stats stats;
+    if (sx_lock_adaptive_stats(lock, &stats)) {
+        fprintf(stderr,
+                "  adaptive stats: acquires=%llu contended=%llu spins=%llu parks=%llu "
+                "max_wait=%.3f ms\n",
+                (unsigned long long)stats.num_acquires, (unsigned long long)stats.num_contended,
+                (unsigned long long)stats.num_spins, (unsigned long long)stats.num_parks,
+                (double)stats.max_wait / 1000000.0);
+    }
+    sx_aligned_free(alloc, lock, SX_CACHE_LINE_SIZE);
+}
+
+static void adaptive_enter(void* lock)
+{
+    sx_lock_adaptive_enter(lock);
+}
+
+static void adaptive_exit(void* lock)
+{
+    sx_lock_adaptive_exit(lock);
+}
+
+static const bench_lock_api k_adaptive_api = { adaptive_create, adaptive_destroy, adaptive_enter,
+                                               adaptive_exit, NULL };
+
+//
+// sx_mutex
+static void* mutex_create(const sx_alloc* alloc)
+{
+    sx_mutex* mutex = sx_aligned_malloc(alloc, sizeof(sx_mutex), 64);
+    sx_assert_always(mutex);
+    sx_mutex_init(mutex);
+    return mutex;
+}
+
+static void mutex_destroy(void* mutex, const sx_alloc* alloc)
+{
+    sx_mutex_release(mutex);
+    sx_aligned_free(alloc, mutex, 64);
+}
+
+static void mutex_enter(void* mutex)
+{
+    sx_mutex_enter(mutex);
+}
+
+static void mutex_exit(void* mutex)
+{
+    sx_mutex_exit(mutex);
+}
+
+static const bench_lock_api k_mutex_api = { mutex_create, mutex_destroy, mutex_enter,
+                                            mutex_exit, NULL };
+
+//
+// sx_rwlock
+static void* rwlock_create_with(const sx_alloc* alloc, bool prefer_writers)
+{
+    sx_rwlock* lock = sx_aligned_malloc(alloc, sizeof(sx_rwlock), 64);
+    sx_assert_always(lock);
+    sx_rwlock_init(lock, prefer_writers);
+    return lock;
+}
+
+static void* rwlock_create(const sx_alloc* alloc)
+{
+    return rwlock_create_with(alloc, false);
+}
+
+static void* rwlock_wp_create(const sx_alloc* alloc)
+{
+    return rwlock_create_with(alloc, true);
+}
+
+static void rwlock_destroy(void* lock, const sx_alloc* alloc)
+{
+    sx_rwlock_release(lock);
+    sx_aligned_free(alloc, lock, 64);
+}
+
+static void rwlock_enter(void* lock)
+{
+    sx_rwlock_write_enter(lock);
+}
+
+static void rwlock_exit(void* lock)
+{
+    sx_rwlock_write_exit(lock);
+}
+
+static void rwlock_read(void* lock, void* dst, const void* src, size_t size)
+{
+    sx_rwlock_read_enter(lock);
+    sx_memcpy(dst, src, size);
+    sx_rwlock_read_exit(lock);
+}
+
+static const bench_lock_api k_rwlock_api = { rwlock_create, rwlock_destroy, rwlock_enter,
+                                             rwlock_exit, rwlock_read };
+static const bench_lock_api k_rwlock_wp_api = { rwlock_wp_create, rwlock_destroy, rwlock_enter,
+                                                rwlock_exit, rwlock_read };
+
+//
+// sx_seqlock
+static void* seqlock_create(const sx_alloc* alloc)
+{
+    sx_seqlock* lock = sx_aligned_malloc(alloc, sizeof(sx_seqlock), 64);
+    sx_assert_always(lock);
+    sx_seqlock_init(lock);
+    return lock;
+}
+
+static void seqlock_destroy(void* lock, const sx_alloc* alloc)
+{
+    sx_aligned_free(alloc, lock, 64);
+}
+
+static void seqlock_enter(void* lock)
+{
+    sx_seqlock_write_enter(lock);
+}
+
+static void seqlock_exit(void* lock)
+{
+    sx_seqlock_write_exit(lock);
+}
+
+static void seqlock_read(void* lock, void* dst, const void* src, size_t size)
+{
+    sx_seqlock_read(lock, dst, src, size);
+}
+
+static const bench_lock_api k_seqlock_api = { seqlock_create, seqlock_destroy, seqlock_enter,
+                                              seqlock_exit, seqlock_read };
+
+static const bench_desc k_benchmarks[] = {
+    { "spinlock", &k_spinlock_api, 0 },
+    { "adaptive", &k_adaptive_api, 0 },
+    { "mutex", &k_mutex_api, 0 },
+    { "mutex_90r", &k_mutex_api, 90 },
+    { "rwlock_90r", &k_rwlock_api, 90 },
+    { "rwlock_wp_90r", &k_rwlock_wp_api, 90 },
+    { "seqlock_90r", &k_seqlock_api, 90 },
+};
+#define NUM_BENCHMARKS (int)(sizeof(k_benchmarks) / sizeof(k_benchmarks[0]))
+
+static const bench_column k_columns[] = {
+    { "threads", "threads", BENCH_COLUMN_INT, 7 },
+    { "ops", "ops", BENCH_COLUMN_INT, 10 },
+    { "time(ms)", "time_ms", BENCH_COLUMN_FLOAT, 10 },
+    { "mops/s", "mops_per_sec", BENCH_COLUMN_FLOAT, 10 },
+    { "valid", "valid", BENCH_COLUMN_BOOL, 6 },
+};
+
+static volatile uint32_t g_sink;
+
+static uint32_t work(uint32_t seed)
+{
+    uint32_t h = seed | 1;
+    for (int i = 0; i < WORK_ITERS; i++) {
+        h ^= h << 13;
+        h ^= h >> 17;
+        h ^= h << 5;
+    }
+    return h;
+}
+
+static int worker_thread_fn(void* user1, void* user2)
+{
+    bench_context* bench = user1;
+    const bench_lock_api* api = bench->desc->api;
+    int read_pct = bench->desc->read_pct;
+    uint32_t h = (uint32_t)(uintptr_t)user2;
+    uint64_t snapshot[SHARED_DATA_SIZE];
+
+    while (!sx_atomic_load32_explicit(&bench->start, SX_ATOMIC_MEMORYORDER_ACQUIRE))
+        sx_thread_yield();
+
+    for (int i = 0; i < bench->ops_per_thread; i++) {
+        if ((i % 100) < read_pct) {
+            if (api->read) {
+                api->read(bench->lock, snapshot, bench->data, sizeof(snapshot));
+            } else {
+                api->enter(bench->lock);
+                sx_memcpy(snapshot, bench->data, sizeof(snapshot));
+                api->exit(bench->lock);
+            }
+
+            for (int k = 1; k < SHARED_DATA_SIZE; k++) {
+                if (snapshot[k] != snapshot[0]) {
+                    sx_atomic_fetch_add32(&bench->num_inconsistent_reads, 1);
+                    break;
+                }
+            }
+        } else {
+            api->enter(bench->lock);
+            for (int k = 0; k < SHARED_DATA_SIZE; k++)
+                bench->data[k]++;
+            api->exit(bench->lock);
+        }
+        h = work(h);
+    }
+
+    g_sink = h;
+    return 0;
+}
+
+static bool run_benchmark(int index, int threads, int num_ops, bench_value* values)
+{
+    const bench_desc* desc = &k_benchmarks[index];
+    const sx_alloc* alloc = sx_alloc_malloc();
+    bench_context bench = { .desc = desc,
+                            .lock = desc->api->create(alloc),
+                            .ops_per_thread = sx_max(num_ops / threads, 1) };
+    int total_ops = bench.ops_per_thread * threads;
+
+    sx_thread** thrds = sx_malloc(alloc, sizeof(sx_thread*) * (size_t)threads);
+    sx_assert_always(thrds);
+    for (int i = 0; i < threads; i++) {
+        thrds[i] =
+            sx_thread_create(alloc, worker_thread_fn, &bench, 0, "worker", (void*)(uintptr_t)i);
+    }
+
+    uint64_t start_tm = sx_tm_now();
+    sx_atomic_store32_explicit(&bench.start, 1, SX_ATOMIC_MEMORYORDER_RELEASE);
+    for (int i = 0; i < threads; i++)
+        sx_thread_destroy(thrds[i], alloc);
+    double ms = sx_tm_ms(sx_tm_since(start_tm));
+
+    sx_free(alloc, thrds);
+    desc->api->destroy(bench.lock, alloc);
+
+    int writes_per_thread = 0;
+    for (int i = 0; i < bench.ops_per_thread; i++)
+        writes_per_thread += (i % 100) >= desc->read_pct ? 1 : 0;
+
+    bool valid = bench.num_inconsistent_reads == 0;
+    for (int k = 0; k < SHARED_DATA_SIZE; k++)
+        valid = valid && bench.data[k] == (uint64_t)writes_per_thread * (uint64_t)threads;
+
+    values[0].i = threads;
+    values[1].i = total_ops;
+    values[2].f = ms;
+    values[3].f = (double)total_ops / (ms * 1000.0);
+    values[4].b = valid;
+    return valid;
+}
+
+static const char* benchmark_name(int index)
+{
+    return k_benchmarks[index].name;
+}
+
+static const bench_suite k_suite = {
+    .name = benchmark_name,
+    .run = run_benchmark,
+    .num_benchmarks = NUM_BENCHMARKS,
+    .columns = k_columns,
+    .num_columns = (int)(sizeof(k_columns) / sizeof(bench_column)),
+    .threads_opt = 't',
+    .threads_name = "threads",
+    .threads_help = "maximum number of threads (default: num cores)",
+    .count_name = "ops",
+    .count_help = "number of lock operations for each benchmark (default: 1000000)",
+    .default_count = 1000000,
+};
+
+int main(int argc, char* argv[])
+{
+    return bench_main(argc, argv, &k_suite);
+}
@@ -0,0 +1,197 @@
+#include "bench.h"
+
+#include "sx/allocator.h"
+#include "sx/cmdline.h"
+#include "sx/os.h"
+#include "sx/string.h"
+#include "sx/timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef enum bench_format {
+    BENCH_FORMAT_TABLE = 0,
+    BENCH_FORMAT_CSV,
+    BENCH_FORMAT_JSON
+} bench_format;
+
+static void print_result(const bench_suite* suite, const char* name, const bench_value* values,
+                         bench_format format, bool first)
+{
+    switch (format) {
+    case BENCH_FORMAT_TABLE:
+        if (first) {
+            printf("%-20s", "benchmark");
+            for (int i = 0; i < suite->num_columns; i++)
+                printf(" %*s", suite->columns[i].width, suite->columns[i].title);
+            puts("");
+        }
+        printf("%-20s", name);
+        for (int i = 0; i < suite->num_columns; i++) {
+            const bench_column* col = &suite->columns[i];
+            switch (col->type) {
+            case BENCH_COLUMN_INT:
+                printf(" %*d", col->width, values[i].i);
+                break;
+            case BENCH_COLUMN_FLOAT:
+                printf(" %*.2f", col->width, values[i].f);
+                break;
+            case BENCH_COLUMN_BOOL:
+                printf(" %*s", col->width, values[i].b ? "yes" : "NO");
+                break;
+            }
+        }
+        puts("");
+        break;
+    case BENCH_FORMAT_CSV:
+        if (first) {
+            printf("benchmark");
+            for (int i = 0; i < suite->num_columns; i++)
+                printf(",%s", suite->columns[i].key);
+            puts("");
+        }
+        printf("%s", name);
+        for (int i = 0; i < suite->num_columns; i++) {
+            switch (suite->columns[i].type) {
+            case BENCH_COLUMN_INT:
+                printf(",%d", values[i].i);
+                break;
+            case BENCH_COLUMN_FLOAT:
+                printf(",%.3f", values[i].f);
+                break;
+            case BENCH_COLUMN_BOOL:
+                printf(",%d", values[i].b ? 1 : 0);
+                break;
+            }
+        }
+        puts("");
+        break;
+    case BENCH_FORMAT_JSON:
+        printf("%s\n    {\"benchmark\": \"%s\"", first ? "[" : ",", name);
+        for (int i = 0; i < suite->num_columns; i++) {
+            const bench_column* col = &suite->columns[i];
+            switch (col->type) {
+            case BENCH_COLUMN_INT:
+                printf(", \"%s\": %d", col->key, values[i].i);
+                break;
+            case BENCH_COLUMN_FLOAT:
+                printf(", \"%s\": %.3f", col->key, values[i].f);
+                break;
+            case BENCH_COLUMN_BOOL:
+                printf(", \"%s\": %s", col->key, values[i].b ? "true" : "false");
+                break;
+            }
+        }
+        printf("}");
+        break;
+    }
+    fflush(stdout);
+}
+
+int bench_main(int argc, char* argv[], const bench_suite* suite)
+{
+    sx_assert(suite->num_columns <= BENCH_MAX_COLUMNS);
+
+    const sx_alloc* alloc = sx_alloc_malloc();
+    int max_threads = sx_os_numcores();
+    int count = suite->default_count;
+    const char* filter = NULL;
+    bench_format format = BENCH_FORMAT_TABLE;
+
+    const sx_cmdline_opt opts[] = {
+        { "help", 'h', SX_CMDLINE_OPTYPE_NO_ARG, 0x0, 'h', "print this help text", 0x0 },
+        { suite->threads_name, suite->threads_opt, SX_CMDLINE_OPTYPE_REQUIRED, 0x0,
+          suite->threads_opt, suite->threads_help, "N" },
+        { suite->count_name, 'n', SX_CMDLINE_OPTYPE_REQUIRED, 0x0, 'n', suite->count_help, "N" },
+        { "bench", 'b', SX_CMDLINE_OPTYPE_REQUIRED, 0x0, 'b', "only run this benchmark", "NAME" },
+        { "format", 'f', SX_CMDLINE_OPTYPE_REQUIRED, 0x0, 'f',
+          "output format: table (default), csv, json", "FORMAT" },
+        SX_CMDLINE_OPT_END
+    };
+    sx_cmdline_context* cmdline = sx_cmdline_create_context(alloc, argc, (const char**)argv, opts);
+
+    int opt;
+    const char* arg;
+    bool quit = false;
+    int result = 0;
+    while (!quit && (opt = sx_cmdline_next(cmdline, NULL, &arg)) != -1) {
+        if (opt == suite->threads_opt) {
+            max_threads = sx_max(atoi(arg), 1);
+            continue;
+        }
+
+        switch (opt) {
+        case 'n':
+            count = sx_max(atoi(arg), 1);
+            break;
+        case 'b':
+            filter = arg;
+            break;
+        case 'f':
+            if (sx_strequal(arg, "csv")) {
+                format = BENCH_FORMAT_CSV;
+            } else if (sx_strequal(arg, "json")) {
+                format = BENCH_FORMAT_JSON;
+            } else if (!sx_strequal(arg, "table")) {
+                printf("unknown format: %s\n", arg);
+                quit = true;
+                result = -1;
+            }
+            break;
+        case 'h': {
+            char buffer[2048];
+            puts(sx_cmdline_create_help_string(cmdline, buffer, sizeof(buffer)));
+            puts("benchmarks:");
+            for (int i = 0; i < suite->num_benchmarks; i++)
+                printf("\t%s\n", suite->name(i));
+            quit = true;
+            break;
+        }
+        case '+':
+        case '?':
+        case '!':
+            printf("invalid argument: %s\n", arg);
+            quit = true;
+            result = -1;
+            break;
+        default:
+            break;
+        }
+    }
+    sx_cmdline_destroy_context(cmdline, alloc);
+    if (quit)
+        return result;
+
+    // nothing is written for unknown benchmarks, so json output is never left half written
+    if (filter) {
+        bool found = false;
+        for (int i = 0; i < suite->num_benchmarks && !found; i++)
+            found = sx_strequal(filter, suite->name(i));
+        if (!found) {
+            printf("unknown benchmark: %s\n", filter);
+            return -1;
+        }
+    }
+
+    sx_tm_init();
+
+    bool first = true;
+    for (int i = 0; i < suite->num_benchmarks; i++) {
+        const char* name = suite->name(i);
+        if (filter && !sx_strequal(filter, name))
+            continue;
+        int num_threads = suite->max_threads ? suite->max_threads(i, max_threads) : max_threads;
+        for (int threads = 1; threads <= num_threads; threads++) {
+            bench_value values[BENCH_MAX_COLUMNS];
+            if (!suite->run(i, threads, count, values))
+                result = -1;
+            print_result(suite, name, values, format, first);
+            first = false;
+        }
+    }
+
+    if (format == BENCH_FORMAT_JSON)
+        puts(first ? "[]" : "\n]");
+
+    return result;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "sx/sx.h"
+
+// Shared driver of the benchmark suites (bench-*.c)
+// A suite declares it's result columns and a run callback, the driver parses the command line,
+// runs every benchmark (or the one that is selected with -b) with 1..N threads and prints the
+// results as a table, csv or json. Output of csv and json is meant for scripts that compare
+// revisions and catch regressions
+// Common options:
+//      -<threads_opt> N    maximum number of threads (cores, ...) to run the benchmarks with
+//      -n N                number of samples/items/ops for each benchmark (suite's count)
+//      -b NAME             only run this benchmark, unknown names fail before anything is written
+//      -f FORMAT           output format: table (default), csv, json
+
+#define BENCH_MAX_COLUMNS 8
+
+typedef enum bench_column_type {
+    BENCH_COLUMN_INT = 0,
+    BENCH_COLUMN_FLOAT,
+    BENCH_COLUMN_BOOL
+} bench_column_type;
+
+typedef struct bench_column {
+    const char* title;    // table header, ex. "time(ms)"
+    const char* key;      // csv header and json key, ex. "time_ms"
+    bench_column_type type;
+    int width;            // table column width
+} bench_column;
+
+typedef union bench_value {
+    int i;
+    double f;
+    bool b;
+} bench_value;
+
+typedef struct bench_suite {
+    const char* (*name)(int index);
+    // runs benchmark `index` and fills one value per column, returns false if the result is not
+    // valid (the program fails then)
+    bool (*run)(int index, int threads, int count, bench_value* values);
+    int (*max_threads)(int index, int max_threads);    // optional limit for each benchmark
+    int num_benchmarks;
+    const bench_column* columns;
+    int num_columns;
+
+    char threads_opt;            // -t, -c, ...
+    const char* threads_name;    // long option
+    const char* threads_help;
+    const char* count_name;      // long option of -n
+    const char* count_help;
+    int default_count;
+} bench_suite;
+
+// returns the exit code of the program
+int bench_main(int argc, char* argv[], const bench_suite* suite);
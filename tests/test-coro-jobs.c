@@ -0,0 +1,154 @@
+#include "sx/allocator.h"
+#include "sx/atomic.h"
+#include "sx/fiber.h"
+#include "sx/jobs.h"
+#include "sx/os.h"
+#include "sx/timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Runs script-like coroutines that do some work between yields and waits, first on a single
+// threaded context, then on a context that resumes them with jobs. Every coroutine also invokes
+// a child coroutine from inside, which is done from the worker threads in the second run
+// Both contexts also check that waits count from the exact accumulated time, when the update
+// time step is shorter than the wait
+// usage: test-coro-jobs [num_threads] [num_coros]
+//      num_threads: number of worker threads (default: num_cores - 1)
+//      num_coros: number of coroutines (default: 5000)
+
+#define NUM_STEPS 8
+#define WORK_ITERS 5000
+#define NUM_WAKES 5
+
+typedef struct coro_data {
+    sx_coro_context* ctx;
+    sx_atomic_uint32 num_steps;
+    sx_atomic_uint32 num_ended;
+    sx_atomic_uint32 num_children;
+} coro_data;
+
+static uint32_t work(uint32_t seed)
+{
+    uint32_t h = seed;
+    for (int i = 0; i < WORK_ITERS; i++) {
+        h ^= h << 13;
+        h ^= h >> 17;
+        h ^= h << 5;
+    }
+    return h;
+}
+
+static volatile uint32_t g_sink;
+
+sx_coro_declare(child)
+{
+    coro_data* d = sx_coro_userdata();
+    sx_coro_yield(d->ctx);
+    sx_atomic_fetch_add32(&d->num_children, 1);
+    sx_coro_end(d->ctx);
+}
+
+sx_coro_declare(script)
+{
+    coro_data* d = sx_coro_userdata();
+    for (int i = 0; i < NUM_STEPS; i++) {
+        g_sink = work((uint32_t)i + 1);
+        sx_atomic_fetch_add32(&d->num_steps, 1);
+        if (i == NUM_STEPS / 2)
+            sx_coro_invoke(d->ctx, child, d);
+
+        if (i % 2)
+            sx_coro_wait(d->ctx, 10);
+        else
+            sx_coro_yield(d->ctx);
+    }
+    sx_atomic_fetch_add32(&d->num_ended, 1);
+    sx_coro_end(d->ctx);
+}
+
+typedef struct wake_data {
+    sx_coro_context* ctx;
+    int update;
+    int num_wakes;
+    int wake_updates[NUM_WAKES];
+} wake_data;
+
+sx_coro_declare(wake)
+{
+    wake_data* d = sx_coro_userdata();
+    for (int i = 0; i < NUM_WAKES; i++) {
+        sx_coro_wait(d->ctx, 1);
+        d->wake_updates[d->num_wakes++] = d->update;
+    }
+    sx_coro_end(d->ctx);
+}
+
+// 1ms waits with 0.9ms updates continue on every other update: 2, 4, 6, ...
+static bool check_wakes(sx_coro_context* ctx)
+{
+    wake_data d = { .ctx = ctx };
+    sx_coro_invoke(ctx, wake, &d);
+    while (d.num_wakes < NUM_WAKES && d.update < NUM_WAKES * 4) {
+        ++d.update;
+        sx_coro_update(ctx, 0.0009f);
+    }
+
+    bool ok = d.num_wakes == NUM_WAKES;
+    for (int i = 0; i < d.num_wakes; i++)
+        ok = ok && d.wake_updates[i] == (i + 1) * 2;
+    if (!ok)
+        puts("Error: waits are not resumed on every other update");
+    return ok;
+}
+
+static bool run(sx_coro_context* ctx, int num_coros, const char* name)
+{
+    coro_data d = { .ctx = ctx };
+    uint64_t start_tm = sx_tm_now();
+    for (int i = 0; i < num_coros; i++) {
+        sx_coro_invoke(ctx, script, &d);
+    }
+
+    int num_updates = 0;
+    while (d.num_ended < (uint32_t)num_coros || d.num_children < (uint32_t)num_coros) {
+        sx_coro_update(ctx, 0.005f);
+        ++num_updates;
+    }
+
+    printf("%s: %d coroutines, %d updates, %.1f ms\n", name, num_coros, num_updates,
+           sx_tm_ms(sx_tm_since(start_tm)));
+    return d.num_steps == (uint32_t)(num_coros * NUM_STEPS);
+}
+
+int main(int argc, char* argv[])
+{
+    int num_threads = argc > 1 ? atoi(argv[1]) : (sx_os_numcores() - 1);
+    int num_coros = argc > 2 ? atoi(argv[2]) : 5000;
+
+    sx_tm_init();
+    const sx_alloc* alloc = sx_alloc_malloc();
+
+    sx_coro_context* ctx = sx_coro_create_context(alloc, 256, 64 * 1024);
+    bool ok = run(ctx, num_coros, "single thread") && check_wakes(ctx);
+    sx_coro_destroy_context(ctx);
+
+    sx_job_context* job_ctx =
+        sx_job_create_context(alloc, &(sx_job_context_desc){ .num_threads = num_threads });
+    if (!job_ctx) {
+        puts("Error: sx_job_create_context failed!");
+        return -1;
+    }
+
+    ctx = sx_coro_create_context_jobs(alloc, 256, 64 * 1024, job_ctx);
+    char name[32];
+    snprintf(name, sizeof(name), "jobs (%d workers)", sx_job_num_worker_threads(job_ctx));
+    ok = run(ctx, num_coros, name) && check_wakes(ctx) && ok;
+    sx_coro_destroy_context(ctx);
+
+    sx_job_destroy_context(job_ctx, alloc);
+    sx_fiber_stack_cache_trim();
+
+    puts(ok ? "OK" : "FAILED");
+    return ok ? 0 : -1;
+}
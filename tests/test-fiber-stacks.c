@@ -0,0 +1,146 @@
+#include "sx/allocator.h"
+#include "sx/fiber.h"
+#include "sx/os.h"
+#include "sx/timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Spawns many fibers on growable stacks, each one recursing to a different depth before it
+// yields back, then reports the reserved and committed memory of all stacks
+// Then creates and ends coroutines at high rate in two contexts that share the global stack cache
+// usage: test-fiber-stacks [num_fibers] [max_stack_kb]
+//      num_fibers: number of fibers that are alive at the same time (default: 10000)
+//      max_stack_kb: reserved virtual memory for each stack in kb (default: 1024)
+
+#define FRAME_SIZE 1024
+#define MAX_DEPTH 64
+#define NUM_CHURN_ROUNDS 1000
+#define NUM_CHURN_COROS 32
+
+typedef struct fiber_data {
+    sx_fiber_stack stack;
+    sx_fiber_t fiber;
+    int depth;
+    int result;
+} fiber_data;
+
+static int recurse(int depth)
+{
+    volatile uint8_t frame[FRAME_SIZE];
+    frame[0] = (uint8_t)depth;
+    frame[FRAME_SIZE - 1] = (uint8_t)depth;
+    return depth > 0 ? (recurse(depth - 1) + frame[0] - frame[FRAME_SIZE - 1] + 1) : 0;
+}
+
+static void fiber_fn(sx_fiber_transfer transfer)
+{
+    fiber_data* d = transfer.user;
+    d->result = recurse(d->depth);
+    transfer = sx_fiber_switch(transfer.from, NULL);    // stay alive until main resumes us
+    sx_fiber_switch(transfer.from, NULL);
+}
+
+typedef struct coro_data {
+    sx_coro_context* ctx;
+    int depth;
+    int num_ended;
+} coro_data;
+
+sx_coro_declare(churn)
+{
+    coro_data* d = sx_coro_userdata();
+    recurse(d->depth);
+    sx_coro_yield(d->ctx);
+    ++d->num_ended;
+    sx_coro_end(d->ctx);
+}
+
+int main(int argc, char* argv[])
+{
+    int num_fibers = argc > 1 ? atoi(argv[1]) : 10000;
+    int max_stack_sz = (argc > 2 ? atoi(argv[2]) : 1024) * 1024;
+
+    const sx_alloc* alloc = sx_alloc_malloc();
+    fiber_data* fibers = sx_malloc(alloc, sizeof(fiber_data) * num_fibers);
+    if (!fibers) {
+        sx_out_of_memory();
+        return -1;
+    }
+
+    int num_created = 0;
+    for (int i = 0; i < num_fibers; i++) {
+        fiber_data* d = &fibers[i];
+        if (!sx_fiber_stack_init_growable(&d->stack, (unsigned int)max_stack_sz, 0)) {
+            printf("Error: could not reserve stack for fiber %d\n", i);
+            break;
+        }
+        // most of the fibers stay shallow and a few of them go deep
+        d->depth = (i % 100) == 0 ? MAX_DEPTH : (i % 8);
+        d->result = -1;
+        d->fiber = sx_fiber_create(d->stack, fiber_fn);
+        d->fiber = sx_fiber_switch(d->fiber, d).from;
+        ++num_created;
+    }
+
+    size_t total_committed = 0;
+    size_t max_usage = 0;
+    bool ok = num_created == num_fibers;
+    for (int i = 0; i < num_created; i++) {
+        fiber_data* d = &fibers[i];
+        size_t usage = sx_fiber_stack_usage(&d->stack);
+        total_committed += sx_fiber_stack_commit_size(&d->stack);
+        max_usage = sx_max(max_usage, usage);
+        ok = ok && d->result == d->depth && usage >= (size_t)d->depth * FRAME_SIZE;
+    }
+
+    double reserved_mb = (double)num_created * (double)max_stack_sz / (1024.0 * 1024.0);
+    printf("fibers: %d\n", num_created);
+    printf("reserved: %.1f mb\n", reserved_mb);
+    printf("committed: %.1f mb (%.1f kb per fiber)\n",
+           (double)total_committed / (1024.0 * 1024.0),
+           num_created > 0 ? (double)total_committed / (1024.0 * num_created) : 0.0);
+    printf("max usage: %.1f kb\n", (double)max_usage / 1024.0);
+
+    for (int i = 0; i < num_created; i++) {
+        sx_fiber_switch(fibers[i].fiber, NULL);
+        sx_fiber_stack_release(&fibers[i].stack);
+    }
+    sx_free(alloc, fibers);
+
+    // coroutine churn
+    sx_tm_init();
+    coro_data coros[2];
+    for (int i = 0; i < 2; i++) {
+        coros[i] = (coro_data){ .ctx = sx_coro_create_context(alloc, NUM_CHURN_COROS, 128 * 1024),
+                                .depth = 16 };
+    }
+    uint64_t start_tm = sx_tm_now();
+    for (int r = 0; r < NUM_CHURN_ROUNDS; r++) {
+        for (int i = 0; i < NUM_CHURN_COROS; i++) {
+            sx_coro_invoke(coros[i % 2].ctx, churn, &coros[i % 2]);
+        }
+        sx_coro_update(coros[0].ctx, 0);
+        sx_coro_update(coros[1].ctx, 0);
+    }
+    double churn_tm = sx_tm_ms(sx_tm_since(start_tm));
+
+    // stacks are back in the cache without physical memory
+    sx_fiber_stack stack;
+    sx_fiber_stack_acquire(&stack, 128 * 1024);
+    size_t cached_commit_size = sx_fiber_stack_commit_size(&stack);
+    sx_fiber_stack_recycle(&stack);
+
+    int num_ended = coros[0].num_ended + coros[1].num_ended;
+    printf("coroutines: %d in %.1f ms (cached stack committed: %.1f kb)\n", num_ended, churn_tm,
+           (double)cached_commit_size / 1024.0);
+    ok = ok && num_ended == NUM_CHURN_ROUNDS * NUM_CHURN_COROS &&
+         cached_commit_size < 128 * 1024;
+
+    sx_coro_destroy_context(coros[0].ctx);
+    sx_coro_destroy_context(coros[1].ctx);
+    sx_fiber_stack_cache_trim();
+
+    puts(ok ? "OK" : "FAILED");
+    return ok ? 0 : -1;
+}
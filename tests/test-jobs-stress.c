@@ -0,0 +1,119 @@
+#include "sx/allocator.h"
+#include "sx/atomic.h"
+#include "sx/jobs.h"
+#include "sx/os.h"
+#include "sx/timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Dispatches a large number of jobs at once from multiple producers (one producer job per thread)
+// without waiting in between, so the job pool and the queues have to grow
+// usage: test-jobs-stress [num_threads] [num_jobs] [trace_file]
+//      num_threads: number of worker threads (default: num_cores - 1)
+//      num_jobs: total number of jobs that are dispatched by all producers (default: 100000)
+//      trace_file: saves Chrome trace of the run, library must be built with SX_JOBS_PROFILE=ON
+
+typedef struct producer_data {
+    int num_dispatches;
+    sx_job_t* handles;
+} producer_data;
+
+static sx_job_context* g_ctx;
+static sx_atomic_uint32 g_num_items;
+static sx_atomic_uint32 g_num_calls;
+
+static void item_job_fn(int range_start, int range_end, int thread_index, void* user)
+{
+    sx_unused(thread_index);
+    sx_unused(user);
+    sx_atomic_fetch_add32(&g_num_items, (uint32_t)(range_end - range_start));
+    sx_atomic_fetch_add32(&g_num_calls, 1);
+}
+
+static void producer_job_fn(int range_start, int range_end, int thread_index, void* user)
+{
+    sx_unused(thread_index);
+    producer_data* producers = user;
+    int count = sx_job_num_worker_threads(g_ctx) + 1;    // one job for each thread
+
+    for (int p = range_start; p < range_end; p++) {
+        producer_data* producer = &producers[p];
+        for (int i = 0; i < producer->num_dispatches; i++) {
+            producer->handles[i] =
+                sx_job_dispatch(g_ctx, count, item_job_fn, NULL, SX_JOB_PRIORITY_NORMAL, 0);
+        }
+        for (int i = 0; i < producer->num_dispatches; i++) {
+            sx_job_wait_and_del(g_ctx, producer->handles[i]);
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int num_threads = argc > 1 ? atoi(argv[1]) : (sx_os_numcores() - 1);
+    int num_jobs = argc > 2 ? atoi(argv[2]) : 100000;
+    const char* trace_file = argc > 3 ? argv[3] : NULL;
+    if (num_threads < 1)
+        num_threads = 1;
+
+    sx_tm_init();
+    const sx_alloc* alloc = sx_alloc_malloc();
+    // small pages, so the job pool grows a lot
+    g_ctx = sx_job_create_context(alloc, &(sx_job_context_desc){ .num_threads = num_threads,
+                                                                 .max_fibers = 64,
+                                                                 .max_handles = 65536 });
+    if (!g_ctx) {
+        puts("Error: sx_job_create_context failed!");
+        return -1;
+    }
+
+    int num_producers = num_threads + 1;
+    int count = num_threads + 1;
+    int num_dispatches = (num_jobs / count + num_producers - 1) / num_producers;
+    if (num_dispatches * num_producers > 65536) {
+        puts("Error: too many jobs, handles exceeded!");
+        return -1;
+    }
+
+    producer_data* producers = sx_malloc(alloc, sizeof(producer_data) * num_producers);
+    sx_assert_always(producers);
+    for (int i = 0; i < num_producers; i++) {
+        producers[i].num_dispatches = num_dispatches;
+        producers[i].handles = sx_malloc(alloc, sizeof(sx_job_t) * num_dispatches);
+        sx_assert_always(producers[i].handles);
+    }
+
+    printf("jobs: %d worker threads, %d producers, %d jobs\n", num_threads, num_producers,
+           num_dispatches * num_producers * count);
+
+    uint64_t start_tm = sx_tm_now();
+    sx_job_t job = sx_job_dispatch(g_ctx, num_producers, producer_job_fn, producers,
+                                   SX_JOB_PRIORITY_HIGH, 0);
+    sx_job_wait_and_del(g_ctx, job);
+    double elapsed = sx_tm_ms(sx_tm_since(start_tm));
+
+    uint32_t expected_items = (uint32_t)(num_dispatches * num_producers * count);
+    bool ok = g_num_items == expected_items && g_num_calls == expected_items &&
+              sx_job_num_handles(g_ctx) == 0;
+    printf("%s: %u items, %u calls (expected %u), %d handles alive, %.1f ms\n",
+           ok ? "OK" : "FAILED", g_num_items, g_num_calls, expected_items,
+           sx_job_num_handles(g_ctx), elapsed);
+
+    if (trace_file) {
+        for (int i = 0; i < num_threads + 1; i++) {
+            sx_job_profile_stats stats = sx_job_profile_thread_stats(g_ctx, i);
+            printf("thread #%d: %u jobs, %u steals, %u waits, busy: %.1f ms, idle: %.1f ms\n", i,
+                   stats.counts[SX_JOB_PROFILE_START], stats.counts[SX_JOB_PROFILE_STEAL],
+                   stats.counts[SX_JOB_PROFILE_WAIT], stats.busy_ms, stats.idle_ms);
+        }
+        if (!sx_job_profile_save_trace(g_ctx, trace_file))
+            printf("Error: could not save trace (is SX_JOBS_PROFILE enabled?): %s\n", trace_file);
+    }
+
+    for (int i = 0; i < num_producers; i++)
+        sx_free(alloc, producers[i].handles);
+    sx_free(alloc, producers);
+    sx_job_destroy_context(g_ctx, alloc);
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,142 @@
+#include "sx/allocator.h"
+#include "sx/atomic.h"
+#include "sx/jobs.h"
+#include "sx/os.h"
+#include "sx/timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Jobs contend on sx_job_mutex, sx_job_sem and sx_job_event while they also dispatch and wait
+// on sub-jobs inside the locked regions, which would deadlock the workers with threads.h locks
+// usage: test-jobs-sync [num_threads] [num_jobs]
+//      num_threads: number of worker threads (default: num_cores - 1), 0 runs everything on main
+//      num_jobs: number of jobs for each test (default: 2000)
+
+#define MAX_CONCURRENT 3
+
+static sx_job_context* g_ctx;
+static sx_job_mutex g_mutex;
+static sx_job_sem g_sem;
+static sx_job_event g_event;
+static int g_shared;    // protected by g_mutex
+static sx_atomic_uint32 g_num_inside;
+static sx_atomic_uint32 g_num_over_limit;
+static sx_atomic_uint32 g_num_passed;
+
+static void sub_job_fn(int range_start, int range_end, int thread_index, void* user)
+{
+    sx_unused(range_start);
+    sx_unused(range_end);
+    sx_unused(thread_index);
+    sx_unused(user);
+    sx_os_sleep(0);
+}
+
+static void mutex_job_fn(int range_start, int range_end, int thread_index, void* user)
+{
+    sx_unused(thread_index);
+    sx_unused(user);
+    for (int i = range_start; i < range_end; i++) {
+        sx_job_mutex_lock(g_ctx, g_mutex) {
+            int value = g_shared;
+            // wait while holding the lock, the other jobs that are trying to lock get suspended
+            if ((i % 16) == 0) {
+                sx_job_wait_and_del(g_ctx, sx_job_dispatch(g_ctx, 2, sub_job_fn, NULL,
+                                                           SX_JOB_PRIORITY_HIGH, 0));
+            }
+            g_shared = value + 1;
+        }
+    }
+}
+
+static void sem_job_fn(int range_start, int range_end, int thread_index, void* user)
+{
+    sx_unused(thread_index);
+    sx_unused(user);
+    for (int i = range_start; i < range_end; i++) {
+        sx_job_sem_wait(g_ctx, &g_sem);
+        if (sx_atomic_fetch_add32(&g_num_inside, 1) >= MAX_CONCURRENT)
+            sx_atomic_fetch_add32(&g_num_over_limit, 1);
+
+        sx_job_wait_and_del(g_ctx, sx_job_dispatch(g_ctx, 1, sub_job_fn, NULL,
+                                                   SX_JOB_PRIORITY_HIGH, 0));
+
+        sx_atomic_fetch_sub32(&g_num_inside, 1);
+        sx_job_sem_post(g_ctx, &g_sem, 1);
+    }
+}
+
+static void event_job_fn(int range_start, int range_end, int thread_index, void* user)
+{
+    sx_unused(thread_index);
+    sx_unused(user);
+    for (int i = range_start; i < range_end; i++) {
+        sx_job_event_wait(g_ctx, &g_event);
+        sx_atomic_fetch_add32(&g_num_passed, 1);
+    }
+}
+
+static void event_set_job_fn(int range_start, int range_end, int thread_index, void* user)
+{
+    sx_unused(range_start);
+    sx_unused(range_end);
+    sx_unused(thread_index);
+    sx_unused(user);
+    sx_os_sleep(10);
+    sx_job_event_set(g_ctx, &g_event);
+}
+
+int main(int argc, char* argv[])
+{
+    int num_threads = argc > 1 ? atoi(argv[1]) : (sx_os_numcores() - 1);
+    int num_jobs = argc > 2 ? atoi(argv[2]) : 2000;
+
+    sx_tm_init();
+
+    const sx_alloc* alloc = sx_alloc_malloc();
+    g_ctx = sx_job_create_context(alloc, &(sx_job_context_desc){ .num_threads = num_threads });
+    if (!g_ctx) {
+        puts("Error: sx_job_create_context failed!");
+        return -1;
+    }
+    printf("jobs: %d worker threads\n", sx_job_num_worker_threads(g_ctx));
+
+    sx_job_mutex_init(&g_mutex);
+    sx_job_sem_init(&g_sem, MAX_CONCURRENT);
+    sx_job_event_init(&g_event, false);
+
+    // mutex
+    sx_job_t job = sx_job_dispatch(g_ctx, num_jobs, mutex_job_fn, NULL, SX_JOB_PRIORITY_NORMAL, 0);
+    sx_job_wait_and_del(g_ctx, job);
+    printf("mutex: %d/%d\n", g_shared, num_jobs);
+
+    // semaphore
+    job = sx_job_dispatch(g_ctx, num_jobs, sem_job_fn, NULL, SX_JOB_PRIORITY_NORMAL, 0);
+    sx_job_wait_and_del(g_ctx, job);
+    printf("semaphore: %u jobs over the limit of %d\n", g_num_over_limit, MAX_CONCURRENT);
+
+    // event: waiters are suspended until the low priority job sets the event
+    job = sx_job_dispatch(g_ctx, num_jobs, event_job_fn, NULL, SX_JOB_PRIORITY_HIGH, 0);
+    sx_job_t set_job = sx_job_dispatch(g_ctx, 1, event_set_job_fn, NULL, SX_JOB_PRIORITY_LOW, 0);
+    sx_job_wait_and_del(g_ctx, job);
+    sx_job_wait_and_del(g_ctx, set_job);
+    printf("event: %u/%d\n", g_num_passed, num_jobs);
+
+    // main thread waits outside of jobs
+    sx_job_event_reset(&g_event);
+    set_job = sx_job_dispatch(g_ctx, 1, event_set_job_fn, NULL, SX_JOB_PRIORITY_NORMAL, 0);
+    sx_job_event_wait(g_ctx, &g_event);
+    sx_job_wait_and_del(g_ctx, set_job);
+
+    bool ok = g_shared == num_jobs && g_num_over_limit == 0 &&
+              g_num_passed == (uint32_t)num_jobs && sx_job_event_test(&g_event);
+
+    sx_job_event_release(&g_event);
+    sx_job_sem_release(&g_sem);
+    sx_job_mutex_release(&g_mutex);
+    sx_job_destroy_context(g_ctx, alloc);
+
+    puts(ok ? "OK" : "FAILED");
+    return ok ? 0 : -1;
+}
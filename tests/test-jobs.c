@@ -47,6 +47,15 @@ static void job_fib_fn(int range_start, int range_end, int thread_index, void* u
     sx_job_wait_and_del(g_ctx, job);
 }
 
+static void job_print_fn(int range_start, int range_end, int thread_index, void* user)
+{
+    uint32_t* results = user;
+    puts("Results: ");
+    for (int i = 0; i < 16; i++) {
+        printf("\t%u\n", results[i]);
+    }
+}
+
 int main(int argc, char* argv[])
 {
     const sx_alloc* alloc = sx_alloc_malloc();
@@ -66,14 +75,18 @@ int main(int argc, char* argv[])
     puts("Dispatching jobs ...");
     sx_job_t jhandle = sx_job_dispatch(ctx, 16, job_fib_fn, results, 0, 0);
 
+    // print job only starts after all fib jobs are finished
+    sx_job_t print_handle = sx_job_dispatch_desc(
+        ctx, &(sx_job_desc){ .count = 1,
+                             .callback = job_print_fn,
+                             .user = results,
+                             .deps = &jhandle,
+                             .num_deps = 1 });
+
     puts("Waiting ...");
+    sx_job_wait_and_del(ctx, print_handle);
     sx_job_wait_and_del(ctx, jhandle);
 
-    puts("Results: ");
-    for (int i = 0; i < 16; i++) {
-        printf("\t%u\n", results[i]);
-    }
-
     sx_job_destroy_context(ctx, alloc);
     sx_os_getch();
     return 0;